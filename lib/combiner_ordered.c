@@ -1,195 +1,270 @@
 #include "libtrace.h"
 #include "libtrace_int.h"
 #include "data-struct/deque.h"
+#include "data-struct/spsc_ring.h"
 #include <assert.h>
 #include <stdlib.h>
 
 /* TODO hook up configuration option for sequentual packets again */
 
+/* Results from each perpkt thread go through a lock-free ring of this size.
+ * Once it is full they spill into a deque, the reporter may be waiting on
+ * another thread before it can drain this one so we must never block. */
+#define RESULT_RING_SIZE 4096
+
+/* A result which did not fit in the ring, seq is its position in the
+ * thread's output so the reporter can tell if the ring still holds results
+ * published before it */
+struct overflow_result {
+	libtrace_result_t res;	// First, see pause()
+	uint64_t seq;
+};
+
+struct ordered_queue {
+	/* Written by the perpkt thread. The ring carries pointers into slots,
+	 * RESULT_RING_SIZE + 1 of them so the slot the reporter is copying
+	 * from can never be reused underneath it */
+	libtrace_spsc_ring_t ring;
+	libtrace_result_t *slots;
+	uint64_t ring_written;
+	libtrace_queue_t overflow;
+	volatile uint64_t published;
+
+	/* Owned by the reporter */
+	volatile uint64_t consumed ALIGN_STRUCT(CACHE_LINE_SIZE);
+	uint64_t ring_read;
+	bool has_head;		// Set iff this queue is in the heap
+	libtrace_result_t head;	// The next result to go out from this queue
+};
+
+struct ordered_combiner {
+	struct ordered_queue *queues;
+	int nb_queues;
+	/* A binary min-heap of queues which have a head, keyed by head.key */
+	int *heap;
+	int heap_size;
+};
+
 static int init_combiner(libtrace_t *t, libtrace_combine_t *c) {
 	int i = 0;
+	struct ordered_combiner *oc;
 	assert(trace_get_perpkt_threads(t) > 0);
-	libtrace_queue_t *queues;
-	c->queues = calloc(sizeof(libtrace_queue_t), trace_get_perpkt_threads(t));
-	queues = c->queues;
-	for (i = 0; i < trace_get_perpkt_threads(t); ++i) {
-		libtrace_deque_init(&queues[i], sizeof(libtrace_result_t));
+
+	oc = calloc(1, sizeof(struct ordered_combiner));
+	oc->nb_queues = trace_get_perpkt_threads(t);
+	oc->queues = calloc(sizeof(struct ordered_queue), oc->nb_queues);
+	oc->heap = calloc(sizeof(int), oc->nb_queues);
+	for (i = 0; i < oc->nb_queues; ++i) {
+		struct ordered_queue *q = &oc->queues[i];
+		/* Neither side ever waits on the ring */
+		libtrace_spsc_ring_init(&q->ring, RESULT_RING_SIZE,
+		                        LIBTRACE_SPSC_RING_POLLING);
+		q->slots = calloc(sizeof(libtrace_result_t), RESULT_RING_SIZE + 1);
+		libtrace_deque_init(&q->overflow, sizeof(struct overflow_result));
 	}
+	c->queues = oc;
 	return 0;
 }
 
 static void publish(libtrace_t *trace, int t_id, libtrace_combine_t *c, libtrace_result_t *res) {
-	libtrace_queue_t *queue = &((libtrace_queue_t*)c->queues)[t_id];
-	//while (libtrace_deque_get_size(&t->deque) >= 1000)
-	//	sched_yield();
-	libtrace_deque_push_back(queue, res); // Automatically locking for us :)
+	struct ordered_combiner *oc = c->queues;
+	struct ordered_queue *q = &oc->queues[t_id];
+
+	/* Once we have spilled everything must follow into the deque until
+	 * the reporter empties it, so the ring only ever holds results
+	 * older than those in the deque */
+	if (libtrace_deque_get_size(&q->overflow) == 0 &&
+	    !libtrace_spsc_ring_is_full(&q->ring)) {
+		libtrace_result_t *slot;
+		slot = &q->slots[q->ring_written % (RESULT_RING_SIZE + 1)];
+		*slot = *res;
+		libtrace_spsc_ring_write(&q->ring, slot);
+		q->ring_written++;
+	} else {
+		struct overflow_result o = {*res, q->published};
+		libtrace_deque_push_back(&q->overflow, &o);
+	}
+	q->published++;
 
-	if (libtrace_deque_get_size(queue) >= trace->config.reporter_thold) {
+	if (q->published - q->consumed >= trace->config.reporter_thold) {
 		trace_post_reporter(trace);
 	}
 }
 
-inline static int peek_queue(libtrace_t *trace, libtrace_combine_t *c,
-                libtrace_queue_t *v, uint64_t *key, libtrace_result_t *peeked) {
+static void publish_bulk(libtrace_t *trace, int t_id, libtrace_combine_t *c, libtrace_result_t *res, size_t nb_results) {
+	struct ordered_combiner *oc = c->queues;
+	struct ordered_queue *q = &oc->queues[t_id];
+	void *slots[64];
+	size_t i = 0, j, nb;
+
+	if (libtrace_deque_get_size(&q->overflow) == 0) {
+		nb = libtrace_spsc_ring_get_free(&q->ring);
+		if (nb > nb_results)
+			nb = nb_results;
+		/* The free count includes the slots, so fill them then
+		 * publish a batch at a time */
+		while (i < nb) {
+			for (j = 0; j < 64 && i < nb; j++, i++) {
+				libtrace_result_t *slot;
+				slot = &q->slots[q->ring_written++ % (RESULT_RING_SIZE + 1)];
+				*slot = res[i];
+				slots[j] = slot;
+			}
+			libtrace_spsc_ring_write_bulk(&q->ring, slots, j, j);
+		}
+	}
+	for (; i < nb_results; i++) {
+		struct overflow_result o = {res[i], q->published + i};
+		libtrace_deque_push_back(&q->overflow, &o);
+	}
+	q->published += nb_results;
 
-        libtrace_result_t r;
-        if (!peeked) {
-                libtrace_deque_peek_front(v, (void *) &r);
-                peeked = &r;
-        }
+	if (q->published - q->consumed >= trace->config.reporter_thold) {
+		trace_post_reporter(trace);
+	}
+}
 
-        /* Ticks are a bit tricky, because we can get TS
-         * ticks in amongst packets indexed by their cardinal
-         * order and vice versa. Also, every thread will
-         * produce an equivalent tick and we should really
-         * combine those into a single tick for the reporter
-         * thread.
-         */
-
-        if (peeked->type == RESULT_TICK_INTERVAL) {
-                if (peeked->key > c->last_ts_tick) {
-                        c->last_ts_tick = peeked->key;
-
-                        /* Pass straight to reporter */
-                        libtrace_generic_t gt = {.res = peeked};
-                        ASSERT_RET (libtrace_deque_pop_front(v, (void *) peeked), == 1);
-                        send_message(trace, &trace->reporter_thread,
-                                        MESSAGE_RESULT, gt,
-                                        &trace->reporter_thread);
-                        return 0;
-
-                } else {
-                        /* Duplicate -- pop it */
-                        ASSERT_RET (libtrace_deque_pop_front(v, (void *) peeked), == 1);
-                        return 0;
+/* Takes the next result published to a queue, in order */
+static bool take_result(struct ordered_queue *q, libtrace_result_t *r) {
+	libtrace_result_t *slot;
+	struct overflow_result o;
+
+	if (libtrace_spsc_ring_try_read(&q->ring, (void **) &slot)) {
+		/* The slot cannot be reused until we read the next one */
+		*r = *slot;
+		q->ring_read++;
+	} else if (libtrace_deque_peek_front(&q->overflow, &o) &&
+	           o.seq == q->consumed) {
+		ASSERT_RET(libtrace_deque_pop_front(&q->overflow, &o), == 1);
+		*r = o.res;
+	} else {
+		/* Empty, or the ring has results we cannot see yet */
+		return false;
+	}
+	q->consumed++;
+	return true;
+}
+
+/**
+ * Fetches the next result from a queue which must go out in order into
+ * its head, passing ticks straight through to the reporter as they are met.
+ *
+ * @return true if the queue has a head, false if the queue is empty
+ */
+static bool refill_head(libtrace_t *trace, libtrace_combine_t *c,
+                        struct ordered_queue *q) {
+        libtrace_result_t *r = &q->head;
+
+        while (take_result(q, r)) {
+                /* Ticks are a bit tricky, because we can get TS
+                 * ticks in amongst packets indexed by their cardinal
+                 * order and vice versa. Also, every thread will
+                 * produce an equivalent tick and we should really
+                 * combine those into a single tick for the reporter
+                 * thread.
+                 */
+                if (r->type == RESULT_TICK_INTERVAL) {
+                        if (r->key > c->last_ts_tick) {
+                                c->last_ts_tick = r->key;
+
+                                /* Pass straight to reporter */
+                                libtrace_generic_t gt = {.res = r};
+                                send_message(trace, &trace->reporter_thread,
+                                                MESSAGE_RESULT, gt,
+                                                &trace->reporter_thread);
+                        }
+                        /* Otherwise a duplicate -- drop it */
+                        continue;
                 }
-        }
 
-        if (peeked->type == RESULT_TICK_COUNT) {
-                if (peeked->key > c->last_count_tick) {
-                        c->last_count_tick = peeked->key;
+                if (r->type == RESULT_TICK_COUNT) {
+                        if (r->key <= c->last_count_tick) {
+                                /* Duplicate -- drop it */
+                                continue;
+                        }
+                        c->last_count_tick = r->key;
 
                         /* Tick doesn't match packet order */
                         if (trace_is_parallel(trace)) {
                                 /* Pass straight to reporter */
-                                libtrace_generic_t gt = {.res = peeked};
-                                ASSERT_RET (libtrace_deque_pop_front(v, (void *) peeked), == 1);
+                                libtrace_generic_t gt = {.res = r};
                                 send_message(trace, &trace->reporter_thread,
                                                 MESSAGE_RESULT, gt,
                                                 &trace->reporter_thread);
-                                return 0;
+                                continue;
                         }
                         /* Tick matches packet order */
-                        *key = peeked->key;
-                        return 1;
-
-                        /* Tick doesn't match packet order */
-                } else {
-                        /* Duplicate -- pop it */
-                        ASSERT_RET (libtrace_deque_pop_front(v, (void *) peeked), == 1);
-                        return 0;
                 }
+
+                q->has_head = true;
+                return true;
         }
+        return false;
+}
 
-        *key = peeked->key;
-        return 1;
+static inline uint64_t heap_key(struct ordered_combiner *oc, int i) {
+	return oc->queues[oc->heap[i]].head.key;
 }
 
-inline static uint64_t next_message(libtrace_t *trace, libtrace_combine_t *c,
-                libtrace_queue_t *v) {
+static void heap_sift_down(struct ordered_combiner *oc, int i) {
+	int tmp;
+
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= oc->heap_size)
+			break;
+		if (child + 1 < oc->heap_size &&
+		    heap_key(oc, child + 1) < heap_key(oc, child))
+			child++;
+		if (heap_key(oc, i) <= heap_key(oc, child))
+			break;
+		tmp = oc->heap[i];
+		oc->heap[i] = oc->heap[child];
+		oc->heap[child] = tmp;
+		i = child;
+	}
+}
 
-        libtrace_result_t r;
-        uint64_t nextkey = 0;
+static void heap_push(struct ordered_combiner *oc, int queue) {
+	int i = oc->heap_size++;
+	int tmp;
 
-        do {
-                if (libtrace_deque_peek_front(v, (void *) &r) == 0) {
-                        return 0;
-                }
-        } while (peek_queue(trace, c, v, &nextkey, &r) == 0);
-
-        return nextkey;
+	oc->heap[i] = queue;
+	while (i > 0 && heap_key(oc, i) < heap_key(oc, (i - 1) / 2)) {
+		tmp = oc->heap[i];
+		oc->heap[i] = oc->heap[(i - 1) / 2];
+		oc->heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
 }
 
-
 inline static void read_internal(libtrace_t *trace, libtrace_combine_t *c, const bool final){
+	struct ordered_combiner *oc = c->queues;
 	int i;
-	int live_count = 0;
-        libtrace_queue_t *queues = c->queues;
-	bool allactive = true;
-        bool live[trace_get_perpkt_threads(trace)]; // Set if a trace is alive
-	uint64_t key[trace_get_perpkt_threads(trace)]; // Cached keys
-	uint64_t min_key = UINT64_MAX;
-        uint64_t peeked = 0;
-	int min_queue = -1;
-
-	/* Loop through check all are alive (have data) and find the smallest */
-        for (i = 0; i < trace_get_perpkt_threads(trace); ++i) {
-		libtrace_queue_t *v = &queues[i];
-                if (libtrace_deque_get_size(v) != 0 &&
-                                peek_queue(trace, c, v, &peeked, NULL)) {
-                        live_count ++;
-                        live[i] = true;
-                        key[i] = peeked;
-                        if (i == 0 || min_key > peeked) {
-                                min_key = peeked;
-                                min_queue = i;
-                        }
-                } else {
-                        allactive = false;
-                        live[i] = false;
-                        key[i] = 0;
-                }
+
+	/* Give any queue which ran dry last time another chance */
+	for (i = 0; i < oc->nb_queues; ++i) {
+		if (!oc->queues[i].has_head &&
+		    refill_head(trace, c, &oc->queues[i]))
+			heap_push(oc, i);
 	}
 
-	/* Now remove the smallest and loop - special case if all threads have
-	 * joined we always flush what's left. Or the next smallest is the same
-	 * value or less than the previous */
-        while (allactive || (live_count && final)) {
-		/* Get the minimum queue and then do stuff */
-		libtrace_result_t r;
-		libtrace_generic_t gt = {.res = &r};
-
-		ASSERT_RET (libtrace_deque_pop_front(&queues[min_queue], (void *) &r), == 1);
-
-                //printf("%lu %lu %lu %lu %d\n", key[0], key[1], key[2], key[3], min_queue);
-
-                send_message(trace, &trace->reporter_thread,
-                                MESSAGE_RESULT, gt,
-                                NULL);
-
-		// Now update the one we just removed
-                peeked = next_message(trace, c, &queues[min_queue]);
-                if (peeked != 0) {
-
-                        key[min_queue] = peeked;
-                        // We are still the smallest, might be out of order :(
-                        if (key[min_queue] <= min_key) {
-                                min_key = key[min_queue];
-                        } else {
-                                min_key = key[min_queue]; // Update our minimum
-                                // Check all find the smallest again - all are alive
-                                for (i = 0; i < trace_get_perpkt_threads(trace); ++i) {
-                                        if (live[i] && min_key >= key[i]) {
-                                                min_key = key[i];
-                                                min_queue = i;
-                                        }
-                                }
-                        }
-		} else {
-			allactive = false;
-                        live[min_queue] = false;
-                        key[min_queue] = 0;
-			live_count--;
-			min_key = UINT64_MAX; // Update our minimum
-                        min_queue = -1;
-			// Check all find the smallest again - all are alive
-			for (i = 0; i < trace_get_perpkt_threads(trace); ++i) {
-				if (live[i] && min_key >= key[i]) {
-					min_key = key[i];
-					min_queue = i;
-				}
-			}
+	/* Now remove the smallest and loop, while every thread has a result
+	 * waiting we know the smallest is next - special case if all threads
+	 * have joined we always flush what's left */
+	while (oc->heap_size == oc->nb_queues || (oc->heap_size && final)) {
+		struct ordered_queue *q = &oc->queues[oc->heap[0]];
+		libtrace_generic_t gt = {.res = &q->head};
+
+		send_message(trace, &trace->reporter_thread,
+		             MESSAGE_RESULT, gt, NULL);
+
+		q->has_head = false;
+		if (!refill_head(trace, c, q)) {
+			/* This queue has run dry, drop it from the heap */
+			oc->heap[0] = oc->heap[--oc->heap_size];
 		}
+		heap_sift_down(oc, 0);
 	}
 }
 
@@ -198,37 +273,51 @@ static void read(libtrace_t *trace, libtrace_combine_t *c) {
 }
 
 static void read_final(libtrace_t *trace, libtrace_combine_t *c) {
+	struct ordered_combiner *oc = c->queues;
         int empty = 0, i;
-        libtrace_queue_t *q = c->queues;
 
         do {
                 read_internal(trace, c, true);
                 empty = 0;
-		for (i = 0; i < trace_get_perpkt_threads(trace); ++i) {
-                        if (libtrace_deque_get_size(&q[i]) == 0)
+		for (i = 0; i < oc->nb_queues; ++i) {
+                        if (oc->queues[i].published == oc->queues[i].consumed)
                                 empty ++;
                 }
         }
-        while (empty < trace_get_perpkt_threads(trace));
+        while (empty < oc->nb_queues || oc->heap_size);
 }
 
-static void destroy(libtrace_t *trace, libtrace_combine_t *c) {
+static void destroy(libtrace_t *trace UNUSED, libtrace_combine_t *c) {
+	struct ordered_combiner *oc = c->queues;
 	int i;
-	libtrace_queue_t *queues = c->queues;
 
-	for (i = 0; i < trace_get_perpkt_threads(trace); i++) {
-		assert(libtrace_deque_get_size(&queues[i]) == 0);
+	for (i = 0; i < oc->nb_queues; i++) {
+		assert(oc->queues[i].published == oc->queues[i].consumed);
+		assert(!oc->queues[i].has_head);
+		libtrace_spsc_ring_destroy(&oc->queues[i].ring);
+		free(oc->queues[i].slots);
+		libtrace_deque_destroy(&oc->queues[i].overflow);
 	}
-	free(queues);
-	queues = NULL;
+	free(oc->queues);
+	free(oc->heap);
+	free(oc);
+	c->queues = NULL;
 }
 
 
-static void pause(libtrace_t *trace, libtrace_combine_t *c) {
-	libtrace_queue_t *queues = c->queues;
+static void pause(libtrace_t *trace UNUSED, libtrace_combine_t *c) {
+	struct ordered_combiner *oc = c->queues;
+	uint64_t j;
 	int i;
-	for (i = 0; i < trace_get_perpkt_threads(trace); i++) {
-		libtrace_deque_apply_function(&queues[i], (deque_data_fn) libtrace_make_result_safe);
+
+	/* The perpkt threads are paused, so nothing is being published */
+	for (i = 0; i < oc->nb_queues; i++) {
+		struct ordered_queue *q = &oc->queues[i];
+		if (q->has_head)
+			libtrace_make_result_safe(&q->head);
+		for (j = q->ring_read; j < q->ring_written; j++)
+			libtrace_make_result_safe(&q->slots[j % (RESULT_RING_SIZE + 1)]);
+		libtrace_deque_apply_function(&q->overflow, (deque_data_fn) libtrace_make_result_safe);
 	}
 }
 
@@ -242,5 +331,6 @@ DLLEXPORT const libtrace_combine_t combiner_ordered = {
 	NULL,			/* queues */
         0,                      /* last_count_tick */
         0,                      /* last_ts_tick */
-	{0}				/* opts */
+	{0},			/* opts */
+	publish_bulk		/* publish_bulk */
 };
@@ -3,85 +3,340 @@
 #include "data-struct/vector.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+/* Once this many runs have been spilled they are merged into one, so we
+ * don't run out of file descriptors */
+#define MAX_RUNS 64
+/* Buffer size used when reading and writing runs */
+#define RUN_BUFFER_SIZE (1 << 16)
+
+/* A result waiting to be sent, either held in memory (run == -1) or the
+ * next result from a run spilled to disk */
+struct sorted_entry {
+	libtrace_result_t res;
+	int run;
+};
+
+/* A sorted run of results written out to a temporary file */
+struct sorted_run {
+	FILE *file;	// NULL if this run is finished with
+	uint64_t remaining;
+};
+
+struct sorted_combiner {
+	/* Written by the perpkt threads */
+	libtrace_vector_t *queues;
+	uint64_t *watermarks;	// The last tick key seen from each thread
+	int nb_queues;
+
+	/* Owned by the reporter */
+	libtrace_vector_t incoming;
+	/* A binary min-heap by res.key of everything not yet sent */
+	struct sorted_entry *heap;
+	size_t heap_size;
+	size_t heap_max;
+	size_t in_memory;	// Entries in the heap with run == -1
+	size_t window;		// Max in_memory before we spill, 0 for no limit
+	struct sorted_run runs[MAX_RUNS];
+	int nb_runs;
+};
 
 static int init_combiner(libtrace_t *t, libtrace_combine_t *c) {
 	int i = 0;
+	struct sorted_combiner *sc;
 	assert(trace_get_perpkt_threads(t) > 0);
-	libtrace_vector_t *queues;
-	c->queues = calloc(sizeof(libtrace_vector_t), trace_get_perpkt_threads(t));
-	queues = c->queues;
-	for (i = 0; i < trace_get_perpkt_threads(t); ++i) {
-		libtrace_vector_init(&queues[i], sizeof(libtrace_result_t));
+
+	sc = calloc(1, sizeof(struct sorted_combiner));
+	sc->nb_queues = trace_get_perpkt_threads(t);
+	sc->queues = calloc(sizeof(libtrace_vector_t), sc->nb_queues);
+	sc->watermarks = calloc(sizeof(uint64_t), sc->nb_queues);
+	for (i = 0; i < sc->nb_queues; ++i) {
+		libtrace_vector_init(&sc->queues[i], sizeof(libtrace_result_t));
 	}
+	libtrace_vector_init(&sc->incoming, sizeof(libtrace_result_t));
+	sc->window = c->configuration.uint64;
+	c->queues = sc;
 	return 0;
 }
 
-static void publish(libtrace_t *trace UNUSED, int t_id, libtrace_combine_t *c, libtrace_result_t *res) {
-	libtrace_vector_t *vec = &((libtrace_vector_t*)c->queues)[t_id];
+static void publish(libtrace_t *trace, int t_id, libtrace_combine_t *c, libtrace_result_t *res) {
+	struct sorted_combiner *sc = c->queues;
+	libtrace_vector_t *vec = &sc->queues[t_id];
+
+	if (res->type == RESULT_TICK_INTERVAL ||
+	    res->type == RESULT_TICK_COUNT) {
+		/* Ticks are not passed on, but tell us this thread has
+		 * published everything before them. Released after the
+		 * results so the reporter will see those first. */
+		if (res->key > sc->watermarks[t_id]) {
+			__atomic_store_n(&sc->watermarks[t_id], res->key,
+			                 __ATOMIC_RELEASE);
+			trace_post_reporter(trace);
+		}
+		return;
+	}
+
 	libtrace_vector_push_back(vec, res);
+	if (libtrace_vector_get_size(vec) >= trace->config.reporter_thold) {
+		trace_post_reporter(trace);
+	}
+}
+
+static void heap_sift_down(struct sorted_combiner *sc, size_t i) {
+	struct sorted_entry tmp;
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= sc->heap_size)
+			break;
+		if (child + 1 < sc->heap_size &&
+		    sc->heap[child + 1].res.key < sc->heap[child].res.key)
+			child++;
+		if (sc->heap[i].res.key <= sc->heap[child].res.key)
+			break;
+		tmp = sc->heap[i];
+		sc->heap[i] = sc->heap[child];
+		sc->heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void heap_push(struct sorted_combiner *sc, libtrace_result_t *res, int run) {
+	struct sorted_entry tmp;
+	size_t i;
+
+	if (sc->heap_size == sc->heap_max) {
+		sc->heap_max = sc->heap_max ? sc->heap_max * 2 : 1024;
+		sc->heap = realloc(sc->heap, sc->heap_max * sizeof(struct sorted_entry));
+	}
+	i = sc->heap_size++;
+	sc->heap[i].res = *res;
+	sc->heap[i].run = run;
+	while (i > 0 && sc->heap[i].res.key < sc->heap[(i - 1) / 2].res.key) {
+		tmp = sc->heap[i];
+		sc->heap[i] = sc->heap[(i - 1) / 2];
+		sc->heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
 }
 
-static void read(libtrace_t *trace UNUSED, libtrace_combine_t *c UNUSED){
-	return;
+/* Removes the smallest entry from the heap, if it came from a run the
+ * next result from that run takes its place */
+static void heap_pop(struct sorted_combiner *sc) {
+	struct sorted_entry *top = &sc->heap[0];
+
+	if (top->run == -1) {
+		sc->in_memory--;
+	} else {
+		struct sorted_run *run = &sc->runs[top->run];
+		if (run->remaining) {
+			ASSERT_RET(fread(&top->res, sizeof(top->res), 1, run->file), == 1);
+			run->remaining--;
+			heap_sift_down(sc, 0);
+			return;
+		}
+		fclose(run->file);
+		run->file = NULL;
+		sc->nb_runs--;
+	}
+	sc->heap[0] = sc->heap[--sc->heap_size];
+	heap_sift_down(sc, 0);
 }
 
-static int compare_result(const void* p1, const void* p2)
+static int compare_entry(const void* p1, const void* p2)
 {
-	const libtrace_result_t * r1 = p1;
-	const libtrace_result_t * r2 = p2;
-	if (r1->key < r2->key)
+	const struct sorted_entry * r1 = p1;
+	const struct sorted_entry * r2 = p2;
+	if (r1->res.key < r2->res.key)
 		return -1;
-	if (r1->key == r2->key)
+	if (r1->res.key == r2->res.key)
 		return 0;
 	else
 		return 1;
 }
 
-static void pause(libtrace_t *trace, libtrace_combine_t *c) {
-	libtrace_vector_t *queues = c->queues;
+/* Starts writing a new run, returns the run number or -1 on failure */
+static int new_run(struct sorted_combiner *sc) {
 	int i;
-	for (i = 0; i < trace_get_perpkt_threads(trace); ++i) {
-		libtrace_vector_apply_function(&queues[i], (vector_data_fn) libtrace_make_result_safe);
+
+	for (i = 0; i < MAX_RUNS; i++) {
+		if (sc->runs[i].file == NULL)
+			break;
+	}
+	assert(i < MAX_RUNS);
+	sc->runs[i].file = tmpfile();
+	if (!sc->runs[i].file) {
+		perror("combiner_sorted failed to create a temporary file, "
+		       "no longer limiting memory use");
+		sc->window = 0;
+		return -1;
 	}
+	setvbuf(sc->runs[i].file, NULL, _IOFBF, RUN_BUFFER_SIZE);
+	sc->runs[i].remaining = 0;
+	return i;
 }
 
-static void read_final(libtrace_t *trace, libtrace_combine_t *c) {
-	libtrace_vector_t *queues = c->queues;
-	int i;
-	size_t a;
-	// Combine all results into queue 1
-	for (i = 1; i < trace_get_perpkt_threads(trace); ++i)
-	{
-		libtrace_vector_append(&queues[0],&queues[i]);
+static void write_result(struct sorted_combiner *sc, int run, libtrace_result_t *res) {
+	/* Copy out anything pointing into a format's buffers, which
+	 * might be gone by the time we read this back */
+	libtrace_make_result_safe(res);
+	ASSERT_RET(fwrite(res, sizeof(*res), 1, sc->runs[run].file), == 1);
+	sc->runs[run].remaining++;
+}
+
+/* Rewinds a run we have finished writing and adds its first result
+ * to the heap */
+static void finish_run(struct sorted_combiner *sc, int run) {
+	libtrace_result_t res;
+
+	if (sc->runs[run].remaining == 0) {
+		fclose(sc->runs[run].file);
+		sc->runs[run].file = NULL;
+		return;
+	}
+	ASSERT_RET(fflush(sc->runs[run].file), == 0);
+	rewind(sc->runs[run].file);
+	ASSERT_RET(fread(&res, sizeof(res), 1, sc->runs[run].file), == 1);
+	sc->runs[run].remaining--;
+	sc->nb_runs++;
+	heap_push(sc, &res, run);
+}
+
+/**
+ * The reorder window is full, so write everything held in memory out to
+ * disk as a sorted run.
+ *
+ * If we already have MAX_RUNS runs, everything including the existing
+ * runs is merged into a single new run instead.
+ */
+static void spill(struct sorted_combiner *sc) {
+	size_t i, j;
+	int run = new_run(sc);
+
+	if (run == -1)
+		return;
+
+	if (sc->nb_runs == MAX_RUNS - 1) {
+		while (sc->heap_size) {
+			write_result(sc, run, &sc->heap[0].res);
+			heap_pop(sc);
+		}
+		finish_run(sc, run);
+		return;
+	}
+
+	/* Move the in memory entries to the end of the heap's array */
+	for (i = 0, j = sc->heap_size; i < j;) {
+		if (sc->heap[i].run == -1) {
+			struct sorted_entry tmp = sc->heap[i];
+			sc->heap[i] = sc->heap[--j];
+			sc->heap[j] = tmp;
+		} else {
+			i++;
+		}
+	}
+	qsort(&sc->heap[j], sc->heap_size - j, sizeof(struct sorted_entry),
+	      compare_entry);
+	for (i = j; i < sc->heap_size; i++)
+		write_result(sc, run, &sc->heap[i].res);
+
+	/* Rebuild the heap from the run heads left behind */
+	sc->heap_size = j;
+	sc->in_memory = 0;
+	for (i = sc->heap_size / 2; i-- > 0;)
+		heap_sift_down(sc, i);
+	finish_run(sc, run);
+}
+
+/* Moves everything the perpkt threads have published into the heap */
+static void collect_results(struct sorted_combiner *sc) {
+	libtrace_result_t *res;
+	size_t i;
+	int t;
+
+	for (t = 0; t < sc->nb_queues; t++) {
+		libtrace_vector_append(&sc->incoming, &sc->queues[t]);
+		res = (libtrace_result_t *) sc->incoming.elements;
+		for (i = 0; i < sc->incoming.size; i++) {
+			heap_push(sc, &res[i], -1);
+			sc->in_memory++;
+			if (sc->window && sc->in_memory > sc->window)
+				spill(sc);
+		}
+		libtrace_vector_empty(&sc->incoming);
 	}
-	// Sort them
-	libtrace_vector_qsort(&queues[0], compare_result);
+}
 
-	for (a = 0; a < libtrace_vector_get_size(&queues[0]); ++a) {
-		libtrace_result_t r;
+/* Sends every result with a key before limit, or everything if final */
+static void send_results(libtrace_t *trace, struct sorted_combiner *sc,
+                         uint64_t limit, bool final) {
+	while (sc->heap_size && (final || sc->heap[0].res.key < limit)) {
+		libtrace_result_t r = sc->heap[0].res;
 		libtrace_generic_t gt = {.res = &r};
-		ASSERT_RET (libtrace_vector_get(&queues[0], a, (void *) &r), == 1);
-		if (r.type == RESULT_TICK_INTERVAL ||
-                                r.type == RESULT_TICK_COUNT) {
-                        /* Ticks are essentially useless for this combiner? */
-                        continue;
-                }
-                send_message(trace, &trace->reporter_thread, MESSAGE_RESULT,
-                                gt, NULL);
+
+		heap_pop(sc);
+		send_message(trace, &trace->reporter_thread, MESSAGE_RESULT,
+		             gt, NULL);
 	}
-	libtrace_vector_empty(&queues[0]);
 }
 
-static void destroy(libtrace_t *trace, libtrace_combine_t *c) {
+static void read(libtrace_t *trace, libtrace_combine_t *c) {
+	struct sorted_combiner *sc = c->queues;
+	uint64_t watermark = UINT64_MAX;
+	int i;
+
+	/* Every thread has published all results before its last tick, so
+	 * anything before the oldest of those is ready. These must be read
+	 * before collecting or we could miss results they cover. */
+	for (i = 0; i < sc->nb_queues; ++i) {
+		uint64_t mark = __atomic_load_n(&sc->watermarks[i],
+		                                __ATOMIC_ACQUIRE);
+		if (mark < watermark)
+			watermark = mark;
+	}
+	collect_results(sc);
+	send_results(trace, sc, watermark, false);
+}
+
+static void pause(libtrace_t *trace UNUSED, libtrace_combine_t *c) {
+	struct sorted_combiner *sc = c->queues;
+	size_t j;
+	int i;
+
+	for (i = 0; i < sc->nb_queues; ++i) {
+		libtrace_vector_apply_function(&sc->queues[i], (vector_data_fn) libtrace_make_result_safe);
+	}
+	/* Spilled results were made safe as they were written */
+	for (j = 0; j < sc->heap_size; ++j) {
+		if (sc->heap[j].run == -1)
+			libtrace_make_result_safe(&sc->heap[j].res);
+	}
+}
+
+static void read_final(libtrace_t *trace, libtrace_combine_t *c) {
+	struct sorted_combiner *sc = c->queues;
+
+	collect_results(sc);
+	send_results(trace, sc, UINT64_MAX, true);
+}
+
+static void destroy(libtrace_t *trace UNUSED, libtrace_combine_t *c) {
+	struct sorted_combiner *sc = c->queues;
 	int i;
-	libtrace_vector_t *queues = c->queues;
 
-	for (i = 0; i < trace_get_perpkt_threads(trace); i++) {
-		assert(libtrace_vector_get_size(&queues[i]) == 0);
-		libtrace_vector_destroy(&queues[i]);
+	assert(sc->heap_size == 0);
+	assert(sc->nb_runs == 0);
+	for (i = 0; i < sc->nb_queues; i++) {
+		assert(libtrace_vector_get_size(&sc->queues[i]) == 0);
+		libtrace_vector_destroy(&sc->queues[i]);
 	}
-	free(queues);
-	queues = NULL;
+	libtrace_vector_destroy(&sc->incoming);
+	free(sc->queues);
+	free(sc->watermarks);
+	free(sc->heap);
+	free(sc);
+	c->queues = NULL;
 }
 
 DLLEXPORT const libtrace_combine_t combiner_sorted = {
@@ -94,5 +349,6 @@ DLLEXPORT const libtrace_combine_t combiner_sorted = {
     NULL,			/* queues */
     0,                          /* last_count_tick */
     0,                          /* last_ts_tick */
-    {0}				/* opts */
+    {0},			/* opts */
+    NULL			/* publish_bulk */
 };
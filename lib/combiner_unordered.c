@@ -25,6 +25,18 @@ static void publish(libtrace_t *trace, int t_id, libtrace_combine_t *c, libtrace
 	}
 }
 
+static void publish_bulk(libtrace_t *trace, int t_id, libtrace_combine_t *c, libtrace_result_t *res, size_t nb_results) {
+	libtrace_queue_t *queue = &((libtrace_queue_t*)c->queues)[t_id];
+	size_t i;
+
+	for (i = 0; i < nb_results; i++)
+		libtrace_deque_push_back(queue, &res[i]);
+
+	if (libtrace_deque_get_size(queue) >= trace->config.reporter_thold) {
+		trace_post_reporter(trace);
+	}
+}
+
 static void read(libtrace_t *trace, libtrace_combine_t *c){
 	libtrace_queue_t *queues = c->queues;
 	int i;
@@ -75,5 +87,6 @@ DLLEXPORT const libtrace_combine_t combiner_unordered = {
     NULL,			/* queues */
     0,                          /* last_count_tick */
     0,                          /* last_ts_tick */
-    {0}				/* opts */
+    {0},			/* opts */
+    publish_bulk		/* publish_bulk */
 };
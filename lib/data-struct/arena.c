@@ -0,0 +1,160 @@
+/**
+ * A per-thread bump allocator with cross thread frees
+ *
+ * Allocation is a pointer bump into the owner's current chunk. Each
+ * allocation is preceded by a pointer to its chunk, so freeing is an
+ * atomic decrement of the chunk's count, the last free pushes the chunk
+ * onto the arena's returned list. The owner takes the whole list in one
+ * exchange when it needs a new chunk, so the list is never popped
+ * concurrently.
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* Allocations are aligned to this, which also holds the chunk pointer */
+#define ARENA_ALIGN 16
+
+struct libtrace_arena_chunk {
+	libtrace_arena_t *arena;
+	libtrace_arena_chunk_t *next;
+	size_t size;		// Bytes in data
+	uint32_t refs;		// Live allocations, plus one while current
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static libtrace_arena_chunk_t *chunk_create(libtrace_arena_t *arena, size_t size) {
+	libtrace_arena_chunk_t *chunk;
+
+	chunk = malloc(sizeof(libtrace_arena_chunk_t) + size);
+	if (!chunk)
+		return NULL;
+	chunk->arena = arena;
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->refs = 0;
+	return chunk;
+}
+
+static void free_chunks(libtrace_arena_chunk_t *chunk) {
+	while (chunk) {
+		libtrace_arena_chunk_t *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+/* Drops a reference, the last one hands the chunk back to its arena */
+static void chunk_release(libtrace_arena_chunk_t *chunk) {
+	libtrace_arena_t *arena = chunk->arena;
+
+	if (__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	/* Oversized chunks are only used for a single allocation */
+	if (chunk->size != arena->chunk_size) {
+		free(chunk);
+		return;
+	}
+	chunk->next = __atomic_load_n(&arena->returned, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&arena->returned, &chunk->next,
+	                                    chunk, true, __ATOMIC_RELEASE,
+	                                    __ATOMIC_RELAXED));
+}
+
+/* Finishes with the current chunk and moves to a new one */
+static int next_chunk(libtrace_arena_t *arena) {
+	libtrace_arena_chunk_t *chunk;
+
+	if (arena->current)
+		chunk_release(arena->current);
+	arena->current = NULL;
+
+	if (!arena->spare)
+		arena->spare = __atomic_exchange_n(&arena->returned, NULL,
+		                                   __ATOMIC_ACQUIRE);
+	if (arena->spare) {
+		chunk = arena->spare;
+		arena->spare = chunk->next;
+	} else {
+		chunk = chunk_create(arena, arena->chunk_size);
+		if (!chunk)
+			return -1;
+	}
+	chunk->refs = 1;
+	arena->current = chunk;
+	arena->offset = 0;
+	return 0;
+}
+
+/**
+ * Creates an arena which allocates memory in chunks of chunk_size bytes.
+ */
+DLLEXPORT void libtrace_arena_init(libtrace_arena_t *arena, size_t chunk_size) {
+	libtrace_zero_arena(arena);
+	arena->chunk_size = (chunk_size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+DLLEXPORT void libtrace_zero_arena(libtrace_arena_t *arena) {
+	arena->current = NULL;
+	arena->offset = 0;
+	arena->chunk_size = 0;
+	arena->spare = NULL;
+	arena->returned = NULL;
+}
+
+/**
+ * Frees the chunks held by an arena. Every allocation must have been freed
+ * already, otherwise the chunk it belongs to is leaked.
+ */
+DLLEXPORT void libtrace_arena_destroy(libtrace_arena_t *arena) {
+	if (arena->current && __atomic_sub_fetch(&arena->current->refs, 1,
+	                                         __ATOMIC_ACQ_REL) == 0)
+		free(arena->current);
+	free_chunks(arena->spare);
+	free_chunks(__atomic_exchange_n(&arena->returned, NULL, __ATOMIC_ACQUIRE));
+	libtrace_zero_arena(arena);
+}
+
+/**
+ * Allocates size bytes, only the thread owning the arena may call this.
+ *
+ * @return The memory, aligned to 16 bytes, or NULL if out of memory
+ */
+DLLEXPORT void *libtrace_arena_alloc(libtrace_arena_t *arena, size_t size) {
+	libtrace_arena_chunk_t *chunk;
+	size_t need = ARENA_ALIGN + ((size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1));
+	char *p;
+
+	if (need > arena->chunk_size) {
+		/* Too big to share a chunk */
+		chunk = chunk_create(arena, need);
+		if (!chunk)
+			return NULL;
+		chunk->refs = 1;
+		p = chunk->data;
+	} else {
+		if (!arena->current ||
+		    arena->offset + need > arena->current->size) {
+			if (next_chunk(arena) != 0)
+				return NULL;
+		}
+		chunk = arena->current;
+		p = chunk->data + arena->offset;
+		arena->offset += need;
+		__atomic_add_fetch(&chunk->refs, 1, __ATOMIC_RELAXED);
+	}
+	*(libtrace_arena_chunk_t **) p = chunk;
+	return p + ARENA_ALIGN;
+}
+
+/**
+ * Frees memory from libtrace_arena_alloc(), this may be called from any
+ * thread.
+ */
+DLLEXPORT void libtrace_arena_free(void *ptr) {
+	if (!ptr)
+		return;
+	chunk_release(*(libtrace_arena_chunk_t **) ((char *) ptr - ARENA_ALIGN));
+}
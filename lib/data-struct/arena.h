@@ -0,0 +1,35 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_ARENA_H
+#define LIBTRACE_ARENA_H
+
+typedef struct libtrace_arena_chunk libtrace_arena_chunk_t;
+
+/**
+ * A bump allocator owned by a single thread, whose allocations may be freed
+ * by any thread.
+ *
+ * Memory is carved out of chunks, each counting its live allocations. Once
+ * a chunk is no longer in use by the owner and its last allocation is freed
+ * the chunk is handed back to the owner to be reused.
+ */
+typedef struct libtrace_arena {
+	/* Owner only */
+	libtrace_arena_chunk_t *current;
+	size_t offset;		// Bytes of current already handed out
+	size_t chunk_size;
+	libtrace_arena_chunk_t *spare;
+
+	/* Chunks handed back by other threads */
+	libtrace_arena_chunk_t *returned ALIGN_STRUCT(CACHE_LINE_SIZE);
+} libtrace_arena_t;
+
+DLLEXPORT void libtrace_arena_init(libtrace_arena_t *arena, size_t chunk_size);
+DLLEXPORT void libtrace_zero_arena(libtrace_arena_t *arena);
+DLLEXPORT void libtrace_arena_destroy(libtrace_arena_t *arena);
+DLLEXPORT void *libtrace_arena_alloc(libtrace_arena_t *arena, size_t size);
+DLLEXPORT void libtrace_arena_free(void *ptr);
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
 #include "buckets.h"
 
 #define MAX_OUTSTANDING (200000)
@@ -15,6 +16,51 @@ static void clear_bucket_node(void *node) {
                 free(bnode->released);
 }
 
+/* Frees the buffer of a node once all its packets have been released, along
+ * with their ids. The node itself stays in the list until it reaches the
+ * front, but no longer holds anything. Called with the lock held. */
+static void retire_bucket_node(libtrace_bucket_t *b,
+                libtrace_bucket_node_t *bnode) {
+
+        uint16_t i;
+
+        for (i = 0; i < bnode->slots; i++) {
+                if (bnode->released[i] == 2) {
+                        int index = i + bnode->startindex;
+                        if (index >= MAX_OUTSTANDING) {
+                                index -= (MAX_OUTSTANDING - 1);
+                        }
+                        b->packets[index] = NULL;
+                }
+        }
+        clear_bucket_node(bnode);
+        bnode->buffer = NULL;
+        bnode->released = NULL;
+        bnode->slots = 0;
+        pthread_cond_signal(&b->cond);
+}
+
+/* Moves nextid on to an id which is not in use. Ids still held by packets
+ * from older buffers are skipped over, so a packet that is kept for a long
+ * time does not stop ids being reused; this only waits if every id is in
+ * use. Called with the lock held. */
+static void next_free_id(libtrace_bucket_t *b) {
+
+        int n;
+
+        for (;;) {
+                for (n = 1; n < MAX_OUTSTANDING; n++) {
+                        if (b->nextid >= MAX_OUTSTANDING)
+                                b->nextid = 1;
+                        if (b->packets[b->nextid] == NULL)
+                                return;
+                        b->nextid ++;
+                }
+                /* No more packet slots available! */
+                pthread_cond_wait(&b->cond, &b->lock);
+        }
+}
+
 DLLEXPORT libtrace_bucket_t *libtrace_bucket_init() {
 
         libtrace_bucket_t *b = (libtrace_bucket_t *) malloc(sizeof(libtrace_bucket_t));
@@ -24,7 +70,7 @@ DLLEXPORT libtrace_bucket_t *libtrace_bucket_init() {
 
         b->nextid = 199999;
         b->node = NULL;
-        b->nodelist = libtrace_list_init(sizeof(libtrace_bucket_node_t));
+        b->nodelist = libtrace_list_init(sizeof(libtrace_bucket_node_t *));
 
         pthread_mutex_init(&b->lock, NULL);
         pthread_cond_init(&b->cond, NULL);
@@ -35,10 +81,14 @@ DLLEXPORT libtrace_bucket_t *libtrace_bucket_init() {
 
 DLLEXPORT void libtrace_bucket_destroy(libtrace_bucket_t *b) {
 
+        libtrace_bucket_node_t *bnode;
+
+        /* Buffers still held by packets are freed too, including the
+         * current one which is the last in the list */
         pthread_mutex_lock(&b->lock);
-        if (b->node) {
-                clear_bucket_node(b->node);
-                free(b->node);
+        while (libtrace_list_pop_front(b->nodelist, &bnode)) {
+                clear_bucket_node(bnode);
+                free(bnode);
         }
 
         libtrace_list_deinit(b->nodelist);
@@ -51,7 +101,7 @@ DLLEXPORT void libtrace_bucket_destroy(libtrace_bucket_t *b) {
 
 DLLEXPORT void libtrace_create_new_bucket(libtrace_bucket_t *b, void *buffer) {
 
-        libtrace_bucket_node_t tmp;
+        libtrace_bucket_node_t *tmp;
         libtrace_bucket_node_t *bnode = (libtrace_bucket_node_t *)malloc(
                         sizeof(libtrace_bucket_node_t));
 
@@ -64,6 +114,9 @@ DLLEXPORT void libtrace_create_new_bucket(libtrace_bucket_t *b, void *buffer) {
                 clear_bucket_node(b->node);
                 libtrace_list_pop_back(b->nodelist, &tmp);
                 free(b->node);
+        } else if (b->node && b->node->activemembers == 0) {
+                /* Every packet has already been released */
+                retire_bucket_node(b, b->node);
         }
         pthread_mutex_unlock(&b->lock);
 
@@ -86,7 +139,7 @@ DLLEXPORT void libtrace_create_new_bucket(libtrace_bucket_t *b, void *buffer) {
 
 DLLEXPORT uint64_t libtrace_push_into_bucket(libtrace_bucket_t *b) {
 
-        uint16_t s;
+        uint64_t s;
         uint64_t ret;
 
         pthread_mutex_lock(&b->lock);
@@ -95,16 +148,8 @@ DLLEXPORT uint64_t libtrace_push_into_bucket(libtrace_bucket_t *b) {
                 return 0;
         }
 
-        if (b->nextid >= MAX_OUTSTANDING)
-                b->nextid = 1;
+        next_free_id(b);
         if (b->node->startindex == 0) {
-
-                while (b->packets[b->nextid] != NULL) {
-                        /* No more packet slots available! */
-                        pthread_cond_wait(&b->cond, &b->lock);
-                        pthread_mutex_unlock(&b->lock);
-
-                }
                 b->node->startindex = b->nextid;
                 b->node->activemembers = 1;
                 b->node->released[0] = 1;
@@ -123,22 +168,26 @@ DLLEXPORT uint64_t libtrace_push_into_bucket(libtrace_bucket_t *b) {
                 s = b->nextid - b->node->startindex;
         }
 
+        /* The span of ids includes any that were skipped */
+        assert(s < UINT16_MAX);
         if (s >= b->node->slots) {
-                b->node->slots += 10;
+                /* Grow geometrically, a buffer of small records can hold
+                 * tens of thousands of packets */
+                uint16_t old = b->node->slots;
+
+                while (s >= b->node->slots) {
+                        if (b->node->slots > UINT16_MAX / 2)
+                                b->node->slots = UINT16_MAX;
+                        else
+                                b->node->slots *= 2;
+                }
                 b->node->released = (uint8_t *)realloc(b->node->released,
                                 b->node->slots * sizeof(uint8_t));
 
-                memset((b->node->released +
-                                (b->node->slots - 10) * sizeof(uint8_t)), 0,
-                                (10 * sizeof(uint8_t)));
+                memset(b->node->released + old, 0,
+                                (b->node->slots - old) * sizeof(uint8_t));
         }
 
-        while (b->packets[b->nextid] != NULL) {
-                /* No more packet slots available! */
-                pthread_cond_wait(&b->cond, &b->lock);
-                pthread_mutex_unlock(&b->lock);
-
-        }
         b->packets[b->nextid] = b->node;
         b->node->activemembers ++;
         b->node->released[s] = 1;
@@ -152,10 +201,10 @@ DLLEXPORT uint64_t libtrace_push_into_bucket(libtrace_bucket_t *b) {
 
 DLLEXPORT void libtrace_release_bucket_id(libtrace_bucket_t *b, uint64_t id) {
 
-        uint16_t s, i;
+        uint16_t s;
         libtrace_bucket_node_t *bnode, *front;
         libtrace_list_node_t *lnode;
-        libtrace_bucket_node_t tmp;
+        libtrace_bucket_node_t *tmp;
 
         assert(id != 0);
 
@@ -189,6 +238,8 @@ DLLEXPORT void libtrace_release_bucket_id(libtrace_bucket_t *b, uint64_t id) {
                         bnode->released[s] = 2;
                 }
                 bnode->activemembers -= 1;
+                if (bnode->activemembers == 0 && bnode != b->node)
+                        retire_bucket_node(b, bnode);
         }
 
         while (libtrace_list_get_size(b->nodelist) > 1) {
@@ -203,20 +254,10 @@ DLLEXPORT void libtrace_release_bucket_id(libtrace_bucket_t *b, uint64_t id) {
                         break;
 
                 assert(lnode->next != NULL);
-                for (i = 0; i < front->slots; i++) {
-                        if (front->released[i] == 2) {
-                                int index = i + front->startindex;
-                                if (index >= MAX_OUTSTANDING) {
-                                        index -= (MAX_OUTSTANDING - 1);
-                                }
-                                b->packets[index] = NULL;
-                        }
-                }
-
-                clear_bucket_node(front);
+                if (front->released)
+                        retire_bucket_node(b, front);
                 libtrace_list_pop_front(b->nodelist, &tmp);
                 free(front);
-                pthread_cond_signal(&b->cond);
 
         }
         pthread_mutex_unlock(&b->lock);
@@ -4,6 +4,13 @@
 #include <pthread.h>
 #include "linked_list.h"
 
+/**
+ * Tracks which packets still refer to a buffer that a format has read a
+ * number of packets into, so the buffer can be freed once all of them have
+ * been released. A buffer holds at most UINT16_MAX packets, and a packet
+ * which is kept does not stop other buffers being freed.
+ */
+
 typedef struct bucket_node {
         uint64_t startindex;
         uint8_t *released;
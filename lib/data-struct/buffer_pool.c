@@ -0,0 +1,176 @@
+/**
+ * A size class allocator for packet buffers
+ *
+ * A large range of address space is reserved up front and slabs are
+ * committed from it in order as they are needed, so whether a buffer
+ * belongs to the pool is a range check and its size class is a lookup by
+ * slab number. Each class keeps a free list threaded through its free
+ * buffers and carves new buffers from its current slab once that is empty.
+ * Slabs are never handed back to the system, freed buffers are reused.
+ */
+
+#include "buffer_pool.h"
+#include "../pthread_spinlock.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#define POOL_SLAB_SHIFT 21	// 2MiB, the size of a x86 hugepage
+#define POOL_SLAB_SIZE ((size_t) 1 << POOL_SLAB_SHIFT)
+#define POOL_MIN_SHIFT 7	// The smallest class is 128 bytes
+#define POOL_MAX_SHIFT 16	// and the largest LIBTRACE_PACKET_BUFSIZE
+#define POOL_NB_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_MAX_SLABS 16384	// 32GiB of address space
+
+struct pool_class {
+	pthread_spinlock_t spin;
+	void *free_list;	// Each free buffer points to the next
+	char *next;		// The uncarved part of the current slab
+	char *end;
+} ALIGN_STRUCT(CACHE_LINE_SIZE);
+
+static struct {
+	char *base;		// NULL if the pool is unavailable
+	size_t nb_slabs;	// Committed so far
+	uint8_t slab_class[POOL_MAX_SLABS];
+	struct pool_class classes[POOL_NB_CLASSES];
+} pool;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void pool_init(void) {
+	int i;
+
+	for (i = 0; i < POOL_NB_CLASSES; i++) {
+		pthread_spin_init(&pool.classes[i].spin, 0);
+		pool.classes[i].free_list = NULL;
+		pool.classes[i].next = pool.classes[i].end = NULL;
+	}
+	pool.base = NULL;
+	pool.nb_slabs = 0;
+#if !defined(WIN32) && defined(MAP_NORESERVE)
+	if (sizeof(void *) >= 8) {
+		char *region;
+		size_t len = POOL_SLAB_SIZE * (POOL_MAX_SLABS + 1);
+		size_t skew;
+
+		region = mmap(NULL, len, PROT_NONE,
+		              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (region == MAP_FAILED)
+			return;
+		/* Trim the region so every slab is hugepage aligned */
+		skew = (POOL_SLAB_SIZE - ((uintptr_t) region & (POOL_SLAB_SIZE - 1)))
+		       & (POOL_SLAB_SIZE - 1);
+		if (skew)
+			munmap(region, skew);
+		munmap(region + skew + POOL_SLAB_SIZE * POOL_MAX_SLABS,
+		       POOL_SLAB_SIZE - skew);
+		pool.base = region + skew;
+	}
+#endif
+}
+
+/* Commits the next slab, the caller holds the lock of the class it is for */
+static char *slab_create(int class) {
+	char *slab = NULL;
+#if !defined(WIN32) && defined(MAP_NORESERVE)
+	size_t i = __atomic_fetch_add(&pool.nb_slabs, 1, __ATOMIC_RELAXED);
+
+	if (i >= POOL_MAX_SLABS)
+		return NULL;
+	slab = pool.base + (i << POOL_SLAB_SHIFT);
+	if (mprotect(slab, POOL_SLAB_SIZE, PROT_READ | PROT_WRITE) != 0)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	/* A hint only, small pages are fine if no hugepage is free */
+	madvise(slab, POOL_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+	pool.slab_class[i] = (uint8_t) class;
+#else
+	(void) class;
+#endif
+	return slab;
+}
+
+static inline bool in_pool(const void *buffer) {
+	return pool.base && (const char *) buffer >= pool.base &&
+	       (const char *) buffer < pool.base + POOL_SLAB_SIZE * POOL_MAX_SLABS;
+}
+
+static inline int class_of(const void *buffer) {
+	return pool.slab_class[((const char *) buffer - pool.base) >> POOL_SLAB_SHIFT];
+}
+
+/**
+ * Allocates a packet buffer of at least size bytes, this may be called
+ * from any thread.
+ *
+ * @param size The bytes required
+ * @return The buffer or NULL if out of memory
+ */
+DLLEXPORT void *libtrace_buffer_pool_alloc(size_t size) {
+	struct pool_class *pc;
+	void *buffer;
+	int class = 0;
+
+	/* Too large for any class, it is reported as 0 bytes like any
+	 * buffer from outside the pool so it will not be reused */
+	if (size > LIBTRACE_PACKET_BUFSIZE)
+		return malloc(size);
+	pthread_once(&pool_once, pool_init);
+	if (!pool.base)
+		return malloc(LIBTRACE_PACKET_BUFSIZE);
+
+	while (((size_t) 1 << (class + POOL_MIN_SHIFT)) < size)
+		class++;
+	pc = &pool.classes[class];
+
+	pthread_spin_lock(&pc->spin);
+	if ((buffer = pc->free_list) != NULL) {
+		pc->free_list = *(void **) buffer;
+	} else {
+		if (pc->next == pc->end) {
+			pc->next = slab_create(class);
+			pc->end = pc->next ? pc->next + POOL_SLAB_SIZE : NULL;
+		}
+		buffer = pc->next;
+		if (buffer)
+			pc->next += (size_t) 1 << (class + POOL_MIN_SHIFT);
+	}
+	pthread_spin_unlock(&pc->spin);
+
+	/* The address space is exhausted, carry on without the pool */
+	if (!buffer)
+		return malloc(LIBTRACE_PACKET_BUFSIZE);
+	return buffer;
+}
+
+/**
+ * Returns a buffer to the pool, this may be called from any thread.
+ */
+DLLEXPORT void libtrace_buffer_pool_free(void *buffer) {
+	struct pool_class *pc;
+
+	if (!in_pool(buffer)) {
+		free(buffer);
+		return;
+	}
+	pc = &pool.classes[class_of(buffer)];
+	pthread_spin_lock(&pc->spin);
+	*(void **) buffer = pc->free_list;
+	pc->free_list = buffer;
+	pthread_spin_unlock(&pc->spin);
+}
+
+/**
+ * @return The usable size of a buffer, which may be more than was asked
+ * for, or 0 if the buffer is not from the pool and its size is unknown
+ */
+DLLEXPORT size_t libtrace_buffer_pool_size(const void *buffer) {
+	if (!in_pool(buffer))
+		return 0;
+	return (size_t) 1 << (class_of(buffer) + POOL_MIN_SHIFT);
+}
@@ -0,0 +1,28 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_BUFFER_POOL_H
+#define LIBTRACE_BUFFER_POOL_H
+
+/**
+ * A process wide pool of packet buffers in power of two size classes, from
+ * 128 bytes up to LIBTRACE_PACKET_BUFSIZE.
+ *
+ * Buffers are carved from 2MiB slabs which are aligned so they can be
+ * backed by a transparent hugepage. Where the pool cannot be set up, e.g.
+ * a 32bit address space, every buffer is malloc()'d LIBTRACE_PACKET_BUFSIZE
+ * bytes as before, but like any other buffer from outside the pool its
+ * size is then reported as 0.
+ *
+ * libtrace_buffer_pool_free() and libtrace_buffer_pool_size() also accept
+ * a buffer which was malloc()'d outside the pool, such as one a user
+ * passes with TRACE_PREP_OWN_BUFFER. Its size is unknown so it is
+ * reported as 0 bytes, and it is passed to free().
+ */
+
+DLLEXPORT void *libtrace_buffer_pool_alloc(size_t size);
+DLLEXPORT void libtrace_buffer_pool_free(void *buffer);
+DLLEXPORT size_t libtrace_buffer_pool_size(const void *buffer);
+
+#endif
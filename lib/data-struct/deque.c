@@ -158,6 +158,18 @@ DLLEXPORT size_t libtrace_deque_get_size(libtrace_queue_t *q)
 #endif
 }
 
+DLLEXPORT void libtrace_deque_destroy(libtrace_queue_t *q)
+{
+	list_node_t *n, *next;
+
+	for (n = q->head; n != NULL; n = next) {
+		next = n->next;
+		free(n);
+	}
+	ASSERT_RET(pthread_mutex_destroy(&q->lock), == 0);
+	libtrace_zero_deque(q);
+}
+
 DLLEXPORT void libtrace_zero_deque(libtrace_queue_t *q)
 {
 	q->head = q->tail = NULL;
@@ -24,6 +24,8 @@ DLLEXPORT int libtrace_deque_peek_tail(libtrace_queue_t *q, void *d);
 DLLEXPORT int libtrace_deque_pop_front(libtrace_queue_t *q, void *d);
 DLLEXPORT int libtrace_deque_pop_tail(libtrace_queue_t *q, void *d);
 DLLEXPORT void libtrace_zero_deque(libtrace_queue_t *q);
+// Frees any items left in the deque, which must no longer be in use
+DLLEXPORT void libtrace_deque_destroy(libtrace_queue_t *q);
 
 // Apply a given function to every data item, while keeping the entire
 // structure locked from external modifications
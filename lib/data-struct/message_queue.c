@@ -2,77 +2,205 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 /**
- * TODO look into using eventfd instead of a pipe if we have it available XXX
+ * Messages are passed through a bounded array of cells, each tagged with
+ * a sequence number saying whether it is ready to be written or read for
+ * a given position (see Dmitry Vyukov's bounded MPMC queue). Any number of
+ * threads may put and get without a lock.
+ *
+ * The fd is only signalled when the reader is armed, i.e. it might be
+ * waiting on the fd. The reader arms itself in get_fd() and get() and
+ * disarms once it gets a message, so a busy reader costs the writers no
+ * system calls. Both sides update their flag and then check the other's,
+ * with a full barrier between, so at least one will see the other.
  */
 
+/* The number of messages a queue can hold before put() blocks */
+#define MESSAGE_QUEUE_SIZE 1024
+
+#define LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define FULL_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define CELL(mq, pos) ((volatile size_t *) &(mq)->cells[((pos) & (mq)->mask) * (mq)->cell_len])
+
 /** 
  * @param mq A pointer to allocated space for a libtrace message queue
- * @param message_len The size in bytes of the message item, to ensure thread safety this
- * 		  should be less than PIPE_BUF (normally at least 512bytes)
- * 		  see: man 7 pipe notes on atomic operations
+ * @param message_len The size in bytes of the message item
  */
-void libtrace_message_queue_init(libtrace_message_queue_t *mq, size_t message_len)
+DLLEXPORT void libtrace_message_queue_init(libtrace_message_queue_t *mq, size_t message_len)
 {
+	size_t i;
+
 	assert(message_len);
-	ASSERT_RET(pipe(mq->pipefd), != -1);
-	mq->message_count = 0;
-	if (message_len > PIPE_BUF)
-		fprintf(stderr, "Warning message queue wont be atomic (thread safe) message_len(%zu) > PIPE_BUF(%d)\n",
-					message_len, PIPE_BUF);
 	mq->message_len = message_len;
-	pthread_spin_init(&mq->spin, 0);
+	mq->cell_len = (sizeof(size_t) + message_len + sizeof(size_t) - 1) &
+	               ~(sizeof(size_t) - 1);
+	mq->mask = MESSAGE_QUEUE_SIZE - 1;
+	mq->cells = malloc(mq->cell_len * MESSAGE_QUEUE_SIZE);
+	assert(mq->cells);
+	for (i = 0; i < MESSAGE_QUEUE_SIZE; i++)
+		*CELL(mq, i) = i;
+	mq->enqueue_pos = 0;
+	mq->dequeue_pos = 0;
+	mq->message_count = 0;
+	mq->armed = 0;
+	mq->signalled = 0;
+#ifdef __linux__
+	mq->fd[0] = mq->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ASSERT_RET(mq->fd[0], != -1);
+#else
+	ASSERT_RET(pipe(mq->fd), != -1);
+	ASSERT_RET(fcntl(mq->fd[0], F_SETFL, O_NONBLOCK), != -1);
+	ASSERT_RET(fcntl(mq->fd[1], F_SETFL, O_NONBLOCK), != -1);
+#endif
+}
+
+/* Makes the fd readable, unless it already is */
+static void signal_fd(libtrace_message_queue_t *mq) {
+	if (!__atomic_exchange_n(&mq->signalled, 1, __ATOMIC_SEQ_CST)) {
+#ifdef __linux__
+		uint64_t one = 1;
+		ASSERT_RET(write(mq->fd[1], &one, sizeof(one)), == sizeof(one));
+#else
+		char one = 1;
+		ASSERT_RET(write(mq->fd[1], &one, sizeof(one)), == sizeof(one));
+#endif
+	}
+}
+
+/* Drains the fd once it has been signalled, so it does not poll as ready
+ * on an empty queue. Only the reader calls this. */
+static void clear_fd(libtrace_message_queue_t *mq) {
+	char buf[64];
+
+	/* The writer sets signalled before writing, if the write has not
+	 * landed yet we leave signalled set and catch it next time */
+	if (read(mq->fd[0], buf, sizeof(buf)) <= 0)
+		return;
+#ifndef __linux__
+	while (read(mq->fd[0], buf, sizeof(buf)) > 0);
+#endif
+	__atomic_store_n(&mq->signalled, 0, __ATOMIC_SEQ_CST);
+	/* A message may have arrived while signalled was still set */
+	if (LOAD_ACQUIRE(mq->message_count) > 0)
+		signal_fd(mq);
+}
+
+/* Tells writers we are about to wait on the fd */
+static void arm(libtrace_message_queue_t *mq) {
+	__atomic_store_n(&mq->armed, 1, __ATOMIC_SEQ_CST);
+	FULL_BARRIER();
+	if (LOAD_ACQUIRE(mq->message_count) > 0)
+		signal_fd(mq);
+	else if (LOAD_ACQUIRE(mq->signalled))
+		clear_fd(mq);
 }
 
 /**
  * Posts a message to the given message queue.
  * 
- * This will block if a reader is not keeping up and the underlying pipe
- * fills up.
+ * This will block if a reader is not keeping up and the queue fills up.
  * 
  * @param mq A pointer to a initilised libtrace message queue structure (NOT NULL)
  * @param message A pointer to the message data you wish to send
- * @return A number representing the number of messages already in the queue,
- *         0 implies a thread was waiting and will read your message, negative
- *         numbers implies threads are still waiting. Positive implies a backlog
- *         of messages.
+ * @return The number of messages in the queue including this one
  */
-int libtrace_message_queue_put(libtrace_message_queue_t *mq, const void *message)
+DLLEXPORT int libtrace_message_queue_put(libtrace_message_queue_t *mq, const void *message)
 {
+	volatile size_t *cell;
+	size_t pos = mq->enqueue_pos;
 	int ret;
+
 	assert(mq->message_len);
-	ASSERT_RET(write(mq->pipefd[1], message, mq->message_len), == (int) mq->message_len);
-	// Update after we've written
-	pthread_spin_lock(&mq->spin);
-	ret = ++mq->message_count; // Should be CAS!
-	pthread_spin_unlock(&mq->spin);
+	for (;;) {
+		intptr_t dif;
+		cell = CELL(mq, pos);
+		dif = (intptr_t) LOAD_ACQUIRE(*cell) - (intptr_t) pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&mq->enqueue_pos, &pos,
+			                                pos + 1, true,
+			                                __ATOMIC_RELAXED,
+			                                __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			/* Full, wait for the reader */
+			sched_yield();
+			pos = mq->enqueue_pos;
+		} else {
+			pos = mq->enqueue_pos;
+		}
+	}
+	memcpy((char *) (cell + 1), message, mq->message_len);
+	STORE_RELEASE(*cell, pos + 1);
+
+	ret = __atomic_add_fetch(&mq->message_count, 1, __ATOMIC_SEQ_CST);
+	FULL_BARRIER();
+	if (LOAD_ACQUIRE(mq->armed))
+		signal_fd(mq);
 	return ret;
 }
 
+/* Takes a message if one is ready, returns false if not */
+static bool dequeue(libtrace_message_queue_t *mq, void *message) {
+	volatile size_t *cell;
+	size_t pos = mq->dequeue_pos;
+
+	for (;;) {
+		intptr_t dif;
+		cell = CELL(mq, pos);
+		dif = (intptr_t) LOAD_ACQUIRE(*cell) - (intptr_t) (pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&mq->dequeue_pos, &pos,
+			                                pos + 1, true,
+			                                __ATOMIC_RELAXED,
+			                                __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return false;
+		} else {
+			pos = mq->dequeue_pos;
+		}
+	}
+	memcpy(message, (char *) (cell + 1), mq->message_len);
+	STORE_RELEASE(*cell, pos + mq->mask + 1);
+	return true;
+}
+
 /**
  * Retrieves a message from the given message queue.
  * 
- * This will block if a reader is not keeping up and the underlying pipe
- * fills up.
+ * This will block until a message is available.
  * 
  * @param mq A pointer to a initilised libtrace message queue structure (NOT NULL)
  * @param message A pointer to the message data you wish to send
- * @return The number of messages remaining in the queue less any threads waiting,
- *         0 implies a thread was waiting and will read your message, negative
- *         numbers implies threads are still waiting. Positive implies a backlog
- *         of messages.
+ * @return The number of messages remaining in the queue
  */
-int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message)
+DLLEXPORT int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message)
 {
+	struct pollfd pfd;
 	int ret;
-	// Safely decrease count first - Yes this might make us negative, however thats ok once a write comes in everything will be fine
-	pthread_spin_lock(&mq->spin);
-	ret = mq->message_count--;
-	pthread_spin_unlock(&mq->spin);
-	ASSERT_RET(read(mq->pipefd[0], message, mq->message_len), == (int) mq->message_len);
+
+	while ((ret = libtrace_message_queue_try_get(mq, message)) == LIBTRACE_MQ_FAILED) {
+		arm(mq);
+		if (LOAD_ACQUIRE(mq->message_count) > 0)
+			continue;
+		pfd.fd = mq->fd[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, 1, -1);
+	}
 	return ret;
 }
 
@@ -84,53 +212,53 @@ int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message)
  * 
  * @param mq A pointer to a initilised libtrace message queue structure (NOT NULL)
  * @param message A pointer to the message data you wish to send
- * @return The number of messages remaining in the queue less any threads waiting,
- *         0 implies a thread was waiting and will read your message, negative
- *         numbers implies threads are still waiting. Positive implies a backlog
- *         of messages.
+ * @return The number of messages remaining in the queue, or
+ *         LIBTRACE_MQ_FAILED
  */
-int libtrace_message_queue_try_get(libtrace_message_queue_t *mq, void *message)
+DLLEXPORT int libtrace_message_queue_try_get(libtrace_message_queue_t *mq, void *message)
 {
 	int ret;
-	// Safely decrease count first - Yes this might make us negative, however thats ok once a write comes in everything will be fine
-	// ->Fast path avoid the lock
-	if (mq->message_count <= 0)
+
+	// ->Fast path avoid touching the queue
+	if (mq->message_count <= 0 || !dequeue(mq, message)) {
+		/* Woken for a message we have already taken */
+		if (mq->signalled && mq->message_count <= 0)
+			clear_fd(mq);
 		return LIBTRACE_MQ_FAILED;
-	// Else grab lock and confirm this is so
-	pthread_spin_lock(&mq->spin);
-	if (mq->message_count > 0) {
-		ret = --mq->message_count;
-		// :( read(...) needs to be done within the *spin* lock otherwise blocking might steal our read
-		ASSERT_RET(read(mq->pipefd[0], message, mq->message_len), == (int) mq->message_len);
-	} else {
-		ret = LIBTRACE_MQ_FAILED;
 	}
-	pthread_spin_unlock(&mq->spin);
+	ret = __atomic_sub_fetch(&mq->message_count, 1, __ATOMIC_SEQ_CST);
+	/* We are busy, no need to wake us until we wait again */
+	if (mq->armed)
+		__atomic_store_n(&mq->armed, 0, __ATOMIC_RELAXED);
 	return ret;
 }
 
-/**
- * May be negative if threads blocking and waiting for a message.
- */
-int libtrace_message_queue_count(const libtrace_message_queue_t *mq)
+DLLEXPORT int libtrace_message_queue_count(const libtrace_message_queue_t *mq)
 {
 	// This is only ok because we know int is atomic
 	return mq->message_count;
 }
 
-void libtrace_message_queue_destroy(libtrace_message_queue_t *mq)
+DLLEXPORT void libtrace_message_queue_destroy(libtrace_message_queue_t *mq)
 {
 	mq->message_count = 0;
 	mq->message_len = 0;
-	close(mq->pipefd[0]);
-	close(mq->pipefd[1]);
-	pthread_spin_destroy(&mq->spin);
+	free(mq->cells);
+	mq->cells = NULL;
+	close(mq->fd[0]);
+#ifndef __linux__
+	close(mq->fd[1]);
+#endif
 }
 
 /**
+ * The fd is only woken for the reader once this is called, call this each
+ * time before waiting on the fd.
+ *
  * @return a file descriptor for the queue, can be used with select() poll() etc.
  */
-int libtrace_message_queue_get_fd(libtrace_message_queue_t *mq)
+DLLEXPORT int libtrace_message_queue_get_fd(libtrace_message_queue_t *mq)
 {
-	return mq->pipefd[0];
+	arm(mq);
+	return mq->fd[0];
 }
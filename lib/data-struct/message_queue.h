@@ -1,25 +1,43 @@
 #include <pthread.h>
 #include <limits.h>
+#include <stdint.h>
 #include "../libtrace.h"
-#include "../pthread_spinlock.h"
 
 #ifndef LIBTRACE_MESSAGE_QUEUE
 #define LIBTRACE_MESSAGE_QUEUE
 
 #define LIBTRACE_MQ_FAILED INT_MIN
+
+/**
+ * A bounded multi-producer queue of fixed size messages held in memory.
+ *
+ * A file descriptor is only used to wake a reader blocked in
+ * libtrace_message_queue_get() or polling the descriptor from
+ * libtrace_message_queue_get_fd(), while the reader is busy messages are
+ * passed without any system calls.
+ */
 typedef struct libtrace_message_queue_t {
-	int pipefd[2];
-	volatile int message_count;
+	/* Set by init and read-only after that */
+	char *cells;		// Each a sequence number followed by a message
+	size_t cell_len;
+	size_t mask;		// Number of cells - 1
 	size_t message_len;
-	pthread_spinlock_t spin;
+	int fd[2];		// The eventfd or a pipe, [0] is polled
+
+	volatile size_t enqueue_pos ALIGN_STRUCT(CACHE_LINE_SIZE);
+	volatile size_t dequeue_pos ALIGN_STRUCT(CACHE_LINE_SIZE);
+
+	volatile int message_count ALIGN_STRUCT(CACHE_LINE_SIZE);
+	volatile int armed;	// The reader may be waiting on the fd
+	volatile int signalled;	// The fd has been (or is about to be) woken
 } libtrace_message_queue_t;
 
-void libtrace_message_queue_init(libtrace_message_queue_t *mq, size_t message_len);
-int libtrace_message_queue_put(libtrace_message_queue_t *mq, const void *message);
-int libtrace_message_queue_count(const libtrace_message_queue_t *mq);
-int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message);
-int libtrace_message_queue_try_get(libtrace_message_queue_t *mq, void *message);
-void libtrace_message_queue_destroy(libtrace_message_queue_t *mq);
-int libtrace_message_queue_get_fd(libtrace_message_queue_t *mq);
+DLLEXPORT void libtrace_message_queue_init(libtrace_message_queue_t *mq, size_t message_len);
+DLLEXPORT int libtrace_message_queue_put(libtrace_message_queue_t *mq, const void *message);
+DLLEXPORT int libtrace_message_queue_count(const libtrace_message_queue_t *mq);
+DLLEXPORT int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message);
+DLLEXPORT int libtrace_message_queue_try_get(libtrace_message_queue_t *mq, void *message);
+DLLEXPORT void libtrace_message_queue_destroy(libtrace_message_queue_t *mq);
+DLLEXPORT int libtrace_message_queue_get_fd(libtrace_message_queue_t *mq);
 
 #endif
@@ -4,7 +4,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#if HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+/* The most NUMA nodes given their own global tier, any above share */
+#define OCACHE_MAX_NODES 64
 
+/**
+ * The global tier of the cache, one per NUMA node. This is a bounded
+ * multi-producer multi-consumer ring which moves objects in bulk, much
+ * like DPDK's rte_ring. A thread reserves a run of slots by moving head
+ * with a CAS, copies its objects, then publishes them by moving tail once
+ * any earlier reservations have been published.
+ */
+struct ocache_node {
+	/* Set by init and read-only after that */
+	void **ring;
+	size_t capacity;
+	size_t mask;
+
+	volatile size_t prod_head ALIGN_STRUCT(CACHE_LINE_SIZE);
+	volatile size_t prod_tail;
+	volatile size_t cons_head ALIGN_STRUCT(CACHE_LINE_SIZE);
+	volatile size_t cons_tail;
+} ALIGN_STRUCT(CACHE_LINE_SIZE);
 
 // pthread tls is most likely slower than __thread, but they have destructors so
 // we use a combination of the two here!!
@@ -16,19 +46,17 @@ struct local_cache {
 	size_t used;
 	void **cache;
 	bool invalid;
-};
-
-struct mem_stats {
-	struct memfail {
-	   uint64_t cache_hit;
-	   uint64_t ring_hit;
-	   uint64_t miss;
-	   uint64_t recycled;
-	} readbulk, read, write, writebulk;
+	int node;		// The NUMA node of this thread's global tier
+	libtrace_ocache_stats_t stats;
 };
 
 #ifdef ENABLE_MEM_STATS
-extern __thread struct mem_stats mem_hits;
+#define STAT_ADD(stats, field, n) ((stats)->field += (n))
+/* For threads without a cache, the shared counters are updated atomically */
+#define STAT_ADD_OC(oc, field, n) __atomic_add_fetch(&(oc)->stats.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(stats, field, n) do {} while (0)
+#define STAT_ADD_OC(oc, field, n) do {} while (0)
 #endif
 
 struct local_caches {
@@ -41,6 +69,199 @@ static pthread_key_t memory_destructor_key;
 static pthread_once_t memory_destructor_once = PTHREAD_ONCE_INIT;
 static inline struct local_caches *get_local_caches();
 
+#if HAVE_TLS
+/* The cache last found by this thread, saves walking t_mem_caches */
+static __thread struct local_cache *last_cache = NULL;
+#define FORGET_LAST_CACHE() (last_cache = NULL)
+#else
+#define FORGET_LAST_CACHE() do {} while (0)
+#endif
+
+static void add_stats(libtrace_ocache_stats_t *to, const libtrace_ocache_stats_t *from) {
+	const uint64_t *f = (const uint64_t *) from;
+	uint64_t *t = (uint64_t *) to;
+	size_t i;
+
+	for (i = 0; i < sizeof(*from) / sizeof(uint64_t); i++)
+		__atomic_add_fetch(&t[i], __atomic_load_n(&f[i], __ATOMIC_RELAXED),
+		                   __ATOMIC_RELAXED);
+}
+
+static int count_numa_nodes(void) {
+	int nodes = 1;
+#if HAVE_LIBNUMA
+	if (numa_available() >= 0)
+		nodes = numa_max_node() + 1;
+#elif defined(__linux__)
+	FILE *f = fopen("/sys/devices/system/node/possible", "r");
+	int first, last;
+
+	if (f) {
+		switch (fscanf(f, "%d-%d", &first, &last)) {
+		case 2:
+			nodes = last + 1;
+			break;
+		case 1:
+			nodes = first + 1;
+			break;
+		}
+		fclose(f);
+	}
+#endif
+	if (nodes < 1)
+		nodes = 1;
+	return nodes > OCACHE_MAX_NODES ? OCACHE_MAX_NODES : nodes;
+}
+
+#if HAVE_TLS
+/* The NUMA node of this thread, -1 until it has been looked up */
+static __thread int thread_node = -1;
+#endif
+
+/* The NUMA node the calling thread is running on, this is a system call */
+static int lookup_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return (int) node;
+#endif
+	return 0;
+}
+
+/* The global tier the calling thread should use. The node is looked up
+ * once per thread, so allocating and freeing from a thread without a local
+ * cache makes no system calls. A thread that later moves node keeps
+ * using its first node, as a local cache does with lc->node. */
+static int current_node(const libtrace_ocache_t *oc) {
+	if (oc->nb_nodes <= 1)
+		return 0;
+#if HAVE_TLS
+	if (thread_node < 0)
+		thread_node = lookup_node();
+	return thread_node % oc->nb_nodes;
+#else
+	return lookup_node() % oc->nb_nodes;
+#endif
+}
+
+static int node_init(struct ocache_node *n, size_t capacity) {
+	size_t size = 1;
+
+	while (size < capacity)
+		size <<= 1;
+	n->ring = calloc(size, sizeof(void *));
+	if (!n->ring)
+		return -1;
+	n->capacity = capacity;
+	n->mask = size - 1;
+	n->prod_head = n->prod_tail = 0;
+	n->cons_head = n->cons_tail = 0;
+	return 0;
+}
+
+/* Waits for earlier reservations to be published, then publishes ours */
+static inline void publish(volatile size_t *tail, size_t head, size_t next) {
+	while (__atomic_load_n(tail, __ATOMIC_ACQUIRE) != head)
+		sched_yield();
+	__atomic_store_n(tail, next, __ATOMIC_RELEASE);
+}
+
+/* Puts up to nb objects into the node, returns the number put */
+static size_t node_put(struct ocache_node *n, void *values[], size_t nb) {
+	size_t head, space, i;
+
+	head = __atomic_load_n(&n->prod_head, __ATOMIC_RELAXED);
+	do {
+		space = n->capacity + __atomic_load_n(&n->cons_tail, __ATOMIC_ACQUIRE) - head;
+		if (nb > space)
+			nb = space;
+		if (nb == 0)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&n->prod_head, &head, head + nb,
+	                                      true, __ATOMIC_RELAXED,
+	                                      __ATOMIC_RELAXED));
+	for (i = 0; i < nb; i++)
+		n->ring[(head + i) & n->mask] = values[i];
+	publish(&n->prod_tail, head, head + nb);
+	return nb;
+}
+
+/* Takes up to nb objects from the node, returns the number taken */
+static size_t node_get(struct ocache_node *n, void *values[], size_t nb) {
+	size_t head, avail, i;
+
+	head = __atomic_load_n(&n->cons_head, __ATOMIC_RELAXED);
+	do {
+		avail = __atomic_load_n(&n->prod_tail, __ATOMIC_ACQUIRE) - head;
+		if (nb > avail)
+			nb = avail;
+		if (nb == 0)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&n->cons_head, &head, head + nb,
+	                                      true, __ATOMIC_RELAXED,
+	                                      __ATOMIC_RELAXED));
+	for (i = 0; i < nb; i++)
+		values[i] = n->ring[(head + i) & n->mask];
+	publish(&n->cons_tail, head, head + nb);
+	return nb;
+}
+
+/* Waits a little for other threads, sleeping once we have waited a while
+ * so a thread blocked on a fixed size cache does not burn a core */
+static void backoff(unsigned *waits) {
+	struct timespec ts = {0, 100000};
+
+	if (++*waits < 64)
+		sched_yield();
+	else
+		nanosleep(&ts, NULL);
+}
+
+/**
+ * Takes at least min_nb_buffers objects from the global tier, waiting if
+ * need be. Our own node is tried first and then the others.
+ */
+static size_t global_get(libtrace_ocache_t *oc, int node, void *values[],
+                         size_t nb_buffers, size_t min_nb_buffers) {
+	size_t i = 0;
+	unsigned waits = 0;
+	int n;
+
+	for (;;) {
+		for (n = 0; n < oc->nb_nodes && i < nb_buffers; n++)
+			i += node_get(&oc->nodes[(node + n) % oc->nb_nodes],
+			              &values[i], nb_buffers - i);
+		if (i >= min_nb_buffers)
+			return i;
+		backoff(&waits);
+	}
+}
+
+/**
+ * Puts at least min_nb_buffers objects into the global tier, waiting if
+ * need be. Other nodes are only used if our own is full and we must put
+ * more, otherwise the caller frees what did not fit.
+ */
+static size_t global_put(libtrace_ocache_t *oc, int node, void *values[],
+                         size_t nb_buffers, size_t min_nb_buffers) {
+	size_t i;
+	unsigned waits = 0;
+	int n;
+
+	i = node_put(&oc->nodes[node], values, nb_buffers);
+	while (i < min_nb_buffers) {
+		for (n = 1; n < oc->nb_nodes && i < min_nb_buffers; n++)
+			i += node_put(&oc->nodes[(node + n) % oc->nb_nodes],
+			              &values[i], min_nb_buffers - i);
+		if (i < min_nb_buffers) {
+			backoff(&waits);
+			i += node_put(&oc->nodes[node], &values[i], min_nb_buffers - i);
+		}
+	}
+	return i;
+}
+
 /**
  * @brief unregister_thread assumes we DONT hold spin
  */
@@ -66,17 +287,20 @@ static inline void unregister_thread(struct local_cache *lc) {
 		return;
 	}
 	lc->invalid = true;
+	add_stats(&lc->oc->stats, &lc->stats);
+	pthread_spin_unlock(&lc->oc->spin);
 
 	if (lc->oc->max_allocations) {
-		libtrace_ringbuffer_swrite_bulk(&lc->oc->rb, lc->cache, lc->used, lc->used);
+		global_put(lc->oc, lc->node, lc->cache, lc->used, lc->used);
 	} else {
 		size_t i;
-		// We just run the free these
-		for(i = 0; i < lc->used; ++i) {
+		// Keep what fits and free the rest
+		i = global_put(lc->oc, lc->node, lc->cache, lc->used, 0);
+		for(; i < lc->used; ++i) {
 			lc->oc->free(lc->cache[i]);
 		}
 	}
-	pthread_spin_unlock(&lc->oc->spin);
+	lc->used = 0;
 }
 
 /**
@@ -106,7 +330,7 @@ static void destroy_memory_caches(void *tlsaddr) {
 	free(lcs->t_mem_caches);
 	lcs->t_mem_caches = NULL;
 	free(lcs);
-
+	FORGET_LAST_CACHE();
 }
 
 static void once_memory_cache_key_init() {
@@ -117,10 +341,30 @@ static void once_memory_cache_key_init() {
  * Adds more space to our mem_caches
  */
 static void resize_memory_caches(struct local_caches *lcs) {
+	struct local_cache *old = lcs->t_mem_caches;
+	size_t i, j;
+
 	assert (lcs->t_mem_caches_total > 0);
-	lcs->t_mem_caches += 0x10;
-	lcs->t_mem_caches = realloc(lcs->t_mem_caches,
-	                            lcs->t_mem_caches_total * sizeof(struct local_cache));
+	lcs->t_mem_caches = calloc(lcs->t_mem_caches_total + 0x10,
+	                           sizeof(struct local_cache));
+	assert(lcs->t_mem_caches);
+	memcpy(lcs->t_mem_caches, old,
+	       lcs->t_mem_caches_total * sizeof(struct local_cache));
+	lcs->t_mem_caches_total += 0x10;
+	// The ocaches point at our caches, so move them before freeing the old
+	for (i = 0; i < lcs->t_mem_caches_used; ++i) {
+		libtrace_ocache_t *oc = old[i].oc;
+		if (old[i].invalid)
+			continue;
+		pthread_spin_lock(&oc->spin);
+		for (j = 0; j < oc->nb_thread_list; ++j) {
+			if (oc->thread_list[j] == &old[i])
+				oc->thread_list[j] = &lcs->t_mem_caches[i];
+		}
+		pthread_spin_unlock(&oc->spin);
+	}
+	free(old);
+	FORGET_LAST_CACHE();
 }
 
 /* Get TLS for the list of local_caches */
@@ -157,8 +401,17 @@ static inline struct local_caches *get_local_caches() {
 static inline struct local_cache * find_cache(libtrace_ocache_t *oc) {
 	size_t i;
 	struct local_cache *lc = NULL;
-	struct local_caches *lcs = get_local_caches();
+	struct local_caches *lcs;
+
+	if (!oc->thread_cache_size)
+		return 0;
 
+#if HAVE_TLS
+	if (last_cache && last_cache->oc == oc && !last_cache->invalid)
+		return last_cache;
+#endif
+
+	lcs = get_local_caches();
 	for (i = 0; i < lcs->t_mem_caches_used; ++i) {
 		if (lcs->t_mem_caches[i].oc == oc) {
 			lc = &lcs->t_mem_caches[i];
@@ -166,25 +419,28 @@ static inline struct local_cache * find_cache(libtrace_ocache_t *oc) {
 		}
 	}
 
-	if (!oc->thread_cache_size)
-		return 0;
-
 	// Create a cache
 	if (!lc) {
 		if (lcs->t_mem_caches_used == lcs->t_mem_caches_total)
 			resize_memory_caches(lcs);
-		lcs->t_mem_caches[lcs->t_mem_caches_used].oc = oc;
-		lcs->t_mem_caches[lcs->t_mem_caches_used].used = 0;
-		lcs->t_mem_caches[lcs->t_mem_caches_used].total = oc->thread_cache_size;
-		lcs->t_mem_caches[lcs->t_mem_caches_used].cache = malloc(sizeof(void*) * oc->thread_cache_size);
-		lcs->t_mem_caches[lcs->t_mem_caches_used].invalid = false;
 		lc = &lcs->t_mem_caches[lcs->t_mem_caches_used];
+		memset(lc, 0, sizeof(struct local_cache));
+		lc->oc = oc;
+		lc->used = 0;
+		lc->total = oc->thread_cache_size;
+		lc->cache = malloc(sizeof(void*) * oc->thread_cache_size);
+		lc->invalid = false;
+		// Threads rarely move between nodes, so look this up once
+		lc->node = current_node(oc);
 		// Register it with the underlying ring_buffer
 		register_thread(lc->oc, lc);
 		++lcs->t_mem_caches_used;
 	}
 
 	assert(!lc->invalid);
+#if HAVE_TLS
+	last_cache = lc;
+#endif
 	return lc;
 }
 
@@ -194,9 +450,10 @@ static inline struct local_cache * find_cache(libtrace_ocache_t *oc) {
   * The alloc and free methods are supplied by the user and are used when no
   * recycled objects are available, or to tidy the final results.
   *
-  * The performance of these pools will decrease if thread caches are used
-  * as this results in a list to lookup per thread. The pool is added when
-  * to this list when first encountered, these persist untill the thread exits.
+  * Each thread keeps a small cache of its own, which it refills from or
+  * empties into a shared pool in bulk. The shared pool is split by NUMA
+  * node so that objects freed on a node are reused on that node, a node
+  * only takes from another once its own is empty.
   *
   * NOTE: If limit_size is true do not attempt to 'free' any objects that were
   * not created by this pool back otherwise the 'free' might deadlock. Also
@@ -209,7 +466,8 @@ static inline struct local_cache * find_cache(libtrace_ocache_t *oc) {
   * @param thread_cache_size A small cache kept on a per thread basis, this can be 0
   *		however should only be done if bulk reads of packets are being performed
   *		or contention is minimal.
-  * @param buffer_size The number of packets to be stored in the main buffer.
+  * @param buffer_size The number of packets to be stored in the shared pool
+  *		of each NUMA node.
   * @param limit_size If true no more objects than buffer_size will be allocated,
   *		reads will block (free never should).Otherwise packets can be freely
   *     allocated upon requested and are free'd if there is not enough space for them.
@@ -219,12 +477,24 @@ DLLEXPORT int libtrace_ocache_init(libtrace_ocache_t *oc, void *(*alloc)(void),
                                     void (*free)(void *),
                                     size_t thread_cache_size,
                                     size_t buffer_size, bool limit_size) {
+	int i;
 
 	assert(buffer_size);
 	assert(alloc);
 	assert(free);
-	if (libtrace_ringbuffer_init(&oc->rb, buffer_size, LIBTRACE_RINGBUFFER_BLOCKING) != 0) {
+	libtrace_zero_ocache(oc);
+	oc->nb_nodes = count_numa_nodes();
+	oc->nodes = calloc(oc->nb_nodes, sizeof(struct ocache_node));
+	if (oc->nodes == NULL)
 		return -1;
+	for (i = 0; i < oc->nb_nodes; i++) {
+		if (node_init(&oc->nodes[i], buffer_size) != 0) {
+			while (i--)
+				free(oc->nodes[i].ring);
+			free(oc->nodes);
+			oc->nodes = NULL;
+			return -1;
+		}
 	}
 	oc->alloc = alloc;
 	oc->free = free;
@@ -234,7 +504,10 @@ DLLEXPORT int libtrace_ocache_init(libtrace_ocache_t *oc, void *(*alloc)(void),
 	oc->max_nb_thread_list = 0x10;
 	oc->thread_list = calloc(0x10, sizeof(void*));
 	if (oc->thread_list == NULL) {
-		libtrace_ringbuffer_destroy(&oc->rb);
+		for (i = 0; i < oc->nb_nodes; i++)
+			free(oc->nodes[i].ring);
+		free(oc->nodes);
+		oc->nodes = NULL;
 		return -1;
 	}
 	pthread_spin_init(&oc->spin, 0);
@@ -256,34 +529,33 @@ DLLEXPORT int libtrace_ocache_init(libtrace_ocache_t *oc, void *(*alloc)(void),
   */
 DLLEXPORT int libtrace_ocache_destroy(libtrace_ocache_t *oc) {
 	void *ele;
+	int i;
 
 	while (oc->nb_thread_list)
 		unregister_thread(oc->thread_list[0]);
 
-	pthread_spin_lock(&oc->spin);
-	while (libtrace_ringbuffer_try_read(&oc->rb, &ele)) {
-		oc->free(ele);
-		if (oc->max_allocations)
-			--oc->current_allocations;
+	for (i = 0; i < oc->nb_nodes; i++) {
+		while (node_get(&oc->nodes[i], &ele, 1)) {
+			oc->free(ele);
+			if (oc->max_allocations)
+				--oc->current_allocations;
+		}
+		free(oc->nodes[i].ring);
 	}
-	pthread_spin_unlock(&oc->spin);
 
 	if (oc->current_allocations)
 		fprintf(stderr, "OCache destroyed, leaking %d packets!!\n", (int) oc->current_allocations);
 
-	libtrace_ringbuffer_destroy(&oc->rb);
+	free(oc->nodes);
 	pthread_spin_destroy(&oc->spin);
 	free(oc->thread_list);
+	i = (int) oc->current_allocations;
 	libtrace_zero_ocache(oc);
-	if (oc->current_allocations)
-		return (int) oc->current_allocations;
-	else
-		return 0;
+	return i;
 }
 
 static inline size_t libtrace_ocache_alloc_cache(libtrace_ocache_t *oc, void *values[], size_t nb_buffers, size_t min_nb_buffers,
 										 struct local_cache *lc) {
-	libtrace_ringbuffer_t *rb = &oc->rb;
 	size_t i;
 
 	// We have enough cached!! Yay
@@ -291,42 +563,34 @@ static inline size_t libtrace_ocache_alloc_cache(libtrace_ocache_t *oc, void *va
 		// Copy all from cache
 		memcpy(values, &lc->cache[lc->used - nb_buffers], sizeof(void *) * nb_buffers);
 		lc->used -= nb_buffers;
-#ifdef ENABLE_MEM_STATS
-		mem_hits.read.cache_hit += nb_buffers;
-		mem_hits.readbulk.cache_hit += 1;
-#endif
+		STAT_ADD(&lc->stats, read.cache_hit, nb_buffers);
+		STAT_ADD(&lc->stats, readbulk.cache_hit, 1);
 		return nb_buffers;
 	}
-	// Cache is not big enough try read all from ringbuffer
+	// Cache is not big enough try read all from the global tier
 	else if (nb_buffers > lc->total) {
-		i = libtrace_ringbuffer_sread_bulk(rb, values, nb_buffers, min_nb_buffers);
-#ifdef ENABLE_MEM_STATS
+		i = global_get(oc, lc->node, values, nb_buffers, min_nb_buffers);
 		if (i)
-			mem_hits.readbulk.ring_hit += 1;
+			STAT_ADD(&lc->stats, readbulk.ring_hit, 1);
 		else
-			mem_hits.readbulk.miss += 1;
-		mem_hits.read.ring_hit += i;
-#endif
+			STAT_ADD(&lc->stats, readbulk.miss, 1);
+		STAT_ADD(&lc->stats, read.ring_hit, i);
 	} else { // Not enough cached
 		// Empty the cache and re-fill it and then see what we're left with
 		i = lc->used;
 		memcpy(values, lc->cache, sizeof(void *) * lc->used);
-#ifdef ENABLE_MEM_STATS
-		mem_hits.read.cache_hit += i;
-#endif
+		STAT_ADD(&lc->stats, read.cache_hit, i);
 
 		// Make sure we still meet the minimum requirement
 		if (i < min_nb_buffers)
-			lc->used = libtrace_ringbuffer_sread_bulk(rb, lc->cache, lc->total, min_nb_buffers - i);
+			lc->used = global_get(oc, lc->node, lc->cache, lc->total, min_nb_buffers - i);
 		else
-			lc->used = libtrace_ringbuffer_sread_bulk(rb, lc->cache, lc->total, 0);
-#ifdef ENABLE_MEM_STATS
+			lc->used = global_get(oc, lc->node, lc->cache, lc->total, 0);
 		if (lc->used == lc->total)
-			mem_hits.readbulk.ring_hit += 1;
+			STAT_ADD(&lc->stats, readbulk.ring_hit, 1);
 		else
-			mem_hits.readbulk.miss += 1;
-		mem_hits.read.ring_hit += lc->used;
-#endif
+			STAT_ADD(&lc->stats, readbulk.miss, 1);
+		STAT_ADD(&lc->stats, read.ring_hit, lc->used);
 	}
 
 	// Try fill the remaining
@@ -337,35 +601,50 @@ static inline size_t libtrace_ocache_alloc_cache(libtrace_ocache_t *oc, void *va
 		lc->used -= remaining;
 		i += remaining;
 	}
-#ifdef ENABLE_MEM_STATS
-	mem_hits.read.miss += nb_buffers - i;
-#endif
+	STAT_ADD(&lc->stats, read.miss, nb_buffers - i);
 	assert(i >= min_nb_buffers);
 	return i;
 }
 
+/* Reserves up to nb new allocations against max_allocations */
+static inline size_t reserve_allocations(libtrace_ocache_t *oc, size_t nb) {
+	size_t current = __atomic_load_n(&oc->current_allocations, __ATOMIC_RELAXED);
+	size_t take;
+
+	do {
+		take = current < oc->max_allocations ?
+		       MIN(oc->max_allocations - current, nb) : 0;
+		if (take == 0)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&oc->current_allocations, &current,
+	                                      current + take, true,
+	                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return take;
+}
+
 DLLEXPORT size_t libtrace_ocache_alloc(libtrace_ocache_t *oc, void *values[], size_t nb_buffers, size_t min_nb_buffers) {
 	struct local_cache *lc = find_cache(oc);
 	size_t i;
 	size_t min;
-	bool try_alloc = !(oc->max_allocations && oc->max_allocations <= oc->current_allocations);
+	bool try_alloc = !(oc->max_allocations && oc->max_allocations <=
+	                   __atomic_load_n(&oc->current_allocations, __ATOMIC_RELAXED));
 
 	assert(oc->max_allocations ? nb_buffers < oc->max_allocations : 1);
 	min = try_alloc ? 0: min_nb_buffers;
-	if (lc)
+	if (lc) {
 		i = libtrace_ocache_alloc_cache(oc, values, nb_buffers, min,  lc);
-	else
-		i = libtrace_ringbuffer_sread_bulk(&oc->rb, values, nb_buffers, min);
+	} else {
+		i = global_get(oc, current_node(oc), values, nb_buffers, min);
+		STAT_ADD_OC(oc, read.ring_hit, i);
+		STAT_ADD_OC(oc, read.miss, nb_buffers - i);
+	}
 
 	if (try_alloc) {
 		size_t nb;
 
 		// Try alloc the rest
 		if (oc->max_allocations) {
-			pthread_spin_lock(&oc->spin);
-			nb = MIN(oc->max_allocations - oc->current_allocations, nb_buffers - i);
-			oc->current_allocations += nb;
-			pthread_spin_unlock(&oc->spin);
+			nb = reserve_allocations(oc, nb_buffers - i);
 			nb += i;
 		} else {
 			nb = nb_buffers;
@@ -381,7 +660,7 @@ DLLEXPORT size_t libtrace_ocache_alloc(libtrace_ocache_t *oc, void *values[], si
 			if (lc)
 				i += libtrace_ocache_alloc_cache(oc, &values[nb], nb_buffers - nb, min_nb_buffers - nb, lc);
 			else
-				i += libtrace_ringbuffer_sread_bulk(&oc->rb, &values[nb], nb_buffers - nb, min_nb_buffers - nb);
+				i += global_get(oc, current_node(oc), &values[nb], nb_buffers - nb, min_nb_buffers - nb);
 		}
 	}
 	assert(i >= min_nb_buffers);
@@ -391,7 +670,6 @@ DLLEXPORT size_t libtrace_ocache_alloc(libtrace_ocache_t *oc, void *values[], si
 
 static inline size_t libtrace_ocache_free_cache(libtrace_ocache_t *oc, void *values[], size_t nb_buffers, size_t min_nb_buffers,
 											struct local_cache *lc) {
-	libtrace_ringbuffer_t *rb = &oc->rb;
 	size_t i;
 
 	// We have enough cached!! Yay
@@ -399,47 +677,39 @@ static inline size_t libtrace_ocache_free_cache(libtrace_ocache_t *oc, void *val
 		// Copy all to the cache
 		memcpy(&lc->cache[lc->used], values, sizeof(void *) * nb_buffers);
 		lc->used += nb_buffers;
-#ifdef ENABLE_MEM_STATS
-		mem_hits.write.cache_hit += nb_buffers;
-		mem_hits.writebulk.cache_hit += 1;
-#endif
+		STAT_ADD(&lc->stats, write.cache_hit, nb_buffers);
+		STAT_ADD(&lc->stats, writebulk.cache_hit, 1);
 		return nb_buffers;
 	}
-	// Cache is not big enough try write all to the ringbuffer
+	// Cache is not big enough try write all to the global tier
 	else if (nb_buffers > lc->total) {
-		i = libtrace_ringbuffer_swrite_bulk(rb, values, nb_buffers, min_nb_buffers);
-#ifdef ENABLE_MEM_STATS
+		i = global_put(oc, lc->node, values, nb_buffers, min_nb_buffers);
 		if (i)
-			mem_hits.writebulk.ring_hit += 1;
+			STAT_ADD(&lc->stats, writebulk.ring_hit, 1);
 		else
-			mem_hits.writebulk.miss += 1;
-		mem_hits.write.ring_hit += i;
-#endif
+			STAT_ADD(&lc->stats, writebulk.miss, 1);
+		STAT_ADD(&lc->stats, write.ring_hit, i);
 	} else { // Not enough cache space but there might later
 		// Fill the cache and empty it and then see what we're left with
 		i = (lc->total - lc->used);
 		memcpy(&lc->cache[lc->used], values, sizeof(void *) * i);
-#ifdef ENABLE_MEM_STATS
-		mem_hits.write.cache_hit += i;
-#endif
+		STAT_ADD(&lc->stats, write.cache_hit, i);
 
 		// Make sure we still meet the minimum requirement
 		if (i < min_nb_buffers)
-			lc->used = lc->total - libtrace_ringbuffer_swrite_bulk(rb, lc->cache, lc->total, min_nb_buffers - i);
+			lc->used = lc->total - global_put(oc, lc->node, lc->cache, lc->total, min_nb_buffers - i);
 		else
-			lc->used = lc->total - libtrace_ringbuffer_swrite_bulk(rb, lc->cache, lc->total, 0);
+			lc->used = lc->total - global_put(oc, lc->node, lc->cache, lc->total, 0);
 
 		// Re originise fulls to the front
 		if (lc->used)
 			memmove(lc->cache, &lc->cache[lc->total - lc->used], sizeof(void *) * lc->used);
 
-#ifdef ENABLE_MEM_STATS
 		if (lc->used)
-			mem_hits.writebulk.miss += 1;
+			STAT_ADD(&lc->stats, writebulk.miss, 1);
 		else
-			mem_hits.writebulk.ring_hit += 1;
-		mem_hits.write.ring_hit += lc->total - lc->used;
-#endif
+			STAT_ADD(&lc->stats, writebulk.ring_hit, 1);
+		STAT_ADD(&lc->stats, write.ring_hit, lc->total - lc->used);
 	}
 
 	// Try empty the remaining
@@ -450,9 +720,7 @@ static inline size_t libtrace_ocache_free_cache(libtrace_ocache_t *oc, void *val
 		lc->used += remaining;
 		i += remaining;
 	}
-#ifdef ENABLE_MEM_STATS
-	mem_hits.write.miss += nb_buffers - i;
-#endif
+	STAT_ADD(&lc->stats, write.miss, nb_buffers - i);
 	return i;
 }
 
@@ -463,10 +731,13 @@ DLLEXPORT size_t libtrace_ocache_free(libtrace_ocache_t *oc, void *values[], siz
 
 	assert(oc->max_allocations ? nb_buffers < oc->max_allocations : 1);
 	min = oc->max_allocations ? min_nb_buffers : 0;
-	if (lc)
+	if (lc) {
 		i = libtrace_ocache_free_cache(oc, values, nb_buffers, min, lc);
-	else
-		i = libtrace_ringbuffer_swrite_bulk(&oc->rb, values, nb_buffers, min);
+	} else {
+		i = global_put(oc, current_node(oc), values, nb_buffers, min);
+		STAT_ADD_OC(oc, write.ring_hit, i);
+		STAT_ADD_OC(oc, write.miss, nb_buffers - i);
+	}
 
 	if (!oc->max_allocations) {
 		// Free these normally
@@ -478,7 +749,8 @@ DLLEXPORT size_t libtrace_ocache_free(libtrace_ocache_t *oc, void *values[], siz
 }
 
 DLLEXPORT void libtrace_zero_ocache(libtrace_ocache_t *oc) {
-	libtrace_zero_ringbuffer(&oc->rb);
+	oc->nodes = NULL;
+	oc->nb_nodes = 0;
 	oc->thread_cache_size = 0;
 	oc->alloc = NULL;
 	oc->free = NULL;
@@ -487,6 +759,7 @@ DLLEXPORT void libtrace_zero_ocache(libtrace_ocache_t *oc) {
 	oc->nb_thread_list = 0;
 	oc->max_nb_thread_list = 0;
 	oc->thread_list = NULL;
+	memset(&oc->stats, 0, sizeof(oc->stats));
 }
 
 /**
@@ -510,5 +783,32 @@ DLLEXPORT void libtrace_ocache_unregister_thread(libtrace_ocache_t *oc) {
 				memset(&lcs->t_mem_caches[lcs->t_mem_caches_used], 0, sizeof(struct local_cache));
 			}
 		}
+		FORGET_LAST_CACHE();
 	}
 }
+
+/**
+ * Totals the statistics of an ocache across every thread which has used
+ * it. The counts of running threads are read without stopping them, so
+ * may be slightly behind.
+ *
+ * @return 0 if successful, -1 if libtrace was built without
+ *         --enable-memory-debugging, in which case no counts are kept
+ */
+DLLEXPORT int libtrace_ocache_get_stats(libtrace_ocache_t *oc, libtrace_ocache_stats_t *stats) {
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+#ifdef ENABLE_MEM_STATS
+	pthread_spin_lock(&oc->spin);
+	add_stats(stats, &oc->stats);
+	for (i = 0; i < oc->nb_thread_list; ++i)
+		add_stats(stats, &oc->thread_list[i]->stats);
+	pthread_spin_unlock(&oc->spin);
+	return 0;
+#else
+	(void) oc;
+	(void) i;
+	return -1;
+#endif
+}
@@ -4,19 +4,33 @@
 #include "ring_buffer.h"
 #include "vector.h"
 
+/**
+ * Counts of where the objects passed through an ocache came from or went
+ * to. read and write count objects, readbulk and writebulk count calls.
+ */
+typedef struct libtrace_ocache_stats {
+	struct libtrace_ocache_stat {
+		uint64_t cache_hit;	// Served by the thread's cache
+		uint64_t ring_hit;	// Served by the global tier
+		uint64_t miss;		// Not served by either
+	} read, readbulk, write, writebulk;
+} libtrace_ocache_stats_t;
 
 struct local_cache;
+struct ocache_node;
 typedef struct libtrace_ocache {
-	libtrace_ringbuffer_t rb;
+	struct ocache_node *nodes;	// The global tier, one per NUMA node
+	int nb_nodes;
 	void *(*alloc)(void);
 	void (*free)(void *);
 	size_t thread_cache_size;
 	size_t max_allocations;
 	size_t current_allocations;
-	pthread_spinlock_t spin;
+	pthread_spinlock_t spin;	// Protects thread_list and stats
 	size_t nb_thread_list;
 	size_t max_nb_thread_list;
 	struct local_cache **thread_list;
+	libtrace_ocache_stats_t stats;	// Of threads no longer registered
 } libtrace_ocache_t;
 
 DLLEXPORT int libtrace_ocache_init(libtrace_ocache_t *oc, void *(*alloc)(void), void (*free)(void*),
@@ -26,4 +40,5 @@ DLLEXPORT size_t libtrace_ocache_alloc(libtrace_ocache_t *oc, void *values[], si
 DLLEXPORT size_t libtrace_ocache_free(libtrace_ocache_t *oc, void *values[], size_t nb_buffers, size_t min_nb_buffers);
 DLLEXPORT void libtrace_zero_ocache(libtrace_ocache_t *oc);
 DLLEXPORT void libtrace_ocache_unregister_thread(libtrace_ocache_t *oc);
+DLLEXPORT int libtrace_ocache_get_stats(libtrace_ocache_t *oc, libtrace_ocache_stats_t *stats);
 #endif // LIBTRACE_OBJECT_CACHE_H
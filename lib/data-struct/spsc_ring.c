@@ -0,0 +1,368 @@
+/**
+ * A lock-free single producer single consumer ring
+ *
+ * Unlike libtrace_ringbuffer neither the reader nor the writer takes a
+ * lock, instead the indices are published with release/acquire ordering.
+ * A blocking ring spins for a short while before sleeping on a futex
+ * (a condition variable on systems without futexes), a writer only makes
+ * a system call if the reader might be asleep and vice versa.
+ */
+
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/* How many times we recheck the ring before going to sleep */
+#define SPIN_COUNT 2000
+
+#define LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define FULL_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static inline void cpu_relax(void) {
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/**
+ * Creates a ring that can hold size items.
+ *
+ * @param rb A pointer to a ring structure
+ * @param size The maximum number of items in the ring
+ * @param mode LIBTRACE_SPSC_RING_BLOCKING to sleep when waiting for the
+ * 		other side or LIBTRACE_SPSC_RING_POLLING to only ever yield
+ * @return If successful returns 0 otherwise -1 upon failure.
+ */
+DLLEXPORT int libtrace_spsc_ring_init(libtrace_spsc_ring_t *rb, size_t size, int mode) {
+	size_t slots = 1;
+
+	if (size < 1)
+		return -1;
+	/* A power of two number of slots lets us mask rather than divide,
+	 * we still only allow size items in at once */
+	while (slots < size)
+		slots <<= 1;
+
+	rb->elements = calloc(slots, sizeof(void *));
+	if (!rb->elements)
+		return -1;
+	rb->mask = slots - 1;
+	rb->size = size;
+	rb->mode = mode;
+	rb->head = 0;
+	rb->tail_cache = 0;
+	rb->tail = 0;
+	rb->head_cache = 0;
+	rb->empty_seq = 0;
+	rb->empty_waiting = 0;
+	rb->full_seq = 0;
+	rb->full_waiting = 0;
+#ifndef __linux__
+	ASSERT_RET(pthread_mutex_init(&rb->sleep_lock, NULL), == 0);
+	ASSERT_RET(pthread_cond_init(&rb->sleep_cond, NULL), == 0);
+#endif
+	return 0;
+}
+
+/**
+ * Destroys the ring along with any memory allocated to it
+ * @param rb The ring to destroy
+ */
+DLLEXPORT void libtrace_spsc_ring_destroy(libtrace_spsc_ring_t *rb) {
+#ifndef __linux__
+	ASSERT_RET(pthread_mutex_destroy(&rb->sleep_lock), == 0);
+	ASSERT_RET(pthread_cond_destroy(&rb->sleep_cond), == 0);
+#endif
+	free(rb->elements);
+	libtrace_zero_spsc_ring(rb);
+}
+
+DLLEXPORT void libtrace_zero_spsc_ring(libtrace_spsc_ring_t *rb) {
+	rb->elements = NULL;
+	rb->mask = 0;
+	rb->size = 0;
+	rb->head = 0;
+	rb->tail_cache = 0;
+	rb->tail = 0;
+	rb->head_cache = 0;
+}
+
+/**
+ * Tests to see if the ring is empty, when using multiple threads
+ * this doesn't guarantee that the next operation wont block. Use
+ * write/read try instead.
+ */
+DLLEXPORT int libtrace_spsc_ring_is_empty(const libtrace_spsc_ring_t *rb) {
+	return LOAD_ACQUIRE(rb->head) == LOAD_ACQUIRE(rb->tail);
+}
+
+/**
+ * Tests to see if the ring is full, when using multiple threads
+ * this doesn't guarantee that the next operation wont block. Use
+ * write/read try instead.
+ */
+DLLEXPORT int libtrace_spsc_ring_is_full(const libtrace_spsc_ring_t *rb) {
+	return LOAD_ACQUIRE(rb->head) - LOAD_ACQUIRE(rb->tail) >= rb->size;
+}
+
+/* Sleeps unless *seq has already moved on from val */
+static void sleep_on(libtrace_spsc_ring_t *rb UNUSED, volatile uint32_t *seq,
+                     uint32_t val) {
+#ifdef __linux__
+	syscall(SYS_futex, seq, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&rb->sleep_lock);
+	while (__atomic_load_n(seq, __ATOMIC_ACQUIRE) == val)
+		pthread_cond_wait(&rb->sleep_cond, &rb->sleep_lock);
+	pthread_mutex_unlock(&rb->sleep_lock);
+#endif
+}
+
+/* Wakes the other side if it is sleeping on seq */
+static void wake(libtrace_spsc_ring_t *rb UNUSED, volatile uint32_t *seq) {
+	__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+	syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&rb->sleep_lock);
+	pthread_cond_broadcast(&rb->sleep_cond);
+	pthread_mutex_unlock(&rb->sleep_lock);
+#endif
+}
+
+/* The number of free slots as far as the producer knows, the consumer's
+ * index is only read if our cached copy says we are full */
+static inline size_t nb_empty(libtrace_spsc_ring_t *rb, size_t head) {
+	size_t nb = rb->size - (head - rb->tail_cache);
+	if (nb == 0) {
+		rb->tail_cache = LOAD_ACQUIRE(rb->tail);
+		nb = rb->size - (head - rb->tail_cache);
+	}
+	return nb;
+}
+
+/* The number of full slots as far as the consumer knows */
+static inline size_t nb_full(libtrace_spsc_ring_t *rb, size_t tail) {
+	size_t nb = rb->head_cache - tail;
+	if (nb == 0) {
+		rb->head_cache = LOAD_ACQUIRE(rb->head);
+		nb = rb->head_cache - tail;
+	}
+	return nb;
+}
+
+/**
+ * The number of items that can be written without blocking, only the
+ * writer may call this as the answer can only grow until it writes.
+ */
+DLLEXPORT size_t libtrace_spsc_ring_get_free(libtrace_spsc_ring_t *rb) {
+	return nb_empty(rb, rb->head);
+}
+
+/**
+ * Waits for an empty slot, that we can write to.
+ *
+ * The waiting flag is set before we recheck the ring and the consumer
+ * checks the flag after moving the tail, with a full barrier between on
+ * both sides at least one will see the other so a wakeup is never lost.
+ */
+static void wait_for_empty(libtrace_spsc_ring_t *rb, size_t head) {
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < SPIN_COUNT || rb->mode == LIBTRACE_SPSC_RING_POLLING; i++) {
+		if (nb_empty(rb, head))
+			return;
+		if (rb->mode == LIBTRACE_SPSC_RING_POLLING)
+			sched_yield();
+		else
+			cpu_relax();
+	}
+
+	while (1) {
+		seq = LOAD_ACQUIRE(rb->full_seq);
+		STORE_RELEASE(rb->full_waiting, 1);
+		FULL_BARRIER();
+		if (nb_empty(rb, head))
+			break;
+		sleep_on(rb, &rb->full_seq, seq);
+	}
+	STORE_RELEASE(rb->full_waiting, 0);
+}
+
+/**
+ * Waits for a full slot, that we can read from.
+ */
+static void wait_for_full(libtrace_spsc_ring_t *rb, size_t tail) {
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < SPIN_COUNT || rb->mode == LIBTRACE_SPSC_RING_POLLING; i++) {
+		if (nb_full(rb, tail))
+			return;
+		if (rb->mode == LIBTRACE_SPSC_RING_POLLING)
+			sched_yield();
+		else
+			cpu_relax();
+	}
+
+	while (1) {
+		seq = LOAD_ACQUIRE(rb->empty_seq);
+		STORE_RELEASE(rb->empty_waiting, 1);
+		FULL_BARRIER();
+		if (nb_full(rb, tail))
+			break;
+		sleep_on(rb, &rb->empty_seq, seq);
+	}
+	STORE_RELEASE(rb->empty_waiting, 0);
+}
+
+/* Wakes the consumer if it may be asleep waiting for the items we wrote */
+static inline void notify_full(libtrace_spsc_ring_t *rb) {
+	if (rb->mode == LIBTRACE_SPSC_RING_BLOCKING) {
+		FULL_BARRIER();
+		if (LOAD_ACQUIRE(rb->empty_waiting))
+			wake(rb, &rb->empty_seq);
+	}
+}
+
+/* Wakes the producer if it may be asleep waiting for the slots we freed */
+static inline void notify_empty(libtrace_spsc_ring_t *rb) {
+	if (rb->mode == LIBTRACE_SPSC_RING_BLOCKING) {
+		FULL_BARRIER();
+		if (LOAD_ACQUIRE(rb->full_waiting))
+			wake(rb, &rb->full_seq);
+	}
+}
+
+/**
+ * Writes up to nb_buffers items, blocking until at least min_nb_buffers
+ * have been written. Only a single thread may write at once.
+ *
+ * Items are written out from start to end in order, if only some are
+ * written those at the end of the array will be still be unwritten.
+ *
+ * @param rb a pointer to libtrace_spsc_ring structure
+ * @param values The items to write
+ * @param nb_buffers The maximum items to write i.e. the length of values
+ * @param min_nb_buffers The minimum number of items to write, 0 to try
+ * @return The number of items written
+ */
+DLLEXPORT size_t libtrace_spsc_ring_write_bulk(libtrace_spsc_ring_t *rb, void *values[], size_t nb_buffers, size_t min_nb_buffers) {
+	size_t head = rb->head;
+	size_t nb_ready, end;
+	size_t i = 0;
+
+	assert(min_nb_buffers <= nb_buffers);
+
+	while (i < nb_buffers) {
+		nb_ready = nb_empty(rb, head);
+		if (nb_ready == 0) {
+			if (i >= min_nb_buffers)
+				break;
+			wait_for_empty(rb, head);
+			continue;
+		}
+		if (nb_ready > nb_buffers - i)
+			nb_ready = nb_buffers - i;
+
+		for (end = i + nb_ready; i < end; i++, head++)
+			rb->elements[head & rb->mask] = values[i];
+		/* Publish the items, the stores above must be seen first */
+		STORE_RELEASE(rb->head, head);
+		notify_full(rb);
+
+		if (i >= min_nb_buffers)
+			break;
+	}
+	return i;
+}
+
+/**
+ * Performs a blocking write to the ring, upon return the value will be
+ * stored. Only a single thread may write at once.
+ */
+DLLEXPORT void libtrace_spsc_ring_write(libtrace_spsc_ring_t *rb, void *value) {
+	libtrace_spsc_ring_write_bulk(rb, &value, 1, 1);
+}
+
+/**
+ * Performs a non-blocking write to the ring.
+ * @return 1 if a object was written otherwise 0.
+ */
+DLLEXPORT int libtrace_spsc_ring_try_write(libtrace_spsc_ring_t *rb, void *value) {
+	return libtrace_spsc_ring_write_bulk(rb, &value, 1, 0) == 1;
+}
+
+/**
+ * Reads up to nb_buffers items, blocking until at least min_nb_buffers
+ * have been read. Only a single thread may read at once.
+ *
+ * The buffer is filled from start to finish i.e. if 2 is returned [0] and [1]
+ * are valid.
+ *
+ * @param rb a pointer to libtrace_spsc_ring structure
+ * @param values Where the items read are placed
+ * @param nb_buffers The maximum items to read i.e. the length of values
+ * @param min_nb_buffers The minimum number of items to read, 0 to try
+ * @return The number of items read
+ */
+DLLEXPORT size_t libtrace_spsc_ring_read_bulk(libtrace_spsc_ring_t *rb, void *values[], size_t nb_buffers, size_t min_nb_buffers) {
+	size_t tail = rb->tail;
+	size_t nb_ready, end;
+	size_t i = 0;
+
+	assert(min_nb_buffers <= nb_buffers);
+
+	while (i < nb_buffers) {
+		nb_ready = nb_full(rb, tail);
+		if (nb_ready == 0) {
+			if (i >= min_nb_buffers)
+				break;
+			wait_for_full(rb, tail);
+			continue;
+		}
+		if (nb_ready > nb_buffers - i)
+			nb_ready = nb_buffers - i;
+
+		for (end = i + nb_ready; i < end; i++, tail++)
+			values[i] = rb->elements[tail & rb->mask];
+		/* Hand the slots back, our loads above must happen first */
+		STORE_RELEASE(rb->tail, tail);
+		notify_empty(rb);
+
+		if (i >= min_nb_buffers)
+			break;
+	}
+	return i;
+}
+
+/**
+ * Waits and reads from the ring, note this will block forever.
+ * @return The object that was read
+ */
+DLLEXPORT void *libtrace_spsc_ring_read(libtrace_spsc_ring_t *rb) {
+	void *value;
+	libtrace_spsc_ring_read_bulk(rb, &value, 1, 1);
+	return value;
+}
+
+/**
+ * Tries to read from the ring, if it is empty returns 0 to indicate
+ * nothing was read.
+ * @return 1 if a object was received otherwise 0, in this case value
+ * remains unchanged
+ */
+DLLEXPORT int libtrace_spsc_ring_try_read(libtrace_spsc_ring_t *rb, void **value) {
+	return libtrace_spsc_ring_read_bulk(rb, value, 1, 0) == 1;
+}
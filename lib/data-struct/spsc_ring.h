@@ -0,0 +1,63 @@
+#include <pthread.h>
+#include <stdint.h>
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_SPSC_RING_H
+#define LIBTRACE_SPSC_RING_H
+
+#define LIBTRACE_SPSC_RING_BLOCKING 0
+#define LIBTRACE_SPSC_RING_POLLING 1
+
+/**
+ * A single producer single consumer ring, neither side takes a lock.
+ *
+ * head and tail count every item ever written and read, the slot used is
+ * the count masked by the (power of two) number of slots. Each side keeps
+ * its own index on its own cache line along with a cached copy of the
+ * other side's index, so the other side's line is only pulled in once the
+ * cached copy says the ring looks full (or empty).
+ */
+typedef struct libtrace_spsc_ring {
+	/* Set by init and read-only after that */
+	void **elements;
+	size_t mask;		// Number of slots - 1
+	size_t size;		// Number of items the ring may hold
+	int mode;
+
+	/* Producer owned */
+	volatile size_t head ALIGN_STRUCT(CACHE_LINE_SIZE);
+	size_t tail_cache;
+
+	/* Consumer owned */
+	volatile size_t tail ALIGN_STRUCT(CACHE_LINE_SIZE);
+	size_t head_cache;
+
+	/* Sleeping, only touched on the slow path. The seq values are
+	 * bumped to wake a waiter, the waiting values say one might be
+	 * asleep */
+	volatile uint32_t empty_seq ALIGN_STRUCT(CACHE_LINE_SIZE);
+	volatile uint32_t empty_waiting;
+	volatile uint32_t full_seq;
+	volatile uint32_t full_waiting;
+#ifndef __linux__
+	pthread_mutex_t sleep_lock;
+	pthread_cond_t sleep_cond;
+#endif
+} libtrace_spsc_ring_t;
+
+DLLEXPORT int libtrace_spsc_ring_init(libtrace_spsc_ring_t *rb, size_t size, int mode);
+DLLEXPORT void libtrace_zero_spsc_ring(libtrace_spsc_ring_t *rb);
+DLLEXPORT void libtrace_spsc_ring_destroy(libtrace_spsc_ring_t *rb);
+DLLEXPORT int libtrace_spsc_ring_is_empty(const libtrace_spsc_ring_t *rb);
+DLLEXPORT int libtrace_spsc_ring_is_full(const libtrace_spsc_ring_t *rb);
+DLLEXPORT size_t libtrace_spsc_ring_get_free(libtrace_spsc_ring_t *rb);
+
+DLLEXPORT void libtrace_spsc_ring_write(libtrace_spsc_ring_t *rb, void *value);
+DLLEXPORT int libtrace_spsc_ring_try_write(libtrace_spsc_ring_t *rb, void *value);
+DLLEXPORT size_t libtrace_spsc_ring_write_bulk(libtrace_spsc_ring_t *rb, void *values[], size_t nb_buffers, size_t min_nb_buffers);
+
+DLLEXPORT void *libtrace_spsc_ring_read(libtrace_spsc_ring_t *rb);
+DLLEXPORT int libtrace_spsc_ring_try_read(libtrace_spsc_ring_t *rb, void **value);
+DLLEXPORT size_t libtrace_spsc_ring_read_bulk(libtrace_spsc_ring_t *rb, void *values[], size_t nb_buffers, size_t min_nb_buffers);
+
+#endif
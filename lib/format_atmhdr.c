@@ -102,7 +102,7 @@ static int atmhdr_prepare_packet(libtrace_t *libtrace,
 	 * avoid leaking memory */
 	if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
 	/* Set the buffer owner appropriately */
@@ -131,8 +131,9 @@ static int atmhdr_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	uint32_t flags = 0;
 	
 	/* Make sure we have a buffer available to read the next record into */
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer=malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
+	if (!trace_reserve_packet_buffer(packet, 12)) {
+		trace_set_err(libtrace, errno, "Cannot allocate memory");
+		return -1;
 	}
 	buffer = packet->buffer;
 	flags |= TRACE_PREP_OWN_BUFFER;
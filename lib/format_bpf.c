@@ -404,7 +404,7 @@ static int bpf_prepare_packet(libtrace_t *libtrace UNUSED,
 	 * old one to avoid memory leaks */
 	if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
 	/* Set the buffer owner appropriately */
@@ -513,7 +513,7 @@ static int bpf_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 	flags |= TRACE_PREP_DO_NOT_OWN_BUFFER;
 
 	if (packet->buffer && packet->buf_control == TRACE_CTRL_PACKET)
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 
 	/* Update 'packet' to point to the first packet in our capture
 	 * buffer */
@@ -278,15 +278,10 @@ static int dag_get_duckinfo(libtrace_t *libtrace,
         dag_inf lt_dag_inf;
 
 	/* Allocate memory for the DUCK data */
-        if (packet->buf_control == TRACE_CTRL_EXTERNAL ||
-                        !packet->buffer) {
-                packet->buffer = malloc(LIBTRACE_PACKET_BUFSIZE);
-                packet->buf_control = TRACE_CTRL_PACKET;
-                if (!packet->buffer) {
-                        trace_set_err(libtrace, errno,
-                                        "Cannot allocate packet buffer");
-                        return -1;
-                }
+        if (!trace_reserve_packet_buffer(packet, LIBTRACE_PACKET_BUFSIZE)) {
+                trace_set_err(libtrace, errno,
+                                "Cannot allocate packet buffer");
+                return -1;
         }
 
 	/* DUCK doesn't actually have a format header, as such */
@@ -350,7 +345,7 @@ static int dag_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
          * old one to avoid memory leaks */
         if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
 	/* Set the buffer owner appropriately */
@@ -416,7 +411,7 @@ static int dag_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	 * that we can set the packet to point into the DAG memory hole */
 	if (packet->buf_control == TRACE_CTRL_PACKET) {
                 packet->buf_control = TRACE_CTRL_EXTERNAL;
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
                 packet->buffer = 0;
         }
 
@@ -925,15 +925,10 @@ static int dag_get_duckinfo(libtrace_t *libtrace,
 		return 0;
 
 	/* Allocate memory for the DUCK data */
-	if (packet->buf_control == TRACE_CTRL_EXTERNAL ||
-	    !packet->buffer) {
-		packet->buffer = malloc(LIBTRACE_PACKET_BUFSIZE);
-		packet->buf_control = TRACE_CTRL_PACKET;
-		if (!packet->buffer) {
-			trace_set_err(libtrace, errno,
-				      "Cannot allocate packet buffer");
-			return -1;
-		}
+	if (!trace_reserve_packet_buffer(packet, LIBTRACE_PACKET_BUFSIZE)) {
+		trace_set_err(libtrace, errno,
+			      "Cannot allocate packet buffer");
+		return -1;
 	}
 
 	/* DUCK doesn't have a format header */
@@ -1025,7 +1020,7 @@ static int dag_prepare_packet_stream(libtrace_t *libtrace,
 	 * old one to avoid memory leaks */
 	if (packet->buffer != buffer &&
 	    packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	/* Set the buffer owner appropriately */
@@ -1289,7 +1284,7 @@ static int dag_read_packet_stream(libtrace_t *libtrace,
 	/* If the packet buffer is currently owned by libtrace, free it so
 	 * that we can set the packet to point into the DAG memory hole */
 	if (packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 		packet->buffer = 0;
 	}
 
@@ -901,6 +901,7 @@ static int dpdk_config_input (libtrace_t *libtrace,
 			toeplitz_create_bikey(FORMAT(libtrace)->rss_key);
 			return 0;
 		case HASHER_CUSTOM:
+		case HASHER_FAST:
 			// We don't support these
 			return -1;
 		}
@@ -1798,7 +1799,7 @@ static int dpdk_prepare_packet(libtrace_t *libtrace UNUSED,
 	assert(packet);
 	if (packet->buffer != buffer &&
 	    packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER)
@@ -2097,7 +2098,7 @@ static int dpdk_pread_packets (libtrace_t *libtrace,
 			if (packets[i]->buffer != NULL) {
 				/* The packet should always be finished */
 				assert(packets[i]->buf_control == TRACE_CTRL_PACKET);
-				free(packets[i]->buffer);
+				libtrace_buffer_pool_free(packets[i]->buffer);
 			}
 			packets[i]->buf_control = TRACE_CTRL_EXTERNAL;
 			packets[i]->type = TRACE_RT_DATA_DPDK;
@@ -2119,7 +2120,7 @@ static int dpdk_read_packet (libtrace_t *libtrace, libtrace_packet_t *packet) {
 	if (packet->buffer != NULL) {
 		/* The packet should always be finished */
 		assert(packet->buf_control == TRACE_CTRL_PACKET);
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 		packet->buffer = NULL;
 	}
 
@@ -2230,7 +2231,7 @@ static libtrace_eventobj_t dpdk_trace_event(libtrace_t *trace,
 			if (packet->buffer != NULL) {
 				/* The packet should always be finished */
 				assert(packet->buf_control == TRACE_CTRL_PACKET);
-				free(packet->buffer);
+				libtrace_buffer_pool_free(packet->buffer);
 				packet->buffer = NULL;
 			}
 
@@ -154,7 +154,7 @@ static int duck_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 
         if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
         if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -183,13 +183,10 @@ static int duck_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	unsigned int duck_size;
 	uint32_t flags = 0;
 	
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-                packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-                if (!packet->buffer) {
-                        trace_set_err(libtrace, errno,
-                                        "Cannot allocate memory");
-                        return -1;
-                }
+	if (!trace_reserve_packet_buffer(packet, LIBTRACE_PACKET_BUFSIZE)) {
+                trace_set_err(libtrace, errno,
+                                "Cannot allocate memory");
+                return -1;
         }
 
 	flags |= TRACE_PREP_OWN_BUFFER;
@@ -102,6 +102,13 @@ struct erf_format_data_t {
 		 * each packet */
 		int real_time;
 	} options;
+
+	/* An uncompressed trace that is being read in parallel is mapped
+	 * and split between the threads */
+	struct trace_map_reader reader;
+
+	/* Reads the trace when it is not mapped */
+	struct trace_record_reader block_reader;
 };
 
 /* "Global" data that is stored for each ERF output trace */
@@ -122,6 +129,13 @@ struct erf_format_data_out_t {
 	
 };
 
+/* There aren't any erf traces before 1995-01-01 */
+#define ERF_MIN_TIMESTAMP 0x2f0539b000000000ULL
+
+/* The largest gap in seconds between neighbouring records that is
+ * considered plausible when resynchronising to a record boundary */
+#define RESYNC_MAX_GAP 3600
+
 typedef struct erf_index_t {
 	uint64_t timestamp;
 	uint64_t offset; 
@@ -192,7 +206,7 @@ static int erf_probe_magic(io_t *io)
 		return 0;
 	}
 	/* There aren't any erf traces before 1995-01-01 */
-	if (bswap_le_to_host64(erf->ts) < 0x2f0539b000000000ULL) {
+	if (bswap_le_to_host64(erf->ts) < ERF_MIN_TIMESTAMP) {
 		return 0;
 	}
 	/* And not pcap! */
@@ -218,6 +232,10 @@ static int erf_init_input(libtrace_t *libtrace)
 	
 	IN_OPTIONS.real_time = 0;
 	DATA(libtrace)->drops = 0;
+	DATA(libtrace)->reader.map = NULL;
+	DATA(libtrace)->reader.len = 0;
+	DATA(libtrace)->reader.boundaries = NULL;
+	trace_record_reader_init(&DATA(libtrace)->block_reader);
 	
 	return 0; /* success */
 }
@@ -236,6 +254,11 @@ static int erf_config_input(libtrace_t *libtrace, trace_option_t option,
 			trace_set_err(libtrace, TRACE_ERR_OPTION_UNAVAIL,
 					"Unsupported option");
 			return -1;
+		case TRACE_OPTION_HASHER:
+			/* Records are split between threads by where they
+			 * are in the file. Don't set an error, libtrace will
+			 * hash the packets itself. */
+			return -1;
 		default:
 			/* Unknown option */
 			trace_set_err(libtrace,TRACE_ERR_UNKNOWN_OPTION,
@@ -319,6 +342,7 @@ static int erf_fast_seek_start(libtrace_t *libtrace,uint64_t erfts)
 
 	/* We've found our location in the trace, now use it. */
 	wandio_seek(libtrace->io,(int64_t) record.offset,SEEK_SET);
+	trace_record_reader_reset(&DATA(libtrace)->block_reader);
 
 	return 0; /* success */
 }
@@ -334,6 +358,7 @@ static int erf_slow_seek_start(libtrace_t *libtrace,uint64_t erfts UNUSED)
 	libtrace->io = trace_open_file(libtrace);
 	if (!libtrace->io)
 		return -1;
+	trace_record_reader_reset(&DATA(libtrace)->block_reader);
 	return 0;
 }
 
@@ -377,10 +402,15 @@ static int erf_seek_erf(libtrace_t *libtrace,uint64_t erfts)
 		trace_read_packet(libtrace,packet);
 		if (trace_get_erf_timestamp(packet)==erfts)
 			break;
-		off=wandio_tell(libtrace->io);
+		off=trace_record_reader_tell(libtrace,
+				&DATA(libtrace)->block_reader);
 	} while(trace_get_erf_timestamp(packet)<erfts);
 
 	wandio_seek(libtrace->io,off,SEEK_SET);
+	trace_record_reader_reset(&DATA(libtrace)->block_reader);
+	/* Release the block the packet points into */
+	trace_fin_packet(packet);
+	trace_destroy_packet(packet);
 
 	return 0;
 }
@@ -422,6 +452,11 @@ static int erf_config_output(libtrace_out_t *libtrace,
 static int erf_fin_input(libtrace_t *libtrace) {
 	if (libtrace->io)
 		wandio_destroy(libtrace->io);
+	if (DATA(libtrace)->reader.map)
+		trace_unmap_file(DATA(libtrace)->reader.map,
+				DATA(libtrace)->reader.len);
+	trace_map_reader_destroy(&DATA(libtrace)->reader);
+	trace_record_reader_destroy(&DATA(libtrace)->block_reader);
 	free(libtrace->format_data);
 	return 0;
 }
@@ -440,7 +475,7 @@ static int erf_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 	
 	if (packet->buffer != buffer && 
 		packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -472,7 +507,9 @@ static int erf_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 		/* No idea how we get this yet */
 
 	} else if (erfptr->lctr) {
-		DATA(libtrace)->drops += ntohs(erfptr->lctr);
+		/* Records may be prepared by several threads at once */
+		__atomic_fetch_add(&DATA(libtrace)->drops, ntohs(erfptr->lctr),
+				__ATOMIC_RELAXED);
 	}
 
 	return 0;
@@ -481,26 +518,14 @@ static int erf_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 static int erf_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	int numbytes;
 	unsigned int size;
-	void *buffer2 = packet->buffer;
 	unsigned int rlen;
-	uint32_t flags = 0;
-	
+	dag_record_t *erfhdr;
+	void *record;
 	
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-		if (!packet->buffer) {
-			trace_set_err(libtrace, errno, 
-					"Cannot allocate memory");
-			return -1;
-		}
-	}
-
-	flags |= TRACE_PREP_OWN_BUFFER;	
-	
-	if ((numbytes=wandio_read(libtrace->io,
-					packet->buffer,
-					(size_t)dag_record_size)) == -1) {
-		trace_set_err(libtrace,errno,"reading ERF file");
+	/* Read the header first, so we know how long the record is */
+	if ((numbytes=trace_record_reader_peek(libtrace,
+					&DATA(libtrace)->block_reader,
+					(size_t)dag_record_size, &record)) == -1) {
 		return -1;
 	}
 	/* EOF */
@@ -513,8 +538,8 @@ static int erf_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
                 return -1;
         }
 
-	rlen = ntohs(((dag_record_t *)packet->buffer)->rlen);
-	buffer2 = (char*)packet->buffer + dag_record_size;
+	erfhdr = (dag_record_t *) record;
+	rlen = ntohs(erfhdr->rlen);
 	size = rlen - dag_record_size;
 
 	if (size >= LIBTRACE_PACKET_BUFSIZE) {
@@ -525,40 +550,141 @@ static int erf_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	}
 
 	/* Unknown/corrupt */
-	if ((((dag_record_t *)packet->buffer)->type & 0x7f) >= TYPE_RAW_LINK) {
+	if ((erfhdr->type & 0x7f) >= TYPE_RAW_LINK) {
 		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, 
 				"Corrupt or Unknown ERF type");
 		return -1;
 	}
-	
-	/* read in the rest of the packet */
-	if ((numbytes=wandio_read(libtrace->io,
-					buffer2,
-					(size_t)size)) != (int)size) {
+
+	/* read in the rest of the packet, the record may have been moved
+	 * to make room for it */
+	if ((numbytes=trace_record_reader_peek(libtrace,
+					&DATA(libtrace)->block_reader,
+					(size_t)rlen, &record)) != (int)rlen) {
 		if (numbytes==-1) {
-			trace_set_err(libtrace,errno, "read(%s)", 
-					libtrace->uridata);
 			return -1;
 		}
 		trace_set_err(libtrace,EIO,
 				"Truncated packet (wanted %d, got %d)", 
-				size, numbytes);
+				size, numbytes - (int)dag_record_size);
 		/* Failed to read the full packet?  must be EOF */
 		return -1;
 	}
-
-        if (numbytes < (int)size) {
-                trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Incomplete ERF record");
-                return -1;
-        }
 	
-	if (erf_prepare_packet(libtrace, packet, packet->buffer, 
-				TRACE_RT_DATA_ERF, flags))
+	if (erf_prepare_packet(libtrace, packet, record, 
+				TRACE_RT_DATA_ERF, TRACE_PREP_DO_NOT_OWN_BUFFER))
 		return -1;
+	trace_record_reader_claim(&DATA(libtrace)->block_reader, packet,
+			rlen);
 	
 	return rlen;
 }
 
+static size_t erf_record_length(libtrace_t *libtrace UNUSED,
+		const char *record, size_t avail)
+{
+	const dag_record_t *erfptr = (const dag_record_t *) record;
+	size_t rlen;
+
+	if (avail < dag_record_size)
+		return 0;
+	rlen = ntohs(erfptr->rlen);
+	if (rlen < dag_record_size)
+		return 0;
+	/* Unknown/corrupt */
+	if ((erfptr->type & 0x7f) >= TYPE_RAW_LINK)
+		return 0;
+	return rlen;
+}
+
+static bool erf_record_plausible(libtrace_t *libtrace UNUSED,
+		const char *record, const char *prev)
+{
+	const dag_record_t *erfptr = (const dag_record_t *) record;
+	uint64_t ts = bswap_le_to_host64(erfptr->ts);
+
+	if (ts < ERF_MIN_TIMESTAMP)
+		return false;
+	if (prev) {
+		const dag_record_t *prevptr = (const dag_record_t *) prev;
+		int64_t gap = (int64_t) (ts >> 32) -
+			(int64_t) (bswap_le_to_host64(prevptr->ts) >> 32);
+
+		if (gap > RESYNC_MAX_GAP || gap < -RESYNC_MAX_GAP)
+			return false;
+	}
+	return true;
+}
+
+/* Only an uncompressed file can be read in parallel. Anything else fails
+ * here without an error, so the trace is started with erf_start_input()
+ * and is read by one thread at a time. */
+static int erf_pstart_input(libtrace_t *libtrace)
+{
+	struct trace_map_reader *reader = &DATA(libtrace)->reader;
+	size_t len;
+	char *map;
+
+	if (reader->map)
+		return 0;	/* Resuming after a pause */
+	map = trace_map_file(libtrace, &len);
+	if (!map)
+		return -1;
+
+	if (trace_map_reader_init(libtrace, reader, map, len, 0,
+				erf_record_length, erf_record_plausible)) {
+		trace_unmap_file(map, len);
+		reader->map = NULL;
+		return -1;
+	}
+	/* Compressed files are mapped too, but won't start with records */
+	if (!trace_map_reader_is_boundary(libtrace, reader, 0)) {
+		trace_map_reader_destroy(reader);
+		trace_unmap_file(map, len);
+		reader->map = NULL;
+		return -1;
+	}
+
+	/* Opened to probe the file, but it is not needed from now on */
+	if (libtrace->io) {
+		wandio_destroy(libtrace->io);
+		libtrace->io = NULL;
+	}
+	DATA(libtrace)->drops = 0;
+	return 0;
+}
+
+static int erf_pread_packets(libtrace_t *libtrace, libtrace_thread_t *t,
+		libtrace_packet_t *packets[], size_t nb_packets)
+{
+	size_t i, offset;
+	int len = 0;
+
+	for (i = 0; i < nb_packets; i++) {
+		len = trace_map_reader_next(libtrace, &DATA(libtrace)->reader,
+				t, &offset);
+		if (len <= 0)
+			break;
+
+		packets[i]->trace = libtrace;
+		if (erf_prepare_packet(libtrace, packets[i],
+					DATA(libtrace)->reader.map + offset,
+					TRACE_RT_DATA_ERF,
+					TRACE_PREP_DO_NOT_OWN_BUFFER)) {
+			len = -1;
+			break;
+		}
+		packets[i]->error = len;
+		/* Keeps the packets in the same order as the file */
+		trace_packet_set_order(packets[i], offset);
+	}
+
+	/* Return what was read, the EOF or error will be seen next time */
+	if (i > 0)
+		return i;
+	return len;
+}
+
 static int erf_dump_packet(libtrace_out_t *libtrace,
 		dag_record_t *erfptr, int framinglen, void *buffer,
                 int caplen) {
@@ -871,7 +997,14 @@ static struct libtrace_format_t erfformat = {
 	erf_event,			/* trace_event */
 	erf_help,			/* help */
 	NULL,				/* next pointer */
-	NON_PARALLEL(false)
+	{false, -1},			/* Not live, no thread limit */
+	erf_pstart_input,		/* pstart_input */
+	erf_pread_packets,		/* pread_packets */
+	NULL,				/* ppause_input */
+	erf_fin_input,			/* pfin_input */
+	trace_map_pregister_thread,	/* pregister_thread */
+	trace_map_punregister_thread,	/* punregister_thread */
+	NULL				/* get_thread_statistics */
 };
 
 static struct libtrace_format_t rawerfformat = {
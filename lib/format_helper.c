@@ -45,6 +45,7 @@
 #include <errno.h>
 #include <time.h>
 #include "format_helper.h"
+#include "data-struct/buckets.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -65,6 +66,9 @@ struct libtrace_eventobj_t trace_event_device(struct libtrace_t *trace, struct l
 }
 #else
 #  include <sys/ioctl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
 
 /* Generic event function for live capture devices / interfaces */
 struct libtrace_eventobj_t trace_event_device(struct libtrace_t *trace, 
@@ -257,6 +261,463 @@ io_t *trace_open_file(libtrace_t *trace)
 	return io;
 }
 
+/* Map a file into memory for reading, see format_helper.h */
+void *trace_map_file(libtrace_t *trace, size_t *len)
+{
+#ifndef WIN32
+	struct stat st;
+	void *map;
+	int fd;
+
+	/* Pipes and stdin cannot be mapped */
+	if (strcmp(trace->uridata, "-") == 0)
+		return NULL;
+	fd = open(trace->uridata, O_RDONLY | O_LARGEFILE | O_BINARY);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+			(uint64_t) st.st_size > SIZE_MAX) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Private and writable so functions which modify a packet in place,
+	 * such as trace_set_capture_length(), only ever touch a copy of the
+	 * page. Nothing is written back to the file. */
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+#ifdef MADV_SEQUENTIAL
+	madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+	*len = (size_t) st.st_size;
+	return map;
+#else
+	(void) trace;
+	(void) len;
+	return NULL;
+#endif
+}
+
+/* Hint that part of a mapped file will be needed soon */
+void trace_map_file_prefetch(void *map, size_t len, size_t offset,
+		size_t bytes)
+{
+#if !defined(WIN32) && defined(MADV_WILLNEED)
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t start;
+
+	if (offset >= len)
+		return;
+	/* madvise() wants a page aligned start */
+	start = offset & ~((size_t) pagesize - 1);
+	if (bytes > len - start)
+		bytes = len - start;
+	madvise((char *) map + start, bytes, MADV_WILLNEED);
+#else
+	(void) map;
+	(void) len;
+	(void) offset;
+	(void) bytes;
+#endif
+}
+
+void trace_unmap_file(void *map, size_t len)
+{
+#ifndef WIN32
+	munmap(map, len);
+#else
+	(void) map;
+	(void) len;
+#endif
+}
+
+/* The size of the ranges a mapped trace file is split into, small enough
+ * that an ordered combiner does not hold many results waiting on a slower
+ * thread */
+#define MAP_CHUNK_SIZE (1024 * 1024)
+/* The number of consecutive valid records that mark a record boundary */
+#define MAP_RESYNC_RECORDS 8
+
+/* Where no record boundary was found in a range */
+#define MAP_NO_BOUNDARY SIZE_MAX
+
+/* The position of a thread within the trace_map_reader */
+struct trace_map_chunk {
+	/* The next record to be read */
+	size_t offset;
+	/* Records starting at or after this belong to the next range */
+	size_t end;
+	/* The range starting at end, which this thread's records run into,
+	 * or 0 if they do not run into another range */
+	size_t next_range;
+	/* Set if end is where another thread started reading, so the
+	 * records must finish exactly there */
+	bool exact;
+};
+
+/* Where the threads reading a range and the range before it meet. Each
+ * notes its offset then arrives, and the second to arrive reconciles the
+ * two. */
+struct trace_map_boundary {
+	/* The first record of the range, from the records before it */
+	size_t end;
+	/* Where the thread reading the range resynchronised to */
+	size_t start;
+	int arrived;
+};
+
+int trace_map_reader_init(libtrace_t *libtrace,
+		struct trace_map_reader *reader, char *map,
+		size_t len, size_t first,
+		size_t (*record_length)(libtrace_t *, const char *, size_t),
+		bool (*record_plausible)(libtrace_t *, const char *,
+			const char *))
+{
+	reader->map = map;
+	reader->len = len;
+	reader->first = first;
+	reader->next_chunk = first;
+	reader->record_length = record_length;
+	reader->record_plausible = record_plausible;
+	reader->nb_ranges = len > first ?
+		(len - first + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE : 0;
+	reader->boundaries = calloc(reader->nb_ranges + 1,
+			sizeof(struct trace_map_boundary));
+	if (!reader->boundaries) {
+		trace_set_err(libtrace, ENOMEM, "Out of memory");
+		return -1;
+	}
+	return 0;
+}
+
+void trace_map_reader_destroy(struct trace_map_reader *reader)
+{
+	free(reader->boundaries);
+	reader->boundaries = NULL;
+}
+
+/* Checks whether a run of valid records starts at offset, see
+ * format_helper.h */
+bool trace_map_reader_is_boundary(libtrace_t *libtrace,
+		struct trace_map_reader *reader, size_t offset)
+{
+	const char *prev = NULL;
+	int i;
+
+	for (i = 0; i < MAP_RESYNC_RECORDS; i++) {
+		const char *record = reader->map + offset;
+		size_t len;
+
+		if (offset == reader->len)
+			return i > 0;
+		len = reader->record_length(libtrace, record,
+				reader->len - offset);
+		if (len == 0 || len > reader->len - offset)
+			return false;
+		if (!reader->record_plausible(libtrace, record, prev))
+			return false;
+		prev = record;
+		offset += len;
+	}
+	return true;
+}
+
+/* Finds the first record boundary in a range, or returns MAP_NO_BOUNDARY
+ * if no record appears to start within it */
+static size_t map_reader_resync(libtrace_t *libtrace,
+		struct trace_map_reader *reader, size_t offset, size_t end)
+{
+	for (; offset < end; offset++) {
+		if (trace_map_reader_is_boundary(libtrace, reader, offset))
+			return offset;
+	}
+	return MAP_NO_BOUNDARY;
+}
+
+/* Raised where a thread's records run past the offset at which another
+ * thread began reading, so one of them is not reading real records */
+static int map_reader_misaligned(libtrace_t *libtrace, size_t offset,
+		size_t start)
+{
+	trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+			"Records run up to offset %"PRIu64" but another thread "
+			"began reading at offset %"PRIu64", the trace may be "
+			"corrupt", (uint64_t) offset, (uint64_t) start);
+	return -1;
+}
+
+static size_t map_range_end(struct trace_map_reader *reader, size_t range)
+{
+	size_t end = reader->first + (range + 1) * MAP_CHUNK_SIZE;
+
+	return end < reader->len ? end : reader->len;
+}
+
+/* Called once a thread has claimed a range and searched it for a record
+ * boundary, decides where the thread starts reading */
+static void map_reader_start_range(struct trace_map_reader *reader,
+		struct trace_map_chunk *chunk, size_t range, size_t start)
+{
+	struct trace_map_boundary *boundary = &reader->boundaries[range];
+
+	chunk->next_range = range + 1 < reader->nb_ranges ? range + 1 : 0;
+	__atomic_store_n(&boundary->start, start, __ATOMIC_RELAXED);
+	if (__atomic_fetch_add(&boundary->arrived, 1, __ATOMIC_ACQ_REL) > 0) {
+		/* The range before is finished, its records say exactly
+		 * where this range's first record is */
+		chunk->offset = __atomic_load_n(&boundary->end,
+				__ATOMIC_RELAXED);
+	} else if (start == MAP_NO_BOUNDARY) {
+		/* Left for the thread reading the range before */
+		chunk->offset = chunk->end;
+		chunk->next_range = 0;
+	} else {
+		chunk->offset = start;
+	}
+}
+
+/* Called once a thread's records have run into the next range, returns 1
+ * if the thread must carry on reading, 0 if it is done or -1 if its
+ * records do not line up with where the range's reader started */
+static int map_reader_end_range(libtrace_t *libtrace,
+		struct trace_map_reader *reader, struct trace_map_chunk *chunk)
+{
+	size_t range = chunk->next_range;
+	struct trace_map_boundary *boundary = &reader->boundaries[range];
+	size_t start;
+
+	chunk->next_range = 0;
+	__atomic_store_n(&boundary->end, chunk->offset, __ATOMIC_RELAXED);
+	if (__atomic_fetch_add(&boundary->arrived, 1, __ATOMIC_ACQ_REL) == 0)
+		return 0;	/* The range's reader will start from here */
+
+	start = __atomic_load_n(&boundary->start, __ATOMIC_RELAXED);
+	if (start == MAP_NO_BOUNDARY) {
+		/* Nothing in the range looked valid, read all of it */
+		chunk->end = map_range_end(reader, range);
+		if (range + 1 < reader->nb_ranges)
+			chunk->next_range = range + 1;
+		return 1;
+	}
+	if (chunk->offset < start) {
+		/* Read the records the resynchronisation passed over */
+		chunk->end = start;
+		chunk->exact = true;
+		return 1;
+	}
+	if (chunk->offset == start)
+		return 0;
+	return map_reader_misaligned(libtrace, chunk->offset, start);
+}
+
+int trace_map_reader_next(libtrace_t *libtrace,
+		struct trace_map_reader *reader, libtrace_thread_t *t,
+		size_t *offset)
+{
+	struct trace_map_chunk *chunk = t->format_data;
+	size_t len, avail;
+
+	while (chunk->offset >= chunk->end) {
+		size_t start, range;
+
+		if (chunk->exact) {
+			chunk->exact = false;
+			if (chunk->offset != chunk->end)
+				return map_reader_misaligned(libtrace,
+						chunk->offset, chunk->end);
+		} else if (chunk->next_range) {
+			int ret = map_reader_end_range(libtrace, reader, chunk);
+
+			if (ret < 0)
+				return -1;
+			if (ret > 0)
+				continue;
+		}
+
+		start = __atomic_fetch_add(&reader->next_chunk,
+				MAP_CHUNK_SIZE, __ATOMIC_RELAXED);
+		if (start >= reader->len)
+			return 0;
+		range = (start - reader->first) / MAP_CHUNK_SIZE;
+		chunk->end = map_range_end(reader, range);
+		trace_map_file_prefetch(reader->map, reader->len, start,
+				MAP_CHUNK_SIZE);
+		if (range == 0) {
+			chunk->offset = start;
+			chunk->next_range = reader->nb_ranges > 1 ? 1 : 0;
+		} else {
+			map_reader_start_range(reader, chunk, range,
+					map_reader_resync(libtrace, reader,
+						start, chunk->end));
+		}
+	}
+
+	avail = reader->len - chunk->offset;
+	len = reader->record_length(libtrace, reader->map + chunk->offset,
+			avail);
+	if (len == 0 || len > avail) {
+		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+				"Corrupt or truncated record at offset %"PRIu64,
+				(uint64_t) chunk->offset);
+		return -1;
+	}
+	*offset = chunk->offset;
+	chunk->offset += len;
+	return (int) len;
+}
+
+int trace_map_pregister_thread(libtrace_t *libtrace, libtrace_thread_t *t,
+		bool reader)
+{
+	struct trace_map_chunk *chunk;
+
+	if (!reader)
+		return 0;
+	/* Nothing is claimed until the first read */
+	chunk = calloc(1, sizeof(struct trace_map_chunk));
+	if (!chunk) {
+		trace_set_err(libtrace, ENOMEM, "Out of memory");
+		return -1;
+	}
+	t->format_data = chunk;
+	return 0;
+}
+
+void trace_map_punregister_thread(libtrace_t *libtrace UNUSED,
+		libtrace_thread_t *t)
+{
+	free(t->format_data);
+	t->format_data = NULL;
+}
+
+/* The size of the blocks read by a trace_record_reader */
+#define RECORD_READER_BLOCK_SIZE (1024 * 1024)
+/* A bucket tracks at most UINT16_MAX packets in each buffer, this leaves
+ * room for the ids it skips because older packets still hold them */
+#define RECORD_READER_MAX_RECORDS 32768
+
+void trace_record_reader_init(struct trace_record_reader *reader)
+{
+	reader->bucket = NULL;
+	reader->block = NULL;
+	reader->read = NULL;
+	reader->write = NULL;
+	reader->end = NULL;
+	reader->records = 0;
+}
+
+void trace_record_reader_destroy(struct trace_record_reader *reader)
+{
+	/* The bucket owns the blocks */
+	if (reader->bucket)
+		libtrace_bucket_destroy(reader->bucket);
+	trace_record_reader_init(reader);
+}
+
+/* Starts a new block, moving across any unread data from the current one.
+ * The current block is left to the bucket to free. */
+static int record_reader_new_block(libtrace_t *libtrace,
+		struct trace_record_reader *reader, size_t len)
+{
+	size_t left = reader->write - reader->read;
+	size_t size = RECORD_READER_BLOCK_SIZE;
+	char *block;
+
+	if (size < len)
+		size = len;
+	if (size < left)
+		size = left;
+	if (!reader->bucket) {
+		reader->bucket = libtrace_bucket_init();
+		if (!reader->bucket) {
+			trace_set_err(libtrace, ENOMEM, "Out of memory");
+			return -1;
+		}
+	}
+	block = malloc(size);
+	if (!block) {
+		trace_set_err(libtrace, ENOMEM, "Out of memory");
+		return -1;
+	}
+	if (left)
+		memcpy(block, reader->read, left);
+	libtrace_create_new_bucket(reader->bucket, block);
+
+	reader->block = block;
+	reader->read = block;
+	reader->write = block + left;
+	reader->end = block + size;
+	reader->records = 0;
+	return 0;
+}
+
+int trace_record_reader_peek(libtrace_t *libtrace,
+		struct trace_record_reader *reader, size_t len, void **record)
+{
+	size_t avail = reader->write - reader->read;
+
+	if (reader->records >= RECORD_READER_MAX_RECORDS) {
+		if (record_reader_new_block(libtrace, reader, len))
+			return -1;
+	}
+	if (avail < len) {
+		if (!reader->block ||
+				(size_t) (reader->end - reader->read) < len) {
+			if (record_reader_new_block(libtrace, reader, len))
+				return -1;
+		}
+		/* Fill the rest of the block, not just what was asked for */
+		while (avail < len) {
+			int64_t numbytes = wandio_read(libtrace->io,
+					reader->write,
+					reader->end - reader->write);
+
+			if (numbytes < 0) {
+				trace_set_err(libtrace, errno, "read(%s)",
+						libtrace->uridata);
+				return -1;
+			}
+			if (numbytes == 0)
+				break;	/* EOF */
+			reader->write += numbytes;
+			avail += numbytes;
+		}
+	}
+
+	*record = reader->read;
+	return avail < len ? (int) avail : (int) len;
+}
+
+void trace_record_reader_claim(struct trace_record_reader *reader,
+		libtrace_packet_t *packet, size_t len)
+{
+	assert(reader->read + len <= reader->write);
+	packet->internalid = libtrace_push_into_bucket(reader->bucket);
+	packet->srcbucket = reader->bucket;
+	reader->read += len;
+	reader->records++;
+}
+
+void trace_record_reader_skip(struct trace_record_reader *reader, size_t len)
+{
+	assert(reader->read + len <= reader->write);
+	reader->read += len;
+}
+
+void trace_record_reader_reset(struct trace_record_reader *reader)
+{
+	reader->read = reader->write;
+}
+
+int64_t trace_record_reader_tell(libtrace_t *libtrace,
+		struct trace_record_reader *reader)
+{
+	return wandio_tell(libtrace->io) - (reader->write - reader->read);
+}
+
 /* Open a file for writing using the new Libtrace IO system */ 
 iow_t *trace_open_file_out(libtrace_out_t *trace, int compress_type, int level, int fileflag)
 {
@@ -80,6 +80,223 @@ struct libtrace_eventobj_t trace_event_trace(libtrace_t *trace, libtrace_packet_
  */
 io_t *trace_open_file(libtrace_t *libtrace);
 
+/** Maps an input trace file into memory, so packets can be read in place
+ * rather than copied out by the libtrace IO system
+ *
+ * @param libtrace	The input trace whose file is to be mapped
+ * @param[out] len	Set to the length of the mapping
+ * @return The start of the mapping or NULL if the file cannot be mapped, e.g.
+ * it is stdin, a pipe or empty. No error is set, callers are expected to
+ * fall back to trace_open_file().
+ *
+ * The whole file is mapped and is not checked for compression, so callers
+ * must validate the contents themselves. Pages of the mapping may be
+ * modified, the changes are never written back to the file.
+ */
+void *trace_map_file(libtrace_t *libtrace, size_t *len);
+
+/** Hints that a range of a file mapped by trace_map_file() will be read
+ * soon so that the kernel can start reading it in
+ *
+ * @param map		The mapping returned by trace_map_file()
+ * @param len		The length of the mapping
+ * @param offset	The offset of the range within the mapping
+ * @param bytes		The length of the range, truncated to the mapping
+ */
+void trace_map_file_prefetch(void *map, size_t len, size_t offset,
+		size_t bytes);
+
+/** Unmaps a file mapped by trace_map_file()
+ *
+ * @param map		The mapping returned by trace_map_file()
+ * @param len		The length of the mapping
+ */
+void trace_unmap_file(void *map, size_t len);
+
+/** The state shared by the threads reading a mapped trace file in parallel
+ *
+ * The file is split into fixed size byte ranges which the threads claim in
+ * turn. A range is read from the first record that starts in it up to and
+ * including the last record that starts in it, so no record is read twice.
+ * Where a range begins mid record the thread resynchronises by searching
+ * for the first offset from which a run of records all look valid.
+ *
+ * A resynchronisation is only a guess, so it is checked against where the
+ * records of the range before actually run up to. Whichever of the two
+ * threads gets there second reconciles them, reading any records the guess
+ * passed over. Records that cannot be lined up are an error rather than
+ * being skipped.
+ */
+struct trace_map_reader {
+	/* The mapping returned by trace_map_file() */
+	char *map;
+	size_t len;
+	/* The offset of the first record, i.e. past any file header */
+	size_t first;
+	/* The start of the next range to be claimed */
+	size_t next_chunk;
+	/* Where the threads reading each range and the one before it meet */
+	struct trace_map_boundary *boundaries;
+	size_t nb_ranges;
+
+	/* Returns the length of the record at the start of record, including
+	 * its header, or 0 if the header is incomplete or corrupt. The record
+	 * may be longer than avail. */
+	size_t (*record_length)(libtrace_t *libtrace, const char *record,
+			size_t avail);
+	/* Stricter checks used while resynchronising, prev is the record
+	 * before this one in the run being checked or NULL */
+	bool (*record_plausible)(libtrace_t *libtrace, const char *record,
+			const char *prev);
+};
+
+/** Prepares to read a mapped trace file in parallel
+ *
+ * @param libtrace	The input trace
+ * @param reader	The reader to initialise
+ * @param map		The mapping returned by trace_map_file()
+ * @param len		The length of the mapping
+ * @param first		The offset of the first record in the mapping
+ * @param record_length	Returns the length of a record, see trace_map_reader
+ * @param record_plausible	Checks a record when resynchronising
+ * @return 0 if successful, -1 with an error set if out of memory
+ */
+int trace_map_reader_init(libtrace_t *libtrace,
+		struct trace_map_reader *reader, char *map,
+		size_t len, size_t first,
+		size_t (*record_length)(libtrace_t *, const char *, size_t),
+		bool (*record_plausible)(libtrace_t *, const char *,
+			const char *));
+
+/** Frees a reader set up by trace_map_reader_init(), the mapping itself is
+ * left to the caller. A reader whose boundaries are NULL, e.g. one that
+ * was never initialised, is left alone.
+ *
+ * @param reader	The reader to destroy
+ */
+void trace_map_reader_destroy(struct trace_map_reader *reader);
+
+/** Checks whether a record boundary is at an offset in the mapping, i.e.
+ * whether a run of records starting there all look valid. A run which
+ * ends exactly at the end of the file also counts.
+ *
+ * @param libtrace	The input trace
+ * @param reader	The reader for the mapping
+ * @param offset	The offset to be checked
+ * @return true if a record appears to start at offset
+ */
+bool trace_map_reader_is_boundary(libtrace_t *libtrace,
+		struct trace_map_reader *reader, size_t offset);
+
+/** Finds the next record to be read by a thread
+ *
+ * @param libtrace	The input trace
+ * @param reader	The reader shared by all threads
+ * @param t		The thread, which must have been registered with
+ * 			trace_map_pregister_thread()
+ * @param[out] offset	Set to the offset of the record within the mapping
+ * @return The length of the record, 0 once every range has been claimed or
+ * -1 if the record is corrupt or truncated, or the records of two ranges
+ * do not line up
+ */
+int trace_map_reader_next(libtrace_t *libtrace,
+		struct trace_map_reader *reader, libtrace_thread_t *t,
+		size_t *offset);
+
+/** A pregister_thread implementation for formats that use a
+ * trace_map_reader, reading threads are given somewhere to keep their
+ * position in the file
+ */
+int trace_map_pregister_thread(libtrace_t *libtrace, libtrace_thread_t *t,
+		bool reader);
+
+/** The punregister_thread implementation to go with
+ * trace_map_pregister_thread()
+ */
+void trace_map_punregister_thread(libtrace_t *libtrace, libtrace_thread_t *t);
+
+/** Reads the records of a trace file from libtrace->io a large block at a
+ * time, rather than with a wandio_read() for each header and each body.
+ *
+ * Packets point straight into the block and are tracked by a bucket (see
+ * data-struct/buckets.h), so a block is freed once every packet read from
+ * it has been finished with. Any partial record at the end of a block is
+ * copied to the start of the next one.
+ */
+struct trace_record_reader {
+	/* Created on the first read */
+	struct buckets *bucket;
+	/* The current block, and the unread data within it */
+	char *block;
+	char *read;
+	char *write;
+	char *end;
+	/* The number of packets read from the current block */
+	uint32_t records;
+};
+
+/** Initialises a record reader, nothing is allocated until the first read
+ *
+ * @param reader	The reader to initialise
+ */
+void trace_record_reader_init(struct trace_record_reader *reader);
+
+/** Frees a record reader and every block it has read, so no packet read
+ * through it may be used afterwards
+ *
+ * @param reader	The reader to destroy
+ */
+void trace_record_reader_destroy(struct trace_record_reader *reader);
+
+/** Looks at the next bytes of the trace without consuming them
+ *
+ * @param libtrace	The input trace, which is read from libtrace->io
+ * @param reader	The reader for the trace
+ * @param len		The number of bytes wanted
+ * @param[out] record	Set to the start of the bytes
+ * @return The number of bytes available at record, this is only less than
+ * len at the end of the file, or -1 if an error occurred.
+ *
+ * The pointer is only valid until the next call for this reader.
+ */
+int trace_record_reader_peek(libtrace_t *libtrace,
+		struct trace_record_reader *reader, size_t len, void **record);
+
+/** Consumes the next record, which must have been returned by the last call
+ * to trace_record_reader_peek(), and ties a packet pointing at it to the
+ * block so the block is kept until the packet is finished with
+ *
+ * @param reader	The reader for the trace
+ * @param packet	The packet the record has been read into
+ * @param len		The length of the record
+ */
+void trace_record_reader_claim(struct trace_record_reader *reader,
+		libtrace_packet_t *packet, size_t len);
+
+/** Consumes the next record without reading it into a packet, e.g. a record
+ * the format ignores
+ *
+ * @param reader	The reader for the trace
+ * @param len		The length of the record
+ */
+void trace_record_reader_skip(struct trace_record_reader *reader, size_t len);
+
+/** Discards anything buffered, this must be called after seeking
+ * libtrace->io
+ *
+ * @param reader	The reader for the trace
+ */
+void trace_record_reader_reset(struct trace_record_reader *reader);
+
+/** Returns the offset in the trace of the next record, where wandio_tell()
+ * would return it without the buffering
+ *
+ * @param libtrace	The input trace
+ * @param reader	The reader for the trace
+ */
+int64_t trace_record_reader_tell(libtrace_t *libtrace,
+		struct trace_record_reader *reader);
+
 /** Opens an output trace file for writing
  *
  * @param libtrace	The output trace to be opened
@@ -94,6 +94,8 @@ struct legacy_format_data_t {
 	uint64_t ts_high;	/* The timestamp of the last packet */
 	uint32_t ts_old; 	/* The timestamp of the last packet as 
 				   reported in the NZIX header */
+	struct trace_record_reader block_reader;	/* Reads the records
+							   from libtrace->io */
 };
 
 static void legacy_init_format_data(libtrace_t *libtrace) {
@@ -102,6 +104,7 @@ static void legacy_init_format_data(libtrace_t *libtrace) {
 	DATA(libtrace)->ts_high = 0;
 	DATA(libtrace)->ts_old = 0;
 	DATA(libtrace)->starttime = 0;
+	trace_record_reader_init(&DATA(libtrace)->block_reader);
 }
 
 static int legacyeth_get_framing_length(const libtrace_packet_t *packet UNUSED) 
@@ -211,6 +214,7 @@ static int erf_start_input(libtrace_t *libtrace)
 
 static int erf_fin_input(libtrace_t *libtrace) {
 	wandio_destroy(libtrace->io);
+	trace_record_reader_destroy(&DATA(libtrace)->block_reader);
 	free(libtrace->format_data);
 	return 0;
 }
@@ -221,7 +225,7 @@ static int legacy_prepare_packet(libtrace_t *libtrace,
 
 	if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
         if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -246,13 +250,6 @@ static int legacy_prepare_packet(libtrace_t *libtrace,
 static int legacy_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	int numbytes;
 	void *buffer;
-	uint32_t flags = 0;
-	
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer=malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-	}
-	flags |= TRACE_PREP_OWN_BUFFER;
-	buffer = packet->buffer;
 
 	switch(libtrace->format->type) {
 		case TRACE_FORMAT_LEGACY_ATM:
@@ -270,26 +267,20 @@ static int legacy_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 
 	/* This is going to block until we either get an entire record
 	 * or we reach the end of the file */
-	while (1) {
-	
-		if ((numbytes=wandio_read(libtrace->io,
-						buffer,
-						(size_t)64)) != 64) {
-			if (numbytes < 0) {
-				trace_set_err(libtrace,errno,"read(%s)",libtrace->uridata);
-			} else if (numbytes > 0) {
-				
-				continue;
-			}
-			return numbytes;
-		}
-		break;
+	if ((numbytes=trace_record_reader_peek(libtrace,
+					&DATA(libtrace)->block_reader,
+					(size_t)64, &buffer)) != 64) {
+		/* A partial record at the end of the file is ignored */
+		if (numbytes < 0)
+			return -1;
+		return 0;
 	}
 	
-	if (legacy_prepare_packet(libtrace, packet, packet->buffer, 
-				packet->type, flags)) {
+	if (legacy_prepare_packet(libtrace, packet, buffer, 
+				packet->type, TRACE_PREP_DO_NOT_OWN_BUFFER)) {
 		return -1;
 	}
+	trace_record_reader_claim(&DATA(libtrace)->block_reader, packet, 64);
 	
 	return 64;
 	
@@ -303,43 +294,42 @@ static int legacynzix_read_packet(libtrace_t *libtrace, libtrace_packet_t *packe
 	int numbytes;
 	void *buffer;
 	char *data_ptr;
-	uint32_t flags = 0;
 	
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer=malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-	}
-	flags |= TRACE_PREP_OWN_BUFFER;
-	
-	buffer = packet->buffer;
 	packet->type = TRACE_RT_DATA_LEGACY_NZIX;
 	
 	while (1) {
-		if ((numbytes = wandio_read(libtrace->io, buffer,
-						(size_t)68)) != 68) {
-			if (numbytes < 0) {
-				trace_set_err(libtrace,errno,"read(%s)",libtrace->uridata);
-			} else if (numbytes > 0)
-				continue;
-			return numbytes;
+		if ((numbytes = trace_record_reader_peek(libtrace,
+						&DATA(libtrace)->block_reader,
+						(size_t)68, &buffer)) != 68) {
+			/* A partial record at the end of the file is
+			 * ignored */
+			if (numbytes < 0)
+				return -1;
+			return 0;
 		} 
 		/* Packets with a zero length are GPS timestamp packets
 		 * but they aren't inserted at the right time to be
 		 * useful - instead we'll ignore them unless we can think
 		 * of a compelling reason to do otherwise */
-		if (((legacy_nzix_t *)buffer)->len == 0)
+		if (((legacy_nzix_t *)buffer)->len == 0) {
+			trace_record_reader_skip(&DATA(libtrace)->block_reader,
+					68);
 			continue;
+		}
 		
 		break;
 	}
 
-	/* Lets move the padding so that it's in the framing header */
+	/* Lets move the padding so that it's in the framing header, the
+	 * record is ours to modify */
 	data_ptr = ((char *)buffer) + 12;
 	memmove(data_ptr + 2, data_ptr, 26);
 
-	if (legacy_prepare_packet(libtrace, packet, packet->buffer, 
-				packet->type, flags)) {
+	if (legacy_prepare_packet(libtrace, packet, buffer, 
+				packet->type, TRACE_PREP_DO_NOT_OWN_BUFFER)) {
 		return -1;
 	}
+	trace_record_reader_claim(&DATA(libtrace)->block_reader, packet, 68);
 	return 68;
 }
 		
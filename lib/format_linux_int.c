@@ -104,7 +104,7 @@ static int linuxnative_prepare_packet(libtrace_t *libtrace UNUSED,
 
 	if (packet->buffer != buffer &&
 	    packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -152,11 +152,8 @@ inline static int linuxnative_read_stream(libtrace_t *libtrace,
 	struct timeval tout;
 	int ret;
 	
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-		if (!packet->buffer) {
-			perror("Cannot allocate buffer");
-		}
+	if (!trace_reserve_packet_buffer(packet, LIBTRACE_PACKET_BUFSIZE)) {
+		perror("Cannot allocate buffer");
 	}
 
 	flags |= TRACE_PREP_OWN_BUFFER;
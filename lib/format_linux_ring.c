@@ -228,7 +228,7 @@ inline static void ring_release_frame(libtrace_t *libtrace UNUSED,
 		return;
 
 	if(packet->buf_control == TRACE_CTRL_PACKET){
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 		packet->buffer = NULL;
 	}
 
@@ -432,7 +432,7 @@ static int linuxring_prepare_packet(libtrace_t *libtrace UNUSED,
 {
 	if (packet->buffer != buffer &&
 	    packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER)
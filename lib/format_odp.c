@@ -8,6 +8,11 @@
 #include <assert.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
 
 #include "config.h"
 #include "libtrace.h"
@@ -24,13 +29,84 @@
 #define SHM_PKT_POOL_SIZE      (512*2048)
 #define SHM_PKT_POOL_BUF_SIZE  1856
 
+/* The number of packet buffers each RX queue keeps posted to the NIC
+ * and the number of packets that can be waiting in the TX ring. These
+ * are taken from the pool in addition to what libtrace holds */
+#define NB_RX_DESC 1024
+#define NB_TX_DESC 1024
+
+/* For single threaded libtrace we read packets as a batch/burst
+ * this is the maximum size of said burst */
+#define BURST_SIZE 32
+
+/* Once the oldest packet waiting for a full burst is this old, in
+ * nanoseconds, the next packet written sends the burst. libtrace gives an
+ * output no chance to act between writes, so a partial burst followed by
+ * an idle period is held until the next write or the output is closed. */
+#define TX_FLUSH_NS 100000
+
+/* How long a reader waits for packets before checking for messages, in
+ * nanoseconds. This bounds how late a pause, stop or tick is acted on */
+#define RX_WAIT_NS 1000000
+
+/* How long destroying an input waits for its packets to be returned to the
+ * pool, e.g. by an ODP output still sending them, in nanoseconds */
+#define POOL_DESTROY_WAIT_NS 1000000000
+
+/* Hugepage memory in MB reserved on the NUMA socket given in the URI */
+#define SOCKET_MEM_MB 1024
+
+/* The most ports that can be listed in a single URI */
+#define ODP_MAX_PORTS 8
+
+#define ODP_DEVNAME_LEN 64
+#define ODP_PCI_LEN 32
+#define ODP_POOL_NAME_LEN 32
+
+/* The most classifier rules a single filter is turned into */
+#define ODP_MAX_CLS_RULES 4
+
+#define TV_TO_NS(tv) ((uint64_t) tv.tv_sec*1000000000ull + \
+			(uint64_t) tv.tv_usec*1000ull)
+#define TS_TO_NS(ts) ((uint64_t) ts.tv_sec*1000000000ull + \
+			(uint64_t) ts.tv_nsec)
+
+/* Use clock_gettime() for nanosecond resolution software timestamps
+ * rather than gettimeofday(), both are a vsyscall on recent kernels */
+#ifdef HAVE_CLOCK_GETTIME
+#define USE_CLOCK_GETTIME 1
+#else
+#define USE_CLOCK_GETTIME 0
+#endif
+
 #define FORMAT(x) ((struct odp_format_data_t *)x->format_data)
 #define DATAOUT(x) ((struct odp_format_data_out_t *)x->format_data)
 #define OUTPUT DATAOUT(libtrace)
 
+/* ODP may only be initialised once per process, every trace holds a
+ * reference and the last one out terminates ODP */
+static pthread_mutex_t odp_lock = PTHREAD_MUTEX_INITIALIZER;
+static int odp_global_refs = 0;
+/* Likewise each thread is only initialised once, however many traces
+ * it uses */
+static __thread int odp_local_refs = 0;
+/* Used to give every pool a unique name, protected by odp_lock */
+static int odp_pool_count = 0;
+
+static struct libtrace_format_t lodp;
+
 //----- OPTIONS -----
 //#define DEBUG
 //#define OPTION_PRINT_PACKETS
+/* Receive through the ODP scheduler rather than polling the pktin
+ * queues directly. Direct mode is faster, scheduled mode lets ODP
+ * balance the queues across the threads */
+//#define OPTION_SCHED_MODE
+/* Define if the ODP platform programs the NIC with a symmetric RSS key,
+ * for example odp-dpdk built with the repeating 0x6d5a key. ODP gives us
+ * no way to set the key ourselves so otherwise HASHER_BIDIRECTIONAL is
+ * left to the software hasher */
+//#define OPTION_SYMMETRIC_RSS
 
 #ifdef DEBUG
  #define debug(x...) printf(x)
@@ -39,31 +115,113 @@
 #endif
 
 
+enum odp_paused_state {
+	ODP_NEVER_STARTED,
+	ODP_RUNNING,
+	ODP_PAUSED,
+};
+
+/* Per RX queue state, one of these is attached to each perpkt thread */
+struct odp_per_stream_t
+{
+	int queue_id;		/* Index of the pktin queues we read from */
+	/* Direct handles to our pktin queue on every port */
+	odp_pktin_queue_t pktin[ODP_MAX_PORTS];
+	int nb_pktin;
+	int next_pktin;		/* The port to poll first next time */
+	uint64_t pkts_read;	/* Number of packets read from this queue */
+	uint64_t ts_last_sys;	/* Timestamp of our most recent packet in nanoseconds */
+} ALIGN_STRUCT(CACHE_LINE_SIZE);
+
+typedef struct odp_per_stream_t odp_per_stream_t;
+
+#define ODP_EMPTY_STREAM {-1, {{0}}, 0, 0, 0, 0}
+
+/* A single classifier rule, a packet matching any rule is accepted */
+struct odp_cls_rule_t {
+	odp_cls_pmr_term_t term;
+	uint32_t val_sz;
+	/* ODP matches these in host byte order */
+	union {
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+	} value, mask;
+};
+
+/* Port settings parsed from the URI, used by both input and output */
+struct odp_port_config_t {
+	/* The pktio names, with odp-dpdk the port numbers */
+	char devname[ODP_MAX_PORTS][ODP_DEVNAME_LEN];
+	int nb_ports;
+	char pci[ODP_MAX_PORTS][ODP_PCI_LEN];	/* PCI addresses to whitelist */
+	int nb_pci;
+	uint32_t pool_size;	/* Packets in the pool, 0 to size it automatically */
+	uint32_t buf_size;	/* The size of each packet buffer */
+	int socket;		/* NUMA socket to take memory from, -1 for any */
+	int queues;		/* Maximum number of RX queues, 0 for one per thread */
+	odp_pktin_mode_t pktin_mode;	/* Direct or scheduled receive */
+};
+
+#define FORMAT_DATA_HEAD(x) FORMAT(x)->per_stream->head
+#define FORMAT_DATA_FIRST(x) ((odp_per_stream_t *)FORMAT_DATA_HEAD(x)->data)
+
 struct odp_format_data_t {
 	int pvt;
 	unsigned int pkts_read;
-	odp_pktio_t pktio;
-	odp_packet_t pkt;	//ptr for current packet which we pass to prepare_packet()
-	int pkt_len;		//length of current packet
-	u_char *l2h;		//l2 header for current packet
+	struct odp_port_config_t config;
+	/* One pktio for each port in the URI, opened when first started */
+	odp_pktio_t pktio[ODP_MAX_PORTS];
+	int nb_pktio;
+	odp_pool_t pool;	/* The pool packets from every port are received into */
+	int promisc;		/* Promiscuous mode, -1 leaves the default */
+	/* The protocols the NIC hashes on to spread packets over queues */
+	odp_pktin_hash_proto_t hash_proto;
+	int flow_hasher;	/* True if the NIC keeps flows on one queue for us */
+	/* A filter done by the classifier rather than by libtrace */
+	struct odp_cls_rule_t cls_rules[ODP_MAX_CLS_RULES];
+	int nb_cls_rules;
+	odp_cos_t cos_default;	/* Drops everything not matching a rule */
+	odp_cos_t cos_match;
+	odp_queue_t cos_queue;
+	odp_pmr_t pmrs[ODP_MAX_CLS_RULES];
+	uint8_t paused;		/* See odp_paused_state */
+	int hw_timestamps;	/* True if the pktio timestamps packets for us */
+	uint64_t rx_wait;	/* RX_WAIT_NS converted for the receive mode */
+	int64_t ts_offset;	/* Converts ODP time into nanoseconds since the epoch */
+	/* To improve single-threaded performance we always batch reading
+	 * packets, in a burst, otherwise the parallel library does this for us */
+	odp_packet_t burst_pkts[BURST_SIZE];
+	int burst_size; /* The total number read in the burst */
+	int burst_offset; /* The offset we are into the burst */
 	/* Our parallel streams */
 	libtrace_list_t *per_stream;
 };
 
-//----- DPDK stream part. Maybe we don't need it -------------------------------
-#if 0
-struct dpdk_per_stream_t
-{
-	uint16_t queue_id;
-	uint64_t ts_last_sys; /* System timestamp of our most recent packet in nanoseconds */
-	struct rte_mempool *mempool;
-	int lcore;
-}
-
-#define DPDK_EMPTY_STREAM {-1, 0, NULL, -1}
+enum odp_addt_hdr_flags {
+	INCLUDES_HW_TIMESTAMP = 0x1,
+};
 
-typedef struct dpdk_per_stream_t dpdk_per_stream_t;
-#endif
+/**
+ * A structure placed in the headroom straight in front of the packet
+ * data where we can store additional information about the given packet.
+ * +--------------------------+
+ * |     odp headroom         | odp_packet_headroom()-sizeof(odp_addt_hdr)
+ * +--------------------------+
+ * |       odp_addt_hdr       | sizeof(odp_addt_hdr)
+ * +--------------------------+
+ * |       Packet data        | odp_packet_data()
+ * |                          |
+ */
+struct odp_addt_hdr {
+	uint64_t timestamp;	/* Nanoseconds since the epoch */
+	uint8_t flags;
+	uint8_t direction;
+	uint8_t reserved1;
+	uint8_t reserved2;
+	uint32_t cap_len;	/* The size to say the capture is */
+	uint32_t wire_len;	/* The length of the packet on the wire */
+};
 
 #if 0
 struct duck_format_data_t {
@@ -73,187 +231,295 @@ struct duck_format_data_t {
 #endif
 
 struct odp_format_data_out_t {
-	char *path;
-	int level;
-	int compress_type;
-	int fileflag;
-	iow_t *file;
-//	int dag_version;	
-};
-
-// A structure describing the location of a PCI device (from rte_pci.h)
-struct rte_pci_addr {
-        uint16_t domain;                /**< Device domain */
-        uint8_t bus;                    /**< Device bus */
-        uint8_t devid;                  /**< Device ID */
-        uint8_t function;               /**< Device function. */
+	struct odp_port_config_t config;
+	odp_pktio_t pktio;
+	odp_pool_t pool;	/* Packets we copy for sending come from here */
+	odp_pktout_queue_t pktout;
+	uint8_t paused;		/* See odp_paused_state */
+	/* Packets waiting to be sent, these are sent as a single burst
+	 * once full, by a write once the oldest has waited TX_FLUSH_NS, or
+	 * on close */
+	odp_packet_t tx_burst[BURST_SIZE];
+	int tx_size;
+	uint64_t tx_first_ns;	/* When the oldest waiting packet was queued */
+	uint64_t tx_dropped;	/* Packets the pktio refused to send */
 };
 
-
 /**
- * Parse the URI format as a pci address
- * Fills in addr, note core is optional and is unchanged if
- * a value for it is not provided.
+ * Parses the URI into the port configuration.
+ *
+ * The URI is either a list of key=value options separated by commas,
+ * i.e. odp:port=1,queues=8,pool=65536, or for compatibility a single PCI
+ * address which is whitelisted and opened as port 0, i.e. odp:0000:03:00.0
  *
- * i.e. ./libtrace dpdk:0:1:0.0 -> 0:1:0.0
- * or ./libtrace dpdk:0:1:0.1-2 -> 0:1:0.1 (Using CPU core #2)
+ * The port and pci options can be repeated to capture from several ports
+ * as a single trace, i.e. odp:port=0,port=1
+ *
+ * @return 0 if successful, otherwise -1 on error.
  */
-//example - odp:0000:03:00.0
-#if 0
-static int parse_pciaddr(char *str, struct rte_pci_addr *addr, long *core) 
-{
-	int matches;
-	assert(str);
-	//str used as input. looking for 0000:03:00.0-0 in it and set addr and core
-	matches = sscanf(str, "%4"SCNx16":%2"SCNx8":%2"SCNx8".%2"SCNx8"-%ld",
-	                 &addr->domain, &addr->bus, &addr->devid,
-	                 &addr->function, core);
-	if (matches >= 4) {
+static int lodp_parse_uri(const char *uridata, struct odp_port_config_t *config,
+                          char *err, int errlen)
+{
+	char *options, *tok, *value, *saveptr = NULL;
+	int ret = 0;
+
+	memset(config, 0, sizeof(struct odp_port_config_t));
+	config->buf_size = SHM_PKT_POOL_BUF_SIZE;
+	config->socket = -1;
+#ifdef OPTION_SCHED_MODE
+	config->pktin_mode = ODP_PKTIN_MODE_SCHED;
+#else
+	config->pktin_mode = ODP_PKTIN_MODE_DIRECT;
+#endif
+
+	if (strchr(uridata, '=') == NULL) {
+		/* The old style, either a PCI address or a pktio name */
+		config->nb_ports = 1;
+		strcpy(config->devname[0], "0");
+		if (strchr(uridata, ':') != NULL) {
+			snprintf(config->pci[0], ODP_PCI_LEN, "%s", uridata);
+			config->nb_pci = 1;
+		} else if (*uridata != '\0') {
+			snprintf(config->devname[0], ODP_DEVNAME_LEN,
+			         "%s", uridata);
+		}
 		return 0;
-	} else {
-		return -1;
 	}
+
+	options = strdup(uridata);
+	for (tok = strtok_r(options, ",", &saveptr); tok != NULL;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		/* Everything after the first '=' is the value, pktio names
+		 * such as pcap:in=file.pcap contain an '=' themselves */
+		value = strchr(tok, '=');
+		if (value == NULL) {
+			snprintf(err, errlen, "ODP - Option %s has no value", tok);
+			ret = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp(tok, "port") == 0 || strcmp(tok, "dev") == 0) {
+			if (config->nb_ports == ODP_MAX_PORTS) {
+				snprintf(err, errlen, "ODP - At most %d ports"
+				         " can be given", ODP_MAX_PORTS);
+				ret = -1;
+				break;
+			}
+			snprintf(config->devname[config->nb_ports++],
+			         ODP_DEVNAME_LEN, "%s", value);
+		} else if (strcmp(tok, "pci") == 0) {
+			if (config->nb_pci == ODP_MAX_PORTS) {
+				snprintf(err, errlen, "ODP - At most %d PCI"
+				         " devices can be given", ODP_MAX_PORTS);
+				ret = -1;
+				break;
+			}
+			snprintf(config->pci[config->nb_pci++], ODP_PCI_LEN,
+			         "%s", value);
+		} else if (strcmp(tok, "queues") == 0) {
+			config->queues = atoi(value);
+		} else if (strcmp(tok, "pool") == 0) {
+			config->pool_size = strtoul(value, NULL, 10);
+		} else if (strcmp(tok, "bufsize") == 0) {
+			config->buf_size = strtoul(value, NULL, 10);
+		} else if (strcmp(tok, "socket") == 0) {
+			config->socket = atoi(value);
+		} else if (strcmp(tok, "mode") == 0) {
+			if (strcmp(value, "sched") == 0)
+				config->pktin_mode = ODP_PKTIN_MODE_SCHED;
+			else if (strcmp(value, "direct") == 0)
+				config->pktin_mode = ODP_PKTIN_MODE_DIRECT;
+			else {
+				snprintf(err, errlen, "ODP - Unknown mode %s"
+				         ", expected sched or direct", value);
+				ret = -1;
+				break;
+			}
+		} else {
+			snprintf(err, errlen, "ODP - Unknown option %s", tok);
+			ret = -1;
+			break;
+		}
+	}
+	free(options);
+
+	if (config->nb_ports == 0) {
+		config->nb_ports = 1;
+		strcpy(config->devname[0], "0");
+	}
+	if (ret == 0 && (config->queues < 0 || config->buf_size == 0)) {
+		snprintf(err, errlen, "ODP - Invalid queues or bufsize");
+		ret = -1;
+	}
+	return ret;
 }
-#endif
 
+/* Initialises ODP for the calling thread unless it already has been */
+static int lodp_init_local(odp_thread_type_t type)
+{
+	if (odp_local_refs == 0 && odp_init_local(type) != 0)
+		return -1;
+	odp_local_refs++;
+	return 0;
+}
 
-static int lodp_init_environment(char *uridata, struct odp_format_data_t *format_data, char *err, int errlen)
+/* Drops a reference to ODP for the calling thread */
+static void lodp_term_local(void)
 {
-	//int ret; //returned error codes
-	//struct rte_pci_addr use_addr; /* The only address that we don't blacklist - needed for DPDK */
-	//char cpu_number[10] = {0}; /* The CPU mask we want to bind to */
-	int num_cpu; /* The number of CPUs in the system */
-	//int my_cpu; /* The CPU number we want to bind to */
-	//odp vars
-	odp_pool_t pool;
-	//odp_pktio_t pktio;
-        odp_pool_param_t params;
-        odp_pktio_param_t pktio_param;
-        odp_pktin_queue_param_t pktin_param;
-	char devname[] = "0";		// - IMPORTANT - this is dpdk port number, should be 0! Only digits accepted!
-	char dpdk_params[256] = {0};
-	char *odp_error = "No error";
+	/* The thread closing a trace is not always the one that opened it */
+	if (odp_local_refs > 0 && --odp_local_refs == 0)
+		odp_term_local();
+}
 
-	if (strlen(odp_error) < (size_t)errlen) 
-		strcpy(err, odp_error);
+/**
+ * Drops a trace's reference to ODP, terminating ODP once the last trace
+ * using it has been destroyed.
+ *
+ * @param local True if the calling thread's local reference should be
+ * dropped as well
+ */
+static void lodp_release_environment(int local)
+{
+	if (local)
+		lodp_term_local();
+
+	/* Note odp-dpdk cannot initialise the DPDK EAL a second time, so
+	 * with it a process cannot open another odp trace once all of its
+	 * odp traces have been destroyed */
+	pthread_mutex_lock(&odp_lock);
+	if (--odp_global_refs == 0) {
+		/* Every thread has to be terminated before ODP is */
+		if (odp_local_refs > 0) {
+			odp_term_local();
+			odp_local_refs = 0;
+		}
+		if (odp_term_global() != 0)
+			fprintf(stderr, "ODP - Global terminate failed\n");
+	}
+	pthread_mutex_unlock(&odp_lock);
+}
+
+static int lodp_init_environment(struct odp_port_config_t *config,
+                                 char *err, int errlen)
+{
+	char dpdk_params[256] = {0};
+	int len, i;
 
 	//DPDK setup -----------------------------------------------------------
 	//we need to set command line for DPDK which we will pass through ODP
-
-
-#if 0
-	char* argv[] = {"libtrace",
-	                "-c", cpu_number,
-	                "-n", "1",
-	                "--proc-type", "auto",
-	                "--file-prefix",
-	                "-m", "512", NULL};
-
-	int argc = sizeof(argv) / sizeof(argv[0]) - 1;
-#endif
-
-	/* Get the number of cpu cores in the system and use the last core
-	 * on the correct numa node */
-	num_cpu = sysconf(_SC_NPROCESSORS_ONLN);
-	if (num_cpu <= 0) 
-	{
-		perror("sysconf(_SC_NPROCESSORS_ONLN) failed."
-		       " Falling back to the first core.");
-		num_cpu = 1; /* fallback to the first core */
+	len = snprintf(dpdk_params, sizeof(dpdk_params), "-n 4");
+	for (i = 0; i < config->nb_pci && (size_t) len < sizeof(dpdk_params); i++)
+		len += snprintf(dpdk_params + len, sizeof(dpdk_params) - len,
+		                " -w %s", config->pci[i]);
+	if (config->socket >= 0 && (size_t) len < sizeof(dpdk_params)) {
+		/* ODP pools have no NUMA placement, instead have DPDK take
+		 * its hugepage memory from the requested socket only */
+		len += snprintf(dpdk_params + len, sizeof(dpdk_params) - len,
+		                " --socket-mem ");
+		for (i = 0; i < config->socket &&
+		     (size_t) len < sizeof(dpdk_params); i++)
+			len += snprintf(dpdk_params + len,
+			                sizeof(dpdk_params) - len, "0,");
+		if ((size_t) len < sizeof(dpdk_params))
+			len += snprintf(dpdk_params + len,
+			                sizeof(dpdk_params) - len,
+			                "%d", SOCKET_MEM_MB);
 	}
-
-	//have 0 core selected by default
-	//my_cpu = 0;
-
-	//forming params -------------------------------------------------------
-	printf("uridata: %s \n", uridata);
-	strcpy(dpdk_params, "-n 4 -w ");
-	strcat(dpdk_params, uridata);
-	printf("dpdk params passed: %s \n", dpdk_params);
-
-
-	/* This allows the user to specify the core - we would try to do this
-	 * automatically but it's hard to tell that this is secondary
-	 * before running rte_eal_init(...). Currently we are limited to 1
-	 * instance per core due to the way memory is allocated. */
-
-//don't need it now - we don't call dpdk white/black list functions, just pass param
-#if 0
-	if (parse_pciaddr(uridata, &use_addr, &my_cpu) != 0) {
-		fprintf(stderr, "Failed to parse URI\n");
+	if ((size_t) len >= sizeof(dpdk_params)) {
+		snprintf(err, errlen, "ODP - Too many DPDK parameters");
 		return -1;
 	}
-#endif
+	debug("dpdk params passed: %s \n", dpdk_params);
 
 	//ODP setup ------------------------------------------------------------
-	/* Init ODP before calling anything else */
-	//@first param - odp params, @second param - dpdk params (passed through)
-	//const odp_platform_init_t *platform_params
-        if (odp_init_global(NULL, (odp_platform_init_t*)dpdk_params))
-	{
-                fprintf(stderr, "Error: ODP global init failed.\n");
-                exit(EXIT_FAILURE);
-        }
+	/* ODP can only be initialised once per process, an input and an
+	 * output trace will both get here. The DPDK parameters of the first
+	 * trace are the ones used */
+	pthread_mutex_lock(&odp_lock);
+	if (odp_global_refs == 0) {
+		/* Init ODP before calling anything else */
+		//@first param - odp params, @second param - dpdk params (passed through)
+		//const odp_platform_init_t *platform_params
+	        if (odp_init_global(NULL, (odp_platform_init_t*)dpdk_params))
+		{
+			pthread_mutex_unlock(&odp_lock);
+			snprintf(err, errlen, "ODP - Global init failed");
+			return -1;
+	        }
+	}
+	odp_global_refs++;
+	pthread_mutex_unlock(&odp_lock);
+
+	/* Create thread structure for ODP, this thread reads packets
+	 * itself if the trace is not parallel */
+	if (lodp_init_local(ODP_THREAD_WORKER) != 0) {
+		lodp_release_environment(0);
+		snprintf(err, errlen, "ODP - Local init failed");
+		return -1;
+	}
 
-        /* Create thread structure for ODP */		//XXX - maybe ODP_THREAD_CONTROL ?
-        if (odp_init_local(ODP_THREAD_WORKER)) 
-	{
-                fprintf(stderr, "Error: ODP local init failed.\n");
-                exit(EXIT_FAILURE);
-        }
+	return 0;
+}
 
-        /* Creating pool */
-        pool = odp_pool_lookup("packet_pool");
-        if (pool == ODP_POOL_INVALID) 
-	{
-                /* Create packet pool */
-                odp_pool_param_init(&params);                   //init pool with default values
-                params.pkt.seg_len = SHM_PKT_POOL_BUF_SIZE;
-                params.pkt.len     = SHM_PKT_POOL_BUF_SIZE;
-                params.pkt.num     = SHM_PKT_POOL_SIZE/SHM_PKT_POOL_BUF_SIZE;
-                params.type        = ODP_POOL_PACKET;
-
-                pool = odp_pool_create("packet_pool", &params);
-
-                if (pool == ODP_POOL_INVALID) {
-                        fprintf(stderr, "Error: packet pool create failed.\n");
-                        exit(EXIT_FAILURE);
-                }
-                odp_pool_print(pool);
-        } 
-	else 
-                fprintf(stdout, "packet pool have been created.\n");
-
-        //----- setting up pktio ------------------------------------------------------
-
-        //setting pktio_param
-        odp_pktio_param_init(&pktio_param);
-        pktio_param.in_mode = ODP_PKTIN_MODE_SCHED;     //XXX - if wont work try MODE_QUEUE
-
-        /* Open a packet IO instance */
-	fprintf(stdout, "calling odp_pktio_open()\n");
-        format_data->pktio = odp_pktio_open(devname, pool, &pktio_param);
-        if (format_data->pktio == ODP_PKTIO_INVALID) {
-                fprintf(stderr, "  Error: pktio create failed %s\n", devname);
-                return 1;
+/**
+ * Creates a packet pool for our pktios.
+ *
+ * The pool is sized by the caller to hold every packet that can be
+ * outstanding at once, this stops the pool from running dry (and the
+ * NIC dropping) while libtrace holds packets and stops us reserving
+ * memory that can never be used. A size given in the URI overrides this.
+ *
+ * Every trace gets its own pool, so several traces can be opened in the
+ * same process without sharing one. All the ports of a trace share it.
+ *
+ * @param config The port configuration from the URI
+ * @param nb_pkts The number of packets in the pool
+ * @param pool Set to the new pool
+ * @return 0 if successful, otherwise -1 on error.
+ */
+static int lodp_create_pool(struct odp_port_config_t *config, uint32_t nb_pkts,
+                            odp_pool_t *pool, char *err, int errlen)
+{
+        odp_pool_param_t params;
+	char pool_name[ODP_POOL_NAME_LEN];
+
+	if (config->pool_size > 0)
+		nb_pkts = config->pool_size;
+
+	pthread_mutex_lock(&odp_lock);
+	snprintf(pool_name, sizeof(pool_name), "libtrace_pool_%d",
+	         odp_pool_count++);
+	pthread_mutex_unlock(&odp_lock);
+
+        /* Create packet pool */
+        odp_pool_param_init(&params);                   //init pool with default values
+        params.pkt.seg_len = config->buf_size;
+        params.pkt.len     = config->buf_size;
+        params.pkt.num     = nb_pkts;
+        params.type        = ODP_POOL_PACKET;
+
+        *pool = odp_pool_create(pool_name, &params);
+        if (*pool == ODP_POOL_INVALID) {
+                snprintf(err, errlen, "ODP - Packet pool of %"PRIu32
+                         " packets create failed", nb_pkts);
+                return -1;
         }
+        debug("created packet pool %s of %"PRIu32" packets\n",
+              pool_name, nb_pkts);
+	return 0;
+}
 
-        //setting queue param
-        odp_pktin_queue_param_init(&pktin_param);
-        pktin_param.queue_param.sched.sync = ODP_SCHED_SYNC_ATOMIC;
-        pktin_param.queue_param.sched.prio = ODP_SCHED_PRIO_DEFAULT;
-
-	//configure in queue
-        if (odp_pktin_queue_config(format_data->pktio, &pktin_param))
-        {
-                fprintf(stderr, "  Error: queue config failed %s\n", devname);
-                return 1;
+/* Opens a packet IO instance receiving into or sending from pool */
+static int lodp_open_pktio(const char *devname, odp_pool_t pool,
+                           odp_pktio_param_t *pktio_param,
+                           odp_pktio_t *pktio, char *err, int errlen)
+{
+        *pktio = odp_pktio_open(devname, pool, pktio_param);
+        if (*pktio == ODP_PKTIO_INVALID) {
+                snprintf(err, errlen, "ODP - pktio create failed %s", devname);
+                return -1;
         }
-
-        //set OUT queue. NULL as param means default values will be used
-        if (odp_pktout_queue_config(format_data->pktio, NULL))
-                fprintf(stderr, "Error: pktout config failed\n");
-
 	return 0;
 }
 
@@ -263,22 +529,46 @@ static int lodp_init_input(libtrace_t *libtrace)
 {
 	char err[500] = {0};
 
+	odp_per_stream_t stream = ODP_EMPTY_STREAM;
+
 	printf("%s() \n", __func__);
-#if 0
-	dpdk_per_stream_t stream = DPDK_EMPTY_STREAM;
-#endif
 	//init all the data in odp_format_data_t
 	libtrace->format_data = malloc(sizeof(struct odp_format_data_t));
 	FORMAT(libtrace)->pvt = 0xFAFAFAFA;
 	FORMAT(libtrace)->pkts_read = 0;
-#if 0
-	/* Make our first stream XXX - add our struct per stream */
-	FORMAT(libtrace)->per_stream = libtrace_list_init(sizeof(struct dpdk_per_stream_t));
+	FORMAT(libtrace)->paused = ODP_NEVER_STARTED;
+	FORMAT(libtrace)->nb_pktio = 0;
+	FORMAT(libtrace)->pool = ODP_POOL_INVALID;
+	FORMAT(libtrace)->promisc = -1;
+	FORMAT(libtrace)->hash_proto.all_bits = 0;
+	FORMAT(libtrace)->hash_proto.proto.ipv4 = 1;
+	FORMAT(libtrace)->hash_proto.proto.ipv4_tcp = 1;
+	FORMAT(libtrace)->hash_proto.proto.ipv4_udp = 1;
+	FORMAT(libtrace)->hash_proto.proto.ipv6 = 1;
+	FORMAT(libtrace)->hash_proto.proto.ipv6_tcp = 1;
+	FORMAT(libtrace)->hash_proto.proto.ipv6_udp = 1;
+	FORMAT(libtrace)->flow_hasher = 0;
+	FORMAT(libtrace)->nb_cls_rules = 0;
+	FORMAT(libtrace)->cos_default = ODP_COS_INVALID;
+	FORMAT(libtrace)->cos_match = ODP_COS_INVALID;
+	FORMAT(libtrace)->cos_queue = ODP_QUEUE_INVALID;
+	FORMAT(libtrace)->burst_size = 0;
+	FORMAT(libtrace)->burst_offset = 0;
+	FORMAT(libtrace)->hw_timestamps = 0;
+	FORMAT(libtrace)->rx_wait = 0;
+	FORMAT(libtrace)->ts_offset = 0;
+	/* Make our first stream, more are added by pstart_input */
+	FORMAT(libtrace)->per_stream = libtrace_list_init(sizeof(odp_per_stream_t));
 	libtrace_list_push_back(FORMAT(libtrace)->per_stream, &stream);
-#endif
-	if (lodp_init_environment(libtrace->uridata, FORMAT(libtrace), err, sizeof(err))) 
+
+	/* The pool and pktio are not created until we are started and
+	 * know how many packets libtrace can hold on to */
+	if (lodp_parse_uri(libtrace->uridata, &FORMAT(libtrace)->config,
+	                   err, sizeof(err)) != 0 ||
+	    lodp_init_environment(&FORMAT(libtrace)->config, err, sizeof(err)))
 	{
 		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "%s", err);
+		libtrace_list_deinit(FORMAT(libtrace)->per_stream);
 		free(libtrace->format_data);
 		libtrace->format_data = NULL;
 		return -1;
@@ -290,108 +580,764 @@ static int lodp_init_input(libtrace_t *libtrace)
 static int lodp_init_output(libtrace_out_t *libtrace) 
 {
 	char err[500] = {0};
+	odp_pktio_param_t pktio_param;
 
 	printf("%s() \n", __func__);
 
-        fprintf(stderr, "Init output!()\n");
-	
-
 	libtrace->format_data = malloc(sizeof(struct odp_format_data_out_t));
-#if 1
-	OUTPUT->file = 0;
-	OUTPUT->level = 0;
-	OUTPUT->compress_type = TRACE_OPTION_COMPRESSTYPE_NONE;
-	OUTPUT->fileflag = O_CREAT | O_WRONLY;
-#endif
-
-	//this is same we do in odp_init_input(), but with odp_format_data_out_t struct
-	if (lodp_init_environment(libtrace->uridata, FORMAT(libtrace), err, sizeof(err)) != 0) {
+	OUTPUT->pktio = ODP_PKTIO_INVALID;
+	OUTPUT->pool = ODP_POOL_INVALID;
+	OUTPUT->paused = ODP_NEVER_STARTED;
+	OUTPUT->tx_size = 0;
+	OUTPUT->tx_first_ns = 0;
+	OUTPUT->tx_dropped = 0;
+
+	odp_pktio_param_init(&pktio_param);
+	pktio_param.in_mode = ODP_PKTIN_MODE_DISABLED;
+	pktio_param.out_mode = ODP_PKTOUT_MODE_DIRECT;
+
+	if (lodp_parse_uri(libtrace->uridata, &OUTPUT->config,
+	                   err, sizeof(err)) != 0 ||
+	    lodp_init_environment(&OUTPUT->config, err, sizeof(err)) != 0) {
 		trace_set_err_out(libtrace, TRACE_ERR_INIT_FAILED, "%s", err);
 		free(libtrace->format_data);
 		libtrace->format_data = NULL;
 		return -1;
 	}
 
+	/* Only packets we copy come from our pool, these are either waiting
+	 * in the tx burst or in the NIC's TX ring */
+	if (OUTPUT->config.nb_ports != 1) {
+		snprintf(err, sizeof(err), "ODP - An output trace can only"
+		         " send on a single port");
+	} else if (lodp_create_pool(&OUTPUT->config, BURST_SIZE + NB_TX_DESC,
+	                            &OUTPUT->pool, err, sizeof(err)) == 0) {
+		if (lodp_open_pktio(OUTPUT->config.devname[0], OUTPUT->pool,
+		                    &pktio_param, &OUTPUT->pktio,
+		                    err, sizeof(err)) == 0)
+			return 0;
+		odp_pool_destroy(OUTPUT->pool);
+	}
+
+	trace_set_err_out(libtrace, TRACE_ERR_INIT_FAILED, "%s", err);
+	lodp_release_environment(1);
+	free(libtrace->format_data);
+	libtrace->format_data = NULL;
+	return -1;
+}
+
+/* Returns the current system time in nanoseconds since the epoch */
+static inline uint64_t lodp_get_sys_time_ns(void)
+{
+#if USE_CLOCK_GETTIME
+	struct timespec cur_sys_time = {0};
+	clock_gettime(CLOCK_REALTIME, &cur_sys_time);
+	return TS_TO_NS(cur_sys_time);
+#else
+	struct timeval cur_sys_time = {0};
+	gettimeofday(&cur_sys_time, NULL);
+	return TV_TO_NS(cur_sys_time);
+#endif
+}
+
+/**
+ * Turns on input timestamping if the pktio supports it. ODP time has
+ * no defined epoch so we also record the offset needed to turn it into
+ * system time.
+ */
+static void lodp_setup_timestamps(struct odp_format_data_t *format_data)
+{
+	odp_pktio_capability_t capa;
+	odp_pktio_config_t config;
+
+	int i;
+
+	/* A port that cannot timestamp is caught by odp_packet_has_ts() */
+	format_data->hw_timestamps = 0;
+	for (i = 0; i < format_data->nb_pktio; i++) {
+		if (odp_pktio_capability(format_data->pktio[i], &capa) == 0 &&
+		    capa.config.pktin.bit.ts_all) {
+			odp_pktio_config_init(&config);
+			config.pktin.bit.ts_all = 1;
+			if (odp_pktio_config(format_data->pktio[i], &config) == 0)
+				format_data->hw_timestamps = 1;
+		}
+	}
+	format_data->ts_offset = (int64_t) lodp_get_sys_time_ns() -
+	        (int64_t) odp_time_to_ns(odp_time_global());
+	debug("pktio timestamping is %s\n",
+	      format_data->hw_timestamps ? "on" : "off");
+}
+
+/**
+ * Configures the pktin queues of our pktios and starts them.
+ *
+ * Each port is given rx_queues queues and stream i reads queue i of every
+ * port. When more than one queue is requested the NIC hashes packets
+ * across the queues so that each perpkt thread can read from its own
+ * queues without locking, with the same hash on every port the two
+ * directions of a tapped link also meet on the same stream.
+ *
+ * @param format_data The format data of the trace
+ * @param err An error buffer filled in on failure
+ * @param errlen The length of err
+ * @param rx_queues The number of pktin queues to configure on each port
+ * @return 0 if successful, otherwise -1 on error.
+ */
+static int lodp_start_streams(struct odp_format_data_t *format_data,
+                              char *err, int errlen, int rx_queues)
+{
+	odp_pktin_queue_param_t pktin_param;
+	odp_pktin_queue_t pktin[rx_queues];
+	odp_per_stream_t empty_stream = ODP_EMPTY_STREAM;
+	odp_per_stream_t *stream;
+	int i, p;
+
+	/* Already started */
+	if (format_data->paused == ODP_RUNNING)
+		return 0;
+
+	/* The pktio can only be configured before it is first started */
+	if (format_data->paused == ODP_NEVER_STARTED)
+		lodp_setup_timestamps(format_data);
+
+	odp_pktin_queue_param_init(&pktin_param);
+	pktin_param.num_queues = rx_queues;
+	/* Every queue is owned by exactly one thread */
+	pktin_param.op_mode = ODP_PKTIO_OP_MT_UNSAFE;
+	/* In scheduled mode an atomic queue is only ever handed to a
+	 * single thread at a time, keeping packets of a flow in order */
+	pktin_param.queue_param.sched.sync = ODP_SCHED_SYNC_ATOMIC;
+	pktin_param.queue_param.sched.prio = ODP_SCHED_PRIO_DEFAULT;
+	if (format_data->nb_cls_rules > 0) {
+		/* Packets are delivered to the queue of their CoS */
+		pktin_param.classifier_enable = 1;
+	} else if (rx_queues > 1) {
+		pktin_param.hash_enable = 1;
+		pktin_param.hash_proto = format_data->hash_proto;
+	}
+
+	/* Add storage for the streams */
+	for (i = 0; i < rx_queues; i++) {
+		if (libtrace_list_get_size(format_data->per_stream) <= (size_t) i)
+			libtrace_list_push_back(format_data->per_stream, &empty_stream);
+		stream = libtrace_list_get_index(format_data->per_stream, i)->data;
+		stream->queue_id = i;
+		stream->nb_pktin = 0;
+		stream->next_pktin = 0;
+		/* Statistics are counted from when we are started */
+		stream->pkts_read = 0;
+	}
+
+	for (p = 0; p < format_data->nb_pktio; p++) {
+		if (odp_pktin_queue_config(format_data->pktio[p], &pktin_param)) {
+			snprintf(err, errlen, "ODP - Cannot configure %d pktin"
+			         " queues on %s", rx_queues,
+			         format_data->config.devname[p]);
+			return -1;
+		}
+
+		/* Scheduled queues are not polled directly */
+		if (format_data->config.pktin_mode == ODP_PKTIN_MODE_DIRECT) {
+			if (odp_pktin_queue(format_data->pktio[p], pktin,
+			                    rx_queues) != rx_queues) {
+				snprintf(err, errlen, "ODP - Cannot get the"
+				         " pktin queues of %s",
+				         format_data->config.devname[p]);
+				return -1;
+			}
+			for (i = 0; i < rx_queues; i++) {
+				stream = libtrace_list_get_index(
+				        format_data->per_stream, i)->data;
+				stream->pktin[stream->nb_pktin++] = pktin[i];
+			}
+		}
+
+		if (format_data->promisc != -1 &&
+		    odp_pktio_promisc_mode_set(format_data->pktio[p],
+		                               format_data->promisc) != 0) {
+			snprintf(err, errlen, "ODP - Cannot set promiscuous"
+			         " mode on %s", format_data->config.devname[p]);
+			return -1;
+		}
+
+		/* Not every pktio supports statistics so a failure here is
+		 * ignored */
+		odp_pktio_stats_reset(format_data->pktio[p]);
+	}
+
+	/* Start every port only once they are all configured, a port we
+	 * started is stopped again if a later one fails */
+	for (p = 0; p < format_data->nb_pktio; p++) {
+		if (odp_pktio_start(format_data->pktio[p])) {
+			snprintf(err, errlen, "ODP - Unable to start pktio %s",
+			         format_data->config.devname[p]);
+			while (--p >= 0)
+				odp_pktio_stop(format_data->pktio[p]);
+			return -1;
+		}
+	}
+
+	/* The wait is converted to ODP's units once rather than per read */
+	if (format_data->config.pktin_mode == ODP_PKTIN_MODE_DIRECT)
+		format_data->rx_wait = odp_pktin_wait_time(RX_WAIT_NS);
+	else
+		format_data->rx_wait = odp_schedule_wait_time(RX_WAIT_NS);
+
+	/* We have now successfully started/unpaused */
+	format_data->paused = ODP_RUNNING;
+	debug("started %d pktio(s) with %d pktin queue(s) each\n",
+	      format_data->nb_pktio, rx_queues);
+
 	return 0;
 }
 
-//not used
-static int lodp_config_output(libtrace_out_t *libtrace, trace_option_output_t option, void *data)
+/**
+ * Returns the number of packets the pool of an input trace needs.
+ *
+ * Every odp packet is attached to a libtrace packet until fin_packet
+ * returns it to the pool, which happens as the libtrace packet goes back
+ * to the packet_freelist. So the most we can have outstanding is bounded
+ * by the ocache: the packets the freelist can hold plus a burst and a
+ * thread cache for each perpkt thread. On top of this each RX queue of
+ * every port keeps its ring filled.
+ *
+ * The freelist is only created by trace_pstart() after the format has
+ * started, with room for cache_size * 4 packets, so that is mirrored here.
+ */
+static uint32_t lodp_input_pool_size(libtrace_t *libtrace, int rx_queues)
 {
-	printf("%s() \n", __func__);
+	uint32_t held = BURST_SIZE;
+
+	/* The configuration is only filled in for a parallel trace */
+	if (libtrace->config.cache_size > 0) {
+		/* The size trace_pstart() gives the packet_freelist */
+		held += libtrace->config.cache_size * 4;
+		held += libtrace->perpkt_thread_count *
+		        (libtrace->config.burst_size +
+		         libtrace->config.thread_cache_size);
+	}
+	held += rx_queues * NB_RX_DESC * FORMAT(libtrace)->config.nb_ports;
 
-	if (!data)
+	if (held < SHM_PKT_POOL_SIZE/SHM_PKT_POOL_BUF_SIZE)
+		held = SHM_PKT_POOL_SIZE/SHM_PKT_POOL_BUF_SIZE;
+	return held;
+}
+
+#ifdef HAVE_BPF
+/**
+ * Turns a simple filter into classifier rules.
+ *
+ * The rules are only a pre-filter, libtrace still applies the filter with
+ * BPF to every packet the classifier lets through, so a rule may match more
+ * than the filter does but never less. Only a single primitive is
+ * understood: tcp, udp or icmp, or tcp or udp followed by [src|dst] port
+ * and a port number. "icmp" also matches ICMP carried directly in IPv6,
+ * which BPF then drops. "host" is not offloaded as BPF also matches it
+ * against ARP, nor is a bare "port" as BPF also matches it against SCTP.
+ *
+ * @return The number of rules, or -1 if the filter cannot be offloaded
+ */
+static int lodp_parse_filter(const char *filterstring,
+                             struct odp_cls_rule_t *rules)
+{
+	char *str, *tok[5], *saveptr = NULL;
+	int ntok = 0, idx = 0, nrules = 0;
+	int proto = 0, src = 1, dst = 1;
+	int ret = -1;
+	long port;
+	char *end;
+
+	str = strdup(filterstring);
+	for (tok[0] = strtok_r(str, " \t", &saveptr); tok[ntok] != NULL;
+	     tok[ntok] = strtok_r(NULL, " \t", &saveptr)) {
+		if (++ntok == 5)
+			goto done;
+	}
+	if (ntok == 0)
+		goto done;
+
+	if (strcmp(tok[idx], "tcp") == 0)
+		proto = TRACE_IPPROTO_TCP;
+	else if (strcmp(tok[idx], "udp") == 0)
+		proto = TRACE_IPPROTO_UDP;
+	else if (strcmp(tok[idx], "icmp") == 0)
+		proto = TRACE_IPPROTO_ICMP;
+	if (proto != 0)
+		idx++;
+
+	if (idx == ntok) {
+		/* Just the protocol */
+		rules[0].term = ODP_PMR_IPPROTO;
+		rules[0].val_sz = 1;
+		rules[0].value.u8 = proto;
+		rules[0].mask.u8 = 0xff;
+		ret = 1;
+		goto done;
+	}
+
+	if (strcmp(tok[idx], "src") == 0) {
+		dst = 0;
+		idx++;
+	} else if (strcmp(tok[idx], "dst") == 0) {
+		src = 0;
+		idx++;
+	}
+	if (idx + 2 != ntok)
+		goto done;
+
+	if (strcmp(tok[idx], "port") == 0 &&
+	    (proto == TRACE_IPPROTO_TCP || proto == TRACE_IPPROTO_UDP)) {
+		port = strtol(tok[idx + 1], &end, 10);
+		if (*end != '\0' || port <= 0 || port > 65535)
+			goto done;
+		if (proto != TRACE_IPPROTO_UDP) {
+			if (src)
+				rules[nrules++].term = ODP_PMR_TCP_SPORT;
+			if (dst)
+				rules[nrules++].term = ODP_PMR_TCP_DPORT;
+		}
+		if (proto != TRACE_IPPROTO_TCP) {
+			if (src)
+				rules[nrules++].term = ODP_PMR_UDP_SPORT;
+			if (dst)
+				rules[nrules++].term = ODP_PMR_UDP_DPORT;
+		}
+		for (idx = 0; idx < nrules; idx++) {
+			rules[idx].val_sz = 2;
+			rules[idx].value.u16 = port;
+			rules[idx].mask.u16 = 0xffff;
+		}
+		ret = nrules;
+	}
+
+done:
+	free(str);
+	return ret;
+}
+#endif
+
+/* Removes the classifier rules, the pktio must already be closed */
+static void lodp_destroy_classifier(struct odp_format_data_t *format_data)
+{
+	int i;
+
+	for (i = 0; i < format_data->nb_cls_rules; i++) {
+		if (format_data->pmrs[i] != ODP_PMR_INVAL)
+			odp_cls_pmr_destroy(format_data->pmrs[i]);
+	}
+	if (format_data->cos_match != ODP_COS_INVALID)
+		odp_cos_destroy(format_data->cos_match);
+	if (format_data->cos_default != ODP_COS_INVALID)
+		odp_cos_destroy(format_data->cos_default);
+	if (format_data->cos_queue != ODP_QUEUE_INVALID)
+		odp_queue_destroy(format_data->cos_queue);
+}
+
+/**
+ * Programs the classifier with the rules of our filter.
+ *
+ * Everything not matching a rule falls to the default CoS, which has no
+ * queue so its packets are dropped by the NIC driver rather than by
+ * libtrace. Every rule leads to the same CoS, which gives us the OR of
+ * the rules.
+ *
+ * Not every ODP implementation accepts a CoS without a queue. If it is
+ * refused the classifier is not used at all, libtrace filters every
+ * packet itself as it would without the classifier.
+ */
+static int lodp_setup_classifier(struct odp_format_data_t *format_data,
+                                 char *err, int errlen)
+{
+	odp_cls_cos_param_t cos_param;
+	odp_queue_param_t queue_param;
+	odp_pmr_param_t pmr_param;
+	char name[ODP_POOL_NAME_LEN];
+	int i;
+
+	snprintf(name, sizeof(name), "libtrace_cls_%p",
+	         (void *) format_data->pool);
+
+	odp_cls_cos_param_init(&cos_param);
+	cos_param.queue = ODP_QUEUE_INVALID;
+	cos_param.pool = format_data->pool;
+	cos_param.drop_policy = ODP_COS_DROP_POOL;
+	format_data->cos_default = odp_cls_cos_create(name, &cos_param);
+
+	odp_queue_param_init(&queue_param);
+	queue_param.type = ODP_QUEUE_TYPE_SCHED;
+	queue_param.sched.sync = ODP_SCHED_SYNC_ATOMIC;
+	queue_param.sched.prio = ODP_SCHED_PRIO_DEFAULT;
+	queue_param.sched.group = ODP_SCHED_GROUP_ALL;
+	format_data->cos_queue = odp_queue_create(name, &queue_param);
+
+	odp_cls_cos_param_init(&cos_param);
+	cos_param.queue = format_data->cos_queue;
+	cos_param.pool = format_data->pool;
+	cos_param.drop_policy = ODP_COS_DROP_NEVER;
+	name[0] = 'L';
+	format_data->cos_match = odp_cls_cos_create(name, &cos_param);
+
+	if (format_data->cos_default == ODP_COS_INVALID ||
+	    format_data->cos_queue == ODP_QUEUE_INVALID ||
+	    format_data->cos_match == ODP_COS_INVALID) {
+		fprintf(stderr, "ODP - Cannot create the filter CoS, the"
+		        " filter is applied by libtrace only\n");
+		format_data->nb_cls_rules = 0;
+		lodp_destroy_classifier(format_data);
+		format_data->cos_default = ODP_COS_INVALID;
+		format_data->cos_match = ODP_COS_INVALID;
+		format_data->cos_queue = ODP_QUEUE_INVALID;
+		return 0;
+	}
+
+	/* The rules hang off the default CoS, so one set serves every port */
+	for (i = 0; i < format_data->nb_pktio; i++) {
+		if (odp_pktio_default_cos_set(format_data->pktio[i],
+		                              format_data->cos_default) != 0) {
+			snprintf(err, errlen, "ODP - Cannot set the filter CoS"
+			         " of %s", format_data->config.devname[i]);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < format_data->nb_cls_rules; i++)
+		format_data->pmrs[i] = ODP_PMR_INVAL;
+	for (i = 0; i < format_data->nb_cls_rules; i++) {
+		struct odp_cls_rule_t *rule = &format_data->cls_rules[i];
+
+		odp_cls_pmr_param_init(&pmr_param);
+		pmr_param.term = rule->term;
+		pmr_param.match.value = &rule->value;
+		pmr_param.match.mask = &rule->mask;
+		pmr_param.val_sz = rule->val_sz;
+		format_data->pmrs[i] = odp_cls_pmr_create(&pmr_param, 1,
+		                                          format_data->cos_default,
+		                                          format_data->cos_match);
+		if (format_data->pmrs[i] == ODP_PMR_INVAL) {
+			snprintf(err, errlen, "ODP - Cannot create filter rule"
+			         " %d", i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Creates the pool and opens the pktios of an input trace the first time
+ * it is started */
+static int lodp_open_input(libtrace_t *libtrace, int rx_queues,
+                           char *err, int errlen)
+{
+	odp_pktio_param_t pktio_param;
+	int p;
+
+	if (FORMAT(libtrace)->nb_pktio > 0)
+		return 0;
+
+	odp_pktio_param_init(&pktio_param);
+	/* Direct mode gives every perpkt thread its own pktin queue,
+	 * the queues themselves are configured once we know how many
+	 * threads we have in lodp_start_streams() */
+	pktio_param.in_mode = FORMAT(libtrace)->config.pktin_mode;
+	pktio_param.out_mode = ODP_PKTOUT_MODE_DISABLED;
+
+	if (FORMAT(libtrace)->pool == ODP_POOL_INVALID &&
+	    lodp_create_pool(&FORMAT(libtrace)->config,
+	                     lodp_input_pool_size(libtrace, rx_queues),
+	                     &FORMAT(libtrace)->pool, err, errlen) != 0)
 		return -1;
 
-	switch (option) 
-	{
-		case TRACE_OPTION_OUTPUT_COMPRESS:
-			//OUTPUT->level = *(int *)data;
-			return 0;
-		case TRACE_OPTION_OUTPUT_COMPRESSTYPE:
-			//OUTPUT->compress_type = *(int *)data;
+	for (p = 0; p < FORMAT(libtrace)->config.nb_ports; p++) {
+		if (lodp_open_pktio(FORMAT(libtrace)->config.devname[p],
+		                    FORMAT(libtrace)->pool, &pktio_param,
+		                    &FORMAT(libtrace)->pktio[p],
+		                    err, errlen) != 0) {
+			/* Close what we opened so a retry starts afresh */
+			while (--p >= 0)
+				odp_pktio_close(FORMAT(libtrace)->pktio[p]);
+			return -1;
+		}
+	}
+	FORMAT(libtrace)->nb_pktio = FORMAT(libtrace)->config.nb_ports;
+
+	if (FORMAT(libtrace)->nb_cls_rules > 0)
+		return lodp_setup_classifier(FORMAT(libtrace), err, errlen);
+	return 0;
+}
+
+static int lodp_config_input(libtrace_t *libtrace, trace_option_t option,
+                             void *data)
+{
+	switch (option) {
+	case TRACE_OPTION_SNAPLEN:
+		/* Make sure the first segment can hold the whole snap, the
+		 * pool can only be changed before we are first started */
+		if (FORMAT(libtrace)->paused == ODP_NEVER_STARTED &&
+		    *(int*)data > (int) FORMAT(libtrace)->config.buf_size)
+			FORMAT(libtrace)->config.buf_size = *(int*)data;
+		/* Let libtrace truncate the packets to the snaplen */
+		break;
+	case TRACE_OPTION_PROMISC:
+		FORMAT(libtrace)->promisc = *(int*)data;
+		if (FORMAT(libtrace)->paused == ODP_RUNNING) {
+			int p;
+			for (p = 0; p < FORMAT(libtrace)->nb_pktio; p++) {
+				if (odp_pktio_promisc_mode_set(
+				        FORMAT(libtrace)->pktio[p],
+				        FORMAT(libtrace)->promisc) != 0)
+					return -1;
+			}
+		}
+		return 0;
+	case TRACE_OPTION_HASHER:
+		switch (*((enum hasher_types *) data))
+		{
+		case HASHER_BALANCE:
+			FORMAT(libtrace)->flow_hasher = 0;
 			return 0;
-		case TRACE_OPTION_OUTPUT_FILEFLAGS:
-			//OUTPUT->fileflag = *(int *)data;
+		case HASHER_UNIDIRECTIONAL:
+		case HASHER_BIDIRECTIONAL:
+#ifndef OPTION_SYMMETRIC_RSS
+			if (*((enum hasher_types *) data) ==
+			    HASHER_BIDIRECTIONAL)
+				return -1;
+#endif
+			/* A filter on the classifier delivers every packet
+			 * to a single queue, so let libtrace hash them */
+			if (FORMAT(libtrace)->nb_cls_rules > 0)
+				return -1;
+			FORMAT(libtrace)->flow_hasher = 1;
 			return 0;
-		default:
-			trace_set_err_out(libtrace, TRACE_ERR_UNKNOWN_OPTION, "Unknown option");
+		case HASHER_CUSTOM:
+		case HASHER_FAST:
+			// We don't support these
 			return -1;
+		}
+		break;
+	case TRACE_OPTION_FILTER:
+#ifdef HAVE_BPF
+		{
+			libtrace_filter_t *filter = (libtrace_filter_t *) data;
+			int nrules;
+
+			/* A filter created from bytecode has no string. The
+			 * classifier is incompatible with the flow hash and
+			 * can only be set up before we first start. Classified
+			 * packets arrive on a CoS queue, which is only read in
+			 * the scheduled mode, so it is left to the user to
+			 * choose that mode. */
+			if (filter->filterstring == NULL ||
+			    FORMAT(libtrace)->flow_hasher ||
+			    FORMAT(libtrace)->paused != ODP_NEVER_STARTED ||
+			    FORMAT(libtrace)->config.pktin_mode !=
+			    ODP_PKTIN_MODE_SCHED)
+				break;
+			nrules = lodp_parse_filter(filter->filterstring,
+			                           FORMAT(libtrace)->cls_rules);
+			if (nrules > 0)
+				FORMAT(libtrace)->nb_cls_rules = nrules;
+			/* The classifier is only a pre-filter, so libtrace
+			 * still applies the filter itself */
+		}
+#endif
+		break;
+	case TRACE_OPTION_META_FREQ:
+	case TRACE_OPTION_EVENT_REALTIME:
+		break;
+	/* Avoid default: so that future options will cause a warning
+	 * here to remind us to implement it, or flag it as
+	 * unimplementable
+	 */
 	}
-	assert(0);
+
+	/* Don't set an error - trace_config will try to deal with the
+	 * option and will set an error if it fails */
+	return -1;
 }
 
 static int lodp_start_input(libtrace_t *libtrace) 
 {
-	int ret;
+	char err[500];
+	err[0] = 0;
 
 	printf("%s() \n", __func__);
 
-#if 0
-	if (libtrace->io) // io - the libtrace IO reader for this trace (if applicable)
-		return 0; //file already open
-	
-	libtrace->io = trace_open_file(libtrace);//Open a file for reading using the new Libtrace IO system (wandio_create)
-	if (!libtrace->io)
-	{
-                fprintf(stderr, "Error: trace_open_file() failed\n");
+	if (lodp_open_input(libtrace, 1, err, sizeof(err)) != 0 ||
+	    lodp_start_streams(FORMAT(libtrace), err, sizeof(err), 1) != 0) {
+		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "%s", err);
 		return -1;
 	}
-#endif
+	return 0;
+}
+
+static int lodp_pstart_input(libtrace_t *libtrace)
+{
+	char err[500];
+	int tot = libtrace->perpkt_thread_count;
+	odp_pktio_capability_t capa;
+	int p;
+	err[0] = 0;
+
+	debug("%s() \n", __func__);
+
+	/* The URI can limit the number of queues we use */
+	if (FORMAT(libtrace)->config.queues > 0 &&
+	    tot > FORMAT(libtrace)->config.queues)
+		tot = FORMAT(libtrace)->config.queues;
+
+	if (lodp_open_input(libtrace, tot, err, sizeof(err)) != 0) {
+		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "%s", err);
+		return -1;
+	}
+
+	/* Don't ask for more queues than any device has, one queue of
+	 * each port is given to each perpkt thread */
+	for (p = 0; p < FORMAT(libtrace)->nb_pktio; p++) {
+		if (odp_pktio_capability(FORMAT(libtrace)->pktio[p], &capa) == 0 &&
+		    capa.max_input_queues > 0 && tot > (int) capa.max_input_queues)
+			tot = capa.max_input_queues;
+	}
+	if (tot < 1)
+		tot = 1;
+
+	if (lodp_start_streams(FORMAT(libtrace), err, sizeof(err), tot) != 0) {
+		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "%s", err);
+		return -1;
+	}
+
+	/* Make sure we only start the number that we should */
+	libtrace->perpkt_thread_count = tot;
+	return 0;
+}
 
-	//start pktio
-        fprintf(stdout, "going to start pktio\n");
-        ret = odp_pktio_start(FORMAT(libtrace)->pktio);
-        if (ret != 0)
-                fprintf(stderr, "Error: unable to start pktio\n");
+static int lodp_pause_input(libtrace_t *libtrace)
+{
+	libtrace_list_node_t *tmp;
+	int p;
 
-        printf("  created pktio:%02ld, queue mode\n default pktio%02ld-INPUT queue\n",
-                (long)(FORMAT(libtrace)->pktio), (long)(FORMAT(libtrace)->pktio));
+	debug("%s() \n", __func__);
 
+	/* Stopping the pktios allows the queues to be reconfigured when
+	 * we are restarted */
+	if (FORMAT(libtrace)->paused == ODP_RUNNING) {
+		for (p = 0; p < FORMAT(libtrace)->nb_pktio; p++)
+			odp_pktio_stop(FORMAT(libtrace)->pktio[p]);
+		FORMAT(libtrace)->paused = ODP_PAUSED;
+		/* Empty the queue of packets */
+		for (; FORMAT(libtrace)->burst_offset < FORMAT(libtrace)->burst_size; ++FORMAT(libtrace)->burst_offset) {
+			odp_packet_free(FORMAT(libtrace)->burst_pkts[FORMAT(libtrace)->burst_offset]);
+		}
+		FORMAT(libtrace)->burst_offset = 0;
+		FORMAT(libtrace)->burst_size = 0;
+
+		for (tmp = FORMAT_DATA_HEAD(libtrace); tmp != NULL; tmp = tmp->next) {
+			odp_per_stream_t *stream = tmp->data;
+			stream->ts_last_sys = 0;
+		}
+	}
 	return 0;
 }
 
 static int lodp_start_output(libtrace_out_t *libtrace) 
 {
+	odp_pktout_queue_param_t pktout_param;
+
 	printf("%s() \n", __func__);
 
-	OUTPUT->file = trace_open_file_out(libtrace, 
-						OUTPUT->compress_type,
-						OUTPUT->level,
-						OUTPUT->fileflag);
-	if (!OUTPUT->file) {
+	if (OUTPUT->paused == ODP_RUNNING)
+		return 0;
+
+	odp_pktout_queue_param_init(&pktout_param);
+	pktout_param.num_queues = 1;
+	/* Output traces are only ever written by a single thread */
+	pktout_param.op_mode = ODP_PKTIO_OP_MT_UNSAFE;
+
+	if (odp_pktout_queue_config(OUTPUT->pktio, &pktout_param)) {
+		trace_set_err_out(libtrace, TRACE_ERR_INIT_FAILED,
+		                  "ODP - Cannot configure the pktout queue");
 		return -1;
 	}
+
+	if (odp_pktout_queue(OUTPUT->pktio, &OUTPUT->pktout, 1) != 1) {
+		trace_set_err_out(libtrace, TRACE_ERR_INIT_FAILED,
+		                  "ODP - Cannot get the pktout queue");
+		return -1;
+	}
+
+	if (odp_pktio_start(OUTPUT->pktio)) {
+		trace_set_err_out(libtrace, TRACE_ERR_INIT_FAILED,
+		                  "ODP - Unable to start pktio");
+		return -1;
+	}
+	OUTPUT->paused = ODP_RUNNING;
+	return 0;
+}
+
+/**
+ * Sends every packet waiting in the tx burst.
+ *
+ * The pktout queue may accept only part of a burst if the NIC ring is full,
+ * in which case we retry with the remainder. Packets are only dropped if
+ * the pktio reports an error.
+ */
+static int lodp_flush_output(libtrace_out_t *libtrace)
+{
+	int sent = 0;
+	int ret;
+
+	while (sent < OUTPUT->tx_size) {
+		ret = odp_pktout_send(OUTPUT->pktout, &OUTPUT->tx_burst[sent],
+		                      OUTPUT->tx_size - sent);
+		if (ret < 0) {
+			/* We still own the packets that were not sent */
+			odp_packet_free_multi(&OUTPUT->tx_burst[sent],
+			                      OUTPUT->tx_size - sent);
+			OUTPUT->tx_dropped += OUTPUT->tx_size - sent;
+			OUTPUT->tx_size = 0;
+			trace_set_err_out(libtrace, EIO,
+			                  "odp_pktout_send failed");
+			return -1;
+		}
+		sent += ret;
+	}
+	OUTPUT->tx_size = 0;
 	return 0;
 }
 
 static int lodp_fin_input(libtrace_t *libtrace) 
 {
+	int p, pool_in_use = 0;
+
 	printf("%s() \n", __func__);
 
-        odp_pktio_stop(FORMAT(libtrace)->pktio);
-        odp_pktio_close(FORMAT(libtrace)->pktio);
+	/* Stops the pktios and returns any buffered packets to the pool */
+	lodp_pause_input(libtrace);
+	for (p = 0; p < FORMAT(libtrace)->nb_pktio; p++)
+	        odp_pktio_close(FORMAT(libtrace)->pktio[p]);
 	printf("pktio stopped and closed \n");
+	lodp_destroy_classifier(FORMAT(libtrace));
+
+	/* This fails while any packet from the pool is still in use. An
+	 * ODP output may still be sending packets we read, so give those a
+	 * moment to come back. */
+	if (FORMAT(libtrace)->pool != ODP_POOL_INVALID) {
+		uint64_t start = lodp_get_sys_time_ns();
+
+		while (odp_pool_destroy(FORMAT(libtrace)->pool) != 0) {
+			if (lodp_get_sys_time_ns() - start <
+			    POOL_DESTROY_WAIT_NS) {
+				usleep(1000);
+				continue;
+			}
+			/* The user is holding on to packets. Leave the pool
+			 * and ODP itself running so they stay valid, rather
+			 * than freeing memory out from under them. */
+			fprintf(stderr, "ODP - Packets are still in use, the"
+			        " packet pool cannot be destroyed\n");
+			pool_in_use = 1;
+			break;
+		}
+	}
 
 	if (libtrace->io)
 	{
@@ -401,7 +1347,13 @@ static int lodp_fin_input(libtrace_t *libtrace)
 	else
 		printf("there is no wandio to destroy\n");
 
+	libtrace_list_deinit(FORMAT(libtrace)->per_stream);
 	free(libtrace->format_data);
+	if (pool_in_use) {
+		lodp_term_local();
+		return -1;
+	}
+	lodp_release_environment(1);
 
 	return 0;
 }
@@ -410,12 +1362,15 @@ static int lodp_fin_output(libtrace_out_t *libtrace)
 {
 	printf("%s() \n", __func__);
 
-	wandio_wdestroy(OUTPUT->file);
-
-	//XXX - we have stopped pktio already in odp_fin_input(). 
-	//Probably there is a need to stop it also here, but probably not.
+	if (OUTPUT->paused == ODP_RUNNING) {
+		lodp_flush_output(libtrace);
+		odp_pktio_stop(OUTPUT->pktio);
+	}
+	odp_pktio_close(OUTPUT->pktio);
+	odp_pool_destroy(OUTPUT->pool);
 
 	free(libtrace->format_data);
+	lodp_release_environment(1);
 	return 0;
 }
 /*
@@ -432,7 +1387,7 @@ static int lodp_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 
 	//in theory we don't have packets allocated with TRACE_CTRL_PACKET
 	if (packet->buffer != buffer && packet->buf_control == TRACE_CTRL_PACKET)
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
 
         if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
                 packet->buf_control = TRACE_CTRL_PACKET;
@@ -443,63 +1398,182 @@ static int lodp_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 	void *payload;			**< Pointer to the link layer *
 	void *buffer;			**< Allocated buffer *
 */
-        packet->buffer = buffer; //XXX - why do we need it, if they are already equal?
-        packet->header = buffer;
-	packet->payload = FORMAT(libtrace)->l2h; //XXX - maybe do it as in dpdk with dpdk_get_framing_length?
-	packet->capture_length = FORMAT(libtrace)->pkt_len;
-	packet->wire_length = FORMAT(libtrace)->pkt_len;
-	//packet->payload = (char *)buffer + dpdk_get_framing_length(packet);
+        /* Everything is taken from the odp packet itself, this is called
+         * concurrently by every perpkt thread so nothing can be stored
+         * against the trace. The buffer is the odp packet handle and our
+         * header sits in the headroom directly before the packet data */
+        packet->buffer = buffer;
+	packet->payload = odp_packet_data((odp_packet_t) buffer);
+        packet->header = (char *) packet->payload - sizeof(struct odp_addt_hdr);
 	packet->type = rt_type;
 
-#if 0
 	if (libtrace->format_data == NULL) {
-		if (odp_init_input(libtrace))
+		if (lodp_init_input(libtrace))
 			return -1;
 	}
-#endif
 
 	return 0;
 }
 
-static int lodp_read_pack(libtrace_t *libtrace)
+/**
+ * Receives up to nb_packets, either straight from the stream's pktin
+ * queue or from the scheduler in scheduled mode.
+ *
+ * @param wait False to return straight away if nothing is waiting, true
+ * to wait up to RX_WAIT_NS for a packet
+ * @return The number of packets received, 0 if none arrived or negative
+ * on error.
+ */
+static inline int lodp_recv_burst(struct odp_format_data_t *format_data,
+                                  odp_per_stream_t *stream,
+                                  odp_packet_t pkts_burst[],
+                                  size_t nb_packets, int wait)
+{
+	odp_event_t events[nb_packets];
+	int nb_rx, i, p;
+
+	if (format_data->config.pktin_mode == ODP_PKTIN_MODE_DIRECT) {
+		/* Take turns at which port is polled first so a busy port
+		 * cannot starve the others */
+		for (i = 0; i < stream->nb_pktin; i++) {
+			p = stream->next_pktin;
+			if (++stream->next_pktin == stream->nb_pktin)
+				stream->next_pktin = 0;
+			nb_rx = odp_pktin_recv(stream->pktin[p], pkts_burst,
+			                       nb_packets);
+			if (nb_rx != 0)
+				return nb_rx;
+		}
+		if (!wait)
+			return 0;
+		if (stream->nb_pktin == 1)
+			return odp_pktin_recv_tmo(stream->pktin[0], pkts_burst,
+			                          nb_packets,
+			                          format_data->rx_wait);
+		return odp_pktin_recv_mq_tmo(stream->pktin, stream->nb_pktin,
+		                             NULL, pkts_burst, nb_packets,
+		                             format_data->rx_wait);
+	}
+
+	nb_rx = odp_schedule_multi(NULL, wait ? format_data->rx_wait :
+	                           ODP_SCHED_NO_WAIT, events, nb_packets);
+	for (i = 0; i < nb_rx; ++i)
+		pkts_burst[i] = odp_packet_from_event(events[i]);
+	return nb_rx;
+}
+
+/**
+ * Fills in the header in front of each packet of a burst.
+ *
+ * If the pktio timestamped the packet we use that, otherwise every packet
+ * in the burst is stamped from a single read of the system clock.
+ */
+static inline void lodp_ready_pkts(struct odp_format_data_t *format_data,
+                                   odp_per_stream_t *stream,
+                                   odp_packet_t pkts[], int nb_pkts)
 {
-	int numbytes;
-	odp_event_t ev;
+	struct odp_addt_hdr *hdr;
+	uint64_t cur_sys_time_ns;
+	int i;
+
+	cur_sys_time_ns = lodp_get_sys_time_ns();
+
+	/* The system clock is not perfect so when running at linerate
+	 * we could timestamp a packet in the past. To avoid this we munge
+	 * the timestamp to appear 1ns after the previous packet. We should
+	 * eventually catch up to system time since a 64byte packet on a
+	 * 10G link takes 67ns.
+	 */
+	if (stream->ts_last_sys >= cur_sys_time_ns)
+		cur_sys_time_ns = stream->ts_last_sys + 1;
+
+	for (i = 0; i < nb_pkts; ++i) {
+		/* The headroom must fit our header, ODP reserves at
+		 * least ODP_CONFIG_PACKET_HEADROOM which is plenty */
+		assert(odp_packet_headroom(pkts[i]) >= sizeof(struct odp_addt_hdr));
+		hdr = (struct odp_addt_hdr *) ((char *) odp_packet_data(pkts[i])
+		                               - sizeof(struct odp_addt_hdr));
+		memset(hdr, 0, sizeof(struct odp_addt_hdr));
+
+		/* With several ports the direction is the index of the
+		 * port in the URI the packet arrived on */
+		if (format_data->nb_pktio > 1) {
+			odp_pktio_t input = odp_packet_input(pkts[i]);
+			int p;
+			for (p = 0; p < format_data->nb_pktio; p++) {
+				if (format_data->pktio[p] == input) {
+					hdr->direction = p;
+					break;
+				}
+			}
+		}
 
-	while (1) 
+		/* Only the first segment is contiguous with our header */
+		hdr->wire_len = odp_packet_len(pkts[i]);
+		hdr->cap_len = odp_packet_seg_len(pkts[i]);
+		if (hdr->cap_len > hdr->wire_len)
+			hdr->cap_len = hdr->wire_len;
+
+		if (format_data->hw_timestamps && odp_packet_has_ts(pkts[i])) {
+			hdr->flags |= INCLUDES_HW_TIMESTAMP;
+			hdr->timestamp = odp_time_to_ns(odp_packet_ts(pkts[i]))
+			                 + format_data->ts_offset;
+		} else {
+			hdr->timestamp = cur_sys_time_ns++;
+		}
+	}
+
+	stream->ts_last_sys = cur_sys_time_ns - 1;
+}
+
+/**
+ * Reads at least one packet from a stream or returns an error.
+ *
+ * Rather than blocking in ODP until a packet arrives we wait at most
+ * RX_WAIT_NS at a time, between waits checking for messages so a perpkt
+ * thread can be paused, stopped or sent ticks while the link is idle.
+ *
+ * @return The number of packets read, READ_MESSAGE if a message is waiting,
+ * READ_EOF if libtrace is halting or READ_ERROR
+ */
+static inline int lodp_read_packet_stream(libtrace_t *libtrace,
+                                          odp_per_stream_t *stream,
+                                          libtrace_message_queue_t *mesg,
+                                          odp_packet_t pkts_burst[],
+                                          size_t nb_packets)
+{
+	int nb_rx; /* Number of rx packets we've received */
+	int wait = 0; /* Only wait once we know nothing is there */
+
+	while (1)
 	{
-                /* Use schedule to get buf from any input queue. 
-		   Waits infinitely for a new event with ODP_SCHED_WAIT param. */
         	debug("%s() - waiting for packet!\n", __func__);
-                ev = odp_schedule(NULL, ODP_SCHED_WAIT);
-                FORMAT(libtrace)->pkt = odp_packet_from_event(ev);
-                if (!odp_packet_is_valid(FORMAT(libtrace)->pkt))
-		{
-        		fprintf(stdout, "%s() - packet is INVALID, skipping...\n", __func__);
-                        continue;
-		}
-		else
-		{
+		/* Poll for a batch of packets */
+		nb_rx = lodp_recv_burst(FORMAT(libtrace), stream, pkts_burst,
+		                        nb_packets, wait);
+		if (nb_rx > 0) {
 #ifdef OPTION_PRINT_PACKETS
-        		fprintf(stdout, "%s() - packet is valid, print:\n", __func__);
-        		fprintf(stdout, "--------------------------------------------------\n");
-			odp_packet_print(FORMAT(libtrace)->pkt);
-        		fprintf(stdout, "--------------------------------------------------\n");
+			int i;
+			for (i = 0; i < nb_rx; ++i)
+				odp_packet_print(pkts_burst[i]);
 #endif
+			lodp_ready_pkts(FORMAT(libtrace), stream, pkts_burst, nb_rx);
+			stream->pkts_read += nb_rx;
+			return nb_rx;
 		}
-
-                //Returns pointer to the start of the layer 2 header
-                FORMAT(libtrace)->l2h = (u_char *)odp_packet_l2_ptr(FORMAT(libtrace)->pkt, NULL);
-                FORMAT(libtrace)->pkt_len = (int)odp_packet_len(FORMAT(libtrace)->pkt);
-                numbytes = FORMAT(libtrace)->pkt_len;
-		FORMAT(libtrace)->pkts_read++;
-
+		if (nb_rx < 0) {
+			trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+			              "Receiving a burst failed on queue %d",
+			              stream->queue_id);
+			return READ_ERROR;
+		}
+		/* Check the message queue this could be less than 0 */
+		if (mesg && libtrace_message_queue_count(mesg) > 0)
+			return READ_MESSAGE;
 		//if trace stopped
 		if (libtrace_halt)
 			return READ_EOF;
-	
-		debug("packet is %d bytes, total packets: %u\n", numbytes, FORMAT(libtrace)->pkts_read);
-		return numbytes;
+		wait = 1;
 	}
 
 	/* We'll NEVER get here */
@@ -533,7 +1607,7 @@ static int lodp_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 	{
 		//Check buffer memory is owned by the packet. It is if flag is TRACE_CTRL_PACKET
 		assert(packet->buf_control == TRACE_CTRL_PACKET); 
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 		packet->buffer = NULL;
 	}
 
@@ -542,40 +1616,123 @@ static int lodp_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 	packet->buf_control = TRACE_CTRL_EXTERNAL;
 	packet->type = TRACE_RT_DATA_ODP;
 
-	//#2. Read a packet from odp. We wait here forever till packet appears.
-	numbytes = lodp_read_pack(libtrace);
-	if (numbytes == -1) 
-	{
-		trace_set_err(libtrace, errno, "Reading odp packet failed");
-		return -1;
+	//#2. Check if we already have some packets buffered
+	if (FORMAT(libtrace)->burst_size != FORMAT(libtrace)->burst_offset) {
+		packet->buffer = FORMAT(libtrace)->burst_pkts[FORMAT(libtrace)->burst_offset++];
+		if (lodp_prepare_packet(libtrace, packet, packet->buffer, packet->type, flags))
+			return -1;
+		return odp_packet_len((odp_packet_t) packet->buffer);
 	}
-	else if (numbytes == 0)
-		return 0;
 
-	//#3. Get pointer from packet and assign it to packet->buffer
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) 
-	{
-		packet->buffer = FORMAT(libtrace)->pkt;
-		packet->capture_length = FORMAT(libtrace)->pkt_len;
-		debug("pointer to packet: %p \n", packet->buffer);
-                if (!packet->buffer) 
-		{
-                        trace_set_err(libtrace, errno, "Cannot allocate memory or have invalid pointer to packet");
-                        return -1;
-                }
-        }
+	//#3. Read a burst from odp. We wait here forever till packets appear.
+	numbytes = lodp_read_packet_stream(libtrace, FORMAT_DATA_FIRST(libtrace),
+	                                   NULL, FORMAT(libtrace)->burst_pkts,
+	                                   BURST_SIZE);
+	if (numbytes <= 0)
+		return numbytes;
+	FORMAT(libtrace)->pkts_read += numbytes;
+	FORMAT(libtrace)->burst_size = numbytes;
+	FORMAT(libtrace)->burst_offset = 1;
+
+	//#4. Hand out the first packet of the burst
+	packet->buffer = FORMAT(libtrace)->burst_pkts[0];
+	debug("pointer to packet: %p \n", packet->buffer);
 
 	if (lodp_prepare_packet(libtrace, packet, packet->buffer, packet->type, flags))
 		return -1;
 	
-	return numbytes;
+	return odp_packet_len((odp_packet_t) packet->buffer);
 }
 
+/* Reads a batch of packets from the pktin queue owned by this thread */
+static int lodp_pread_packets(libtrace_t *libtrace, libtrace_thread_t *t,
+                              libtrace_packet_t **packets, size_t nb_packets)
+{
+	int nb_rx; /* Number of rx packets we've received */
+	odp_packet_t pkts_burst[nb_packets];
+	odp_per_stream_t *stream = t->format_data;
+	int i;
+
+	nb_rx = lodp_read_packet_stream(libtrace, stream, &t->messages,
+	                                pkts_burst, nb_packets);
+
+	for (i = 0; i < nb_rx; ++i) {
+		if (packets[i]->buffer != NULL) {
+			/* The packet should always be finished */
+			assert(packets[i]->buf_control == TRACE_CTRL_PACKET);
+			libtrace_buffer_pool_free(packets[i]->buffer);
+		}
+		packets[i]->buf_control = TRACE_CTRL_EXTERNAL;
+		packets[i]->type = TRACE_RT_DATA_ODP;
+		packets[i]->buffer = pkts_burst[i];
+		packets[i]->trace = libtrace;
+		packets[i]->error = 1;
+		lodp_prepare_packet(libtrace, packets[i], packets[i]->buffer,
+		                    packets[i]->type, 0);
+	}
+
+	return nb_rx;
+}
+
+/**
+ * Registers a thread with ODP, every thread touching ODP must call
+ * odp_init_local() first. Threads reading packets are attached to a stream,
+ * perpkt threads get the stream matching their number and anything else
+ * (i.e. a hasher thread) reads from the first stream.
+ */
+static int lodp_pregister_thread(libtrace_t *libtrace, libtrace_thread_t *t,
+                                 bool reading)
+{
+	debug("%s() \n", __func__);
+
+	if (lodp_init_local(reading ? ODP_THREAD_WORKER : ODP_THREAD_CONTROL)) {
+		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED,
+		              "ODP local init failed");
+		return -1;
+	}
+
+	if (reading) {
+		if (t->type == THREAD_PERPKT) {
+			libtrace_list_node_t *n = libtrace_list_get_index(
+			        FORMAT(libtrace)->per_stream, t->perpkt_num);
+			if (n == NULL) {
+				trace_set_err(libtrace, TRACE_ERR_INIT_FAILED,
+				              "Too many threads registered");
+				return -1;
+			}
+			t->format_data = n->data;
+		} else {
+			t->format_data = FORMAT_DATA_FIRST(libtrace);
+		}
+	}
+	return 0;
+}
+
+/* Releases the ODP resources of a thread registered by pregister_thread */
+static void lodp_punregister_thread(libtrace_t *libtrace UNUSED,
+                                    libtrace_thread_t *t)
+{
+	debug("%s() \n", __func__);
+
+	t->format_data = NULL;
+	lodp_term_local();
+}
+
+/**
+ * Returns the odp packet attached to a libtrace packet to its pool.
+ *
+ * Packets read from ODP are never copied, packet->buffer holds the odp
+ * packet handle and buf_control is TRACE_CTRL_EXTERNAL for as long as the
+ * libtrace packet owns it. libtrace calls this as the packet is finished
+ * with, in the parallel case as it is returned to the packet_freelist, so
+ * the odp packet goes straight back to the pool and the libtrace packet is
+ * reused as is for the next read without touching malloc.
+ */
 static void lodp_fin_packet(libtrace_packet_t *packet)
 {
 	debug("%s() \n", __func__);
 
-	if (packet->buf_control == TRACE_CTRL_EXTERNAL) 
+	if (packet->buf_control == TRACE_CTRL_EXTERNAL && packet->buffer)
 	{
 		odp_packet_free(packet->buffer);
 		packet->buffer = NULL;
@@ -583,89 +1740,111 @@ static void lodp_fin_packet(libtrace_packet_t *packet)
 }
 
 
+/**
+ * Queues a packet to be sent out of the ODP interface.
+ *
+ * Packets are sent in bursts, the burst is flushed once BURST_SIZE packets
+ * are waiting or, when a packet is written, the oldest has waited longer
+ * than TX_FLUSH_NS. Nothing is sent between writes, whatever is waiting
+ * is sent when the output is closed.
+ *
+ * Packets read from an ODP input are sent without a copy, using a static
+ * reference to the odp packet so the libtrace packet is left unchanged.
+ * A reference shares the packet data so cannot be trimmed, a packet whose
+ * capture length has been reduced is copied instead, as are packets from
+ * any other format, into a packet allocated from our pool.
+ */
 static int lodp_write_packet(libtrace_out_t *libtrace, 
 		libtrace_packet_t *packet) 
 {
+	odp_packet_t pkt = ODP_PACKET_INVALID;
+	int caplen;
+
 	debug("%s() \n", __func__);
 
-	int numbytes = 0;
-	
-	assert(OUTPUT->file);
-//XXX - todo
-#if 0
-	if (OUTPUT->dag_version == 0) {
-	/* Writing the DUCK version will help with reading it back in later! */
-		duck_version = bswap_host_to_le32(packet->type);
-		if ((numbytes = wandio_wwrite(OUTPUT->file, &duck_version,
-				sizeof(duck_version))) != sizeof(uint32_t)){
-			trace_set_err_out(libtrace, errno, 
-					"Writing DUCK version failed");
+	if (trace_get_link_type(packet) != TRACE_TYPE_ETH) {
+		trace_set_err_out(libtrace, TRACE_ERR_NO_CONVERSION,
+		                  "Only Ethernet packets can be sent using ODP");
+		return -1;
+	}
+
+	caplen = trace_get_capture_length(packet);
+
+	if (packet->trace && packet->trace->format == &lodp &&
+	    packet->buf_control == TRACE_CTRL_EXTERNAL && packet->buffer &&
+	    odp_packet_len((odp_packet_t) packet->buffer) == (uint32_t) caplen) {
+		/* Zero copy, falling back to a copy if no reference can
+		 * be made */
+		pkt = odp_packet_ref_static((odp_packet_t) packet->buffer);
+	}
+	if (pkt == ODP_PACKET_INVALID) {
+		pkt = odp_packet_alloc(OUTPUT->pool, caplen);
+		if (pkt == ODP_PACKET_INVALID) {
+			trace_set_err_out(libtrace, errno,
+			                  "Cannot get an empty packet buffer");
+			return -1;
+		}
+		if (odp_packet_copy_from_mem(pkt, 0, caplen, packet->payload)) {
+			odp_packet_free(pkt);
+			trace_set_err_out(libtrace, TRACE_ERR_BAD_PACKET,
+			                  "Cannot copy the packet into an odp packet");
 			return -1;
 		}
-		OUTPUT->dag_version = packet->type;
 	}
-#endif
-	if ((numbytes = wandio_wwrite(OUTPUT->file, packet->payload, trace_get_capture_length(packet))) !=
-				(int)trace_get_capture_length(packet)) 
-	{
-		trace_set_err_out(libtrace, errno, "Writing packet failed");
-		return -1;
+
+	if (OUTPUT->tx_size == 0)
+		OUTPUT->tx_first_ns = lodp_get_sys_time_ns();
+	OUTPUT->tx_burst[OUTPUT->tx_size++] = pkt;
+
+	if (OUTPUT->tx_size == BURST_SIZE ||
+	    lodp_get_sys_time_ns() - OUTPUT->tx_first_ns >= TX_FLUSH_NS) {
+		if (lodp_flush_output(libtrace))
+			return -1;
 	}
-	return numbytes;
+	return caplen;
+}
+
+/**
+ * Get the start of the additional header that we added to a packet.
+ */
+static inline struct odp_addt_hdr *get_addt_hdr(const libtrace_packet_t *packet)
+{
+	assert(packet);
+	assert(packet->header);
+	return (struct odp_addt_hdr *) packet->header;
 }
 
 //Returns the payload length of the captured packet record
-//We use the value we got from odp and stored in FORMAT(libtrace)->pkt_len
 static int lodp_get_capture_length(const libtrace_packet_t *packet)
 {
-	int pkt_len;
-
-	debug("%s() \n", __func__);
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
+	return hdr->cap_len;
+}
 
-	if (packet)
-	{
-		// this won't work probably, as we don't set packet->length anywhere, so can't return it.
-		//pkt_len = (int)trace_get_capture_length(packet);
-		//pkt_len = FORMAT(libtrace)->pkt_len;
-		pkt_len = packet->capture_length;
-		debug("packet: %p , length: %d\n", packet, pkt_len);
-		return pkt_len;
-	}
-	else
-	{
-		debug("NO packet. \n");
-		trace_set_err(packet->trace,TRACE_ERR_BAD_PACKET, "Have no packet");
-		return -1;
+static size_t lodp_set_capture_length(libtrace_packet_t *packet, size_t size)
+{
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
+	if (size > hdr->cap_len) {
+		/* Cannot make a packet bigger */
+		return trace_get_capture_length(packet);
 	}
+
+	/* Reset the cached capture length first*/
+	packet->capture_length = -1;
+	hdr->cap_len = (uint32_t) size;
+	return trace_get_capture_length(packet);
 }
 
-static int lodp_get_framing_length(const libtrace_packet_t *packet) 
+static int lodp_get_framing_length(const libtrace_packet_t *packet UNUSED)
 {
-	debug("%s() \n", __func__);
-
-	if (packet)
-		//return trace_get_framing_length(packet);
-		return 0; //XXX - TODO, fix it, this is just for test
-	else
-	{
-		trace_set_err(packet->trace,TRACE_ERR_BAD_PACKET, "Have no packet");
-		return -1;
-	}
+	return sizeof(struct odp_addt_hdr);
 }
 
 //Returns the original length of the packet as it was on the wire
 static int lodp_get_wire_length(const libtrace_packet_t *packet) 
 {
-	debug("%s() \n", __func__);
-
-	if (packet)
-		//return trace_get_wire_length(packet);
-		return packet->wire_length;
-	else
-	{
-		trace_set_err(packet->trace,TRACE_ERR_BAD_PACKET, "Have no packet");
-		return -1;
-	}
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
+	return hdr->wire_len;
 }
 
 static libtrace_linktype_t lodp_get_link_type(const libtrace_packet_t *packet UNUSED) 
@@ -675,29 +1854,217 @@ static libtrace_linktype_t lodp_get_link_type(const libtrace_packet_t *packet UN
 	return TRACE_TYPE_ETH;	//We have Ethernet for ODP and in DPDK.
 }
 
-//XXX - return timestamp from a packet or time now (as hack)
-static double lodp_get_seconds(const libtrace_packet_t *packet)
+static libtrace_direction_t lodp_get_direction(const libtrace_packet_t *packet)
+{
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
+	return (libtrace_direction_t) hdr->direction;
+}
+
+static libtrace_direction_t lodp_set_direction(libtrace_packet_t *packet,
+                                               libtrace_direction_t direction)
+{
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
+	hdr->direction = (uint8_t) direction;
+	return (libtrace_direction_t) hdr->direction;
+}
+
+static uint64_t lodp_get_erf_timestamp(const libtrace_packet_t *packet)
 {
-	double seconds = 0.0f;
-	time_t t;
-	time(&t);
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
 
-	//XXX - hack for test
-	seconds = (double)t;
-	debug("packet framing header is : %p, time : %.0f \n",
-		packet->header, seconds);
+	return ((hdr->timestamp / 1000000000ull) << 32) +
+	       (((hdr->timestamp % 1000000000ull) << 32) / 1000000000ull);
+}
+
+static struct timeval lodp_get_timeval(const libtrace_packet_t *packet)
+{
+	struct timeval tv;
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
+
+	tv.tv_sec = hdr->timestamp / (uint64_t) 1000000000;
+	tv.tv_usec = (hdr->timestamp % (uint64_t) 1000000000) / 1000;
+	return tv;
+}
+
+static struct timespec lodp_get_timespec(const libtrace_packet_t *packet)
+{
+	struct timespec ts;
+	struct odp_addt_hdr *hdr = get_addt_hdr(packet);
 
-	return seconds;
+	ts.tv_sec = hdr->timestamp / (uint64_t) 1000000000;
+	ts.tv_nsec = hdr->timestamp % (uint64_t) 1000000000;
+	return ts;
+}
+
+/**
+ * Fills in the statistics of an input trace.
+ *
+ * Received, dropped and error counts come from the pktio itself if it
+ * supports statistics. Captured is the number of packets read from all of
+ * our streams, this is always available.
+ */
+static void lodp_get_stats(libtrace_t *trace, libtrace_stat_t *stats)
+{
+	odp_pktio_stats_t pktio_stats;
+	libtrace_list_node_t *n;
+	uint64_t captured = 0;
+	uint64_t dropped = 0, errors = 0, received = 0;
+	int p;
+
+	if (trace->format_data == NULL || FORMAT(trace)->nb_pktio == 0)
+		return;
+
+	for (n = FORMAT_DATA_HEAD(trace); n; n = n->next) {
+		odp_per_stream_t *stream = n->data;
+		captured += stream->pkts_read;
+	}
+	stats->captured_valid = true;
+	stats->captured = captured;
+
+	/* The counters are only valid if every port has them */
+	for (p = 0; p < FORMAT(trace)->nb_pktio; p++) {
+		if (odp_pktio_stats(FORMAT(trace)->pktio[p], &pktio_stats) != 0)
+			return;
+		/* Discards are packets the NIC had no buffer for */
+		dropped += pktio_stats.in_discards;
+		errors += pktio_stats.in_errors;
+		received += pktio_stats.in_ucast_pkts + pktio_stats.in_discards;
+	}
+
+	stats->dropped_valid = true;
+	stats->dropped = dropped;
+
+	stats->errors_valid = true;
+	stats->errors = errors;
+
+	stats->received_valid = true;
+	stats->received = received;
+}
+
+/**
+ * Fills in the statistics of a single perpkt thread. ODP does not keep
+ * statistics per pktin queue so only the packets the thread has read from
+ * its stream are known.
+ */
+static void lodp_get_thread_stats(libtrace_t *trace UNUSED,
+                                  libtrace_thread_t *t,
+                                  libtrace_stat_t *stats)
+{
+	odp_per_stream_t *stream = t->format_data;
+
+	if (stream == NULL)
+		return;
+
+	stats->captured_valid = true;
+	stats->captured = stream->pkts_read;
 }
 
 /* <== *** ==> */
+static libtrace_eventobj_t lodp_trace_event(libtrace_t *trace,
+                                            libtrace_packet_t *packet)
+{
+	libtrace_eventobj_t event = {0,0,0.0,0};
+	int nb_rx; /* Number of receive packets we've read */
+
+	do {
+		/* Refill the burst without waiting, read_packet shares it */
+		if (FORMAT(trace)->burst_offset == FORMAT(trace)->burst_size) {
+			nb_rx = lodp_recv_burst(FORMAT(trace),
+			                        FORMAT_DATA_FIRST(trace),
+			                        FORMAT(trace)->burst_pkts,
+			                        BURST_SIZE, 0);
+			if (nb_rx < 0) {
+				trace_set_err(trace, TRACE_ERR_BAD_PACKET,
+				              "Receiving a burst failed");
+				event.type = TRACE_EVENT_TERMINATE;
+				break;
+			}
+			if (nb_rx == 0) {
+				/* We only want to sleep for a very short time - we are non-blocking */
+				event.type = TRACE_EVENT_SLEEP;
+				event.seconds = 0.0001;
+				event.size = 0;
+				break;
+			}
+			lodp_ready_pkts(FORMAT(trace), FORMAT_DATA_FIRST(trace),
+			                FORMAT(trace)->burst_pkts, nb_rx);
+			FORMAT_DATA_FIRST(trace)->pkts_read += nb_rx;
+			FORMAT(trace)->pkts_read += nb_rx;
+			FORMAT(trace)->burst_size = nb_rx;
+			FORMAT(trace)->burst_offset = 0;
+		}
+
+		/* The last packet was finished by trace_event() */
+		packet->trace = trace;
+		packet->buf_control = TRACE_CTRL_EXTERNAL;
+		packet->type = TRACE_RT_DATA_ODP;
+		packet->buffer = FORMAT(trace)->burst_pkts[FORMAT(trace)->burst_offset++];
+		lodp_prepare_packet(trace, packet, packet->buffer, packet->type, 0);
+		event.type = TRACE_EVENT_PACKET;
+		event.size = odp_packet_len((odp_packet_t) packet->buffer);
+
+		/* trace_read_packet() normally applies the filter for us */
+		if (trace->filter) {
+			if (!trace_apply_filter(trace->filter, packet)) {
+				/* Failed the filter so we loop for another packet */
+				trace->filtered_packets ++;
+				trace_fin_packet(packet);
+				continue;
+			}
+		}
+		trace->accepted_packets ++;
+
+		/* If we get here we have our event */
+		break;
+	} while (1);
+
+	return event;
+}
+
 static void lodp_help(void)
 {
 	printf("Endace ODP format module\n");
 	printf("Supported input uris:\n");
-	printf("\todp:/path/to/input/file\n");
+	printf("\todp:<domain:bus:devid.func>\n");
+	printf("\t e.g. odp:0000:01:00.1\n");
+	printf("\todp:<option>=<value>[,<option>=<value>...]\n");
+	printf("\t e.g. odp:port=1,queues=8,pool=65536\n");
+	printf("\n");
+	printf("Supported options:\n");
+	printf("\tport=<name>\tThe pktio to open, default 0. Repeat it to"
+	       " capture\n");
+	printf("\t\t\tfrom several ports, the direction of a packet is"
+	       " then the\n");
+	printf("\t\t\tindex of the port it arrived on\n");
+	printf("\tpci=<domain:bus:devid.func>\tWhitelist this device, can be"
+	       " repeated\n");
+	printf("\tqueues=<n>\tThe most RX queues (threads) to use\n");
+	printf("\tpool=<n>\tPackets in the pool, default sized to the"
+	       " trace\n");
+	printf("\tbufsize=<n>\tBytes in each packet buffer, default %d\n",
+	       SHM_PKT_POOL_BUF_SIZE);
+	printf("\tsocket=<n>\tThe NUMA socket to take memory from\n");
+	printf("\tmode=<sched|direct>\tHow packets are received\n");
+	printf("\n");
+	printf("ODP itself is initialised by the first odp trace, the pci and"
+	       " socket of\n");
+	printf("later traces in the same process are ignored.\n");
+	printf("With mode=sched, a filter of a single tcp, udp or icmp"
+	       " primitive, or\n");
+	printf("tcp or udp followed by [src|dst] port <n>, is also given to"
+	       " the ODP\n");
+	printf("classifier to drop packets early. Every packet is still"
+	       " checked against\n");
+	printf("the filter by libtrace.\n");
 	printf("Supported output uris:\n");
-	printf("\todp:/path/to/output/file\n");
+	printf("\tSame format as the input URI.\n");
+	printf("\t Packets read from an odp input are sent by reference"
+	       " without a copy,\n");
+	printf("\t the packet written is left unchanged.\n");
+	printf("\t Packets are sent in bursts, a partial burst is sent by"
+	       " the next write\n");
+	printf("\t once it is %dus old, or when the output is closed.\n",
+	       TX_FLUSH_NS / 1000);
 	printf("\n");
 	return;
 }
@@ -711,11 +2078,11 @@ static struct libtrace_format_t lodp = {
 	NULL,				/* probe filename - guess capture format - NOT NEEDED*/
 	NULL,				/* probe magic - NOT NEEDED*/
         lodp_init_input,	        /* init_input - Initialises an input trace using the capture format */
-        NULL,                           /* config_input - Sets value to some option */
+        lodp_config_input,              /* config_input - Sets value to some option */
         lodp_start_input,	        /* start_input-Starts or unpause an input trace (also opens file or device for reading)*/
-        NULL,                           /* pause_input */
+        lodp_pause_input,               /* pause_input */
         lodp_init_output,               /* init_output - Initialises an output trace using the capture format. */
-        lodp_config_output,             /* config_output */
+        NULL,                           /* config_output */
         lodp_start_output,              /* start_output */
         lodp_fin_input,	               	/* fin_input - Stops capture input data.*/
         lodp_fin_output,                /* fin_output */
@@ -724,28 +2091,35 @@ static struct libtrace_format_t lodp = {
 	lodp_fin_packet,                /* fin_packet - Frees any resources allocated for a libtrace packet */
         lodp_write_packet,              /* write_packet - Write a libtrace packet to an output trace */
         lodp_get_link_type,    		/* get_link_type - Returns the libtrace link type for a packet */
-        NULL,              		/* get_direction */
-        NULL,              		/* set_direction */
-        NULL,          			/* get_erf_timestamp */
-        NULL,                           /* get_timeval */
-	NULL,				/* get_timespec */
-        lodp_get_seconds,               /* get_seconds */
+        lodp_get_direction,             /* get_direction */
+        lodp_set_direction,             /* set_direction */
+        lodp_get_erf_timestamp,         /* get_erf_timestamp */
+        lodp_get_timeval,               /* get_timeval */
+        lodp_get_timespec,              /* get_timespec */
+        NULL,                           /* get_seconds */
         NULL,                   	/* seek_erf */
         NULL,                           /* seek_timeval */
         NULL,                           /* seek_seconds */
         lodp_get_capture_length,  	/* get_capture_length */
         lodp_get_wire_length,  		/* get_wire_length */
         lodp_get_framing_length, 	/* get_framing_length */
-        NULL,         			/* set_capture_length */
+        lodp_set_capture_length,        /* set_capture_length */
 	NULL,				/* get_received_packets */
 	NULL,				/* get_filtered_packets */
 	NULL,				/* get_dropped_packets */
-	NULL,				/* get_statistics */
+        lodp_get_stats,                 /* get_statistics */
         NULL,                           /* get_fd */
-        NULL,              		/* trace_event */
+        lodp_trace_event,      		/* trace_event */
         lodp_help,                     	/* help */
         NULL,                            /* next pointer */
-        NON_PARALLEL(false)
+        {true, 8},                      /* Live, NICs typically have 8 queues */
+        lodp_pstart_input,              /* pstart_input */
+        lodp_pread_packets,             /* pread_packets */
+        lodp_pause_input,               /* ppause */
+        lodp_fin_input,                 /* p_fin */
+        lodp_pregister_thread,          /* pregister_thread */
+        lodp_punregister_thread,        /* punregister_thread */
+        lodp_get_thread_stats           /* get thread stats */
 };
 
 void odp_constructor(void) 
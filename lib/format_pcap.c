@@ -389,7 +389,7 @@ static int pcap_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 	
 	if (packet->buffer != buffer &&
 			packet->buf_control == TRACE_CTRL_PACKET) {
-			free(packet->buffer);
+			libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -427,7 +427,8 @@ static int pcap_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	 * make sure we have a buffer to *shudder* memcpy into 
 	 */
 	if (!packet->buffer) {
-		packet->buffer = malloc(LIBTRACE_PACKET_BUFSIZE);
+		packet->buffer = libtrace_buffer_pool_alloc(
+				LIBTRACE_PACKET_BUFSIZE);
 		if (!packet->buffer) {
 			trace_set_err(libtrace, errno, 
 					"Cannot allocate memory");
@@ -71,6 +71,15 @@ typedef struct pcapfile_header_t {
 		uint32_t network;        /* data link type */
 } pcapfile_header_t;
 
+/* How far ahead of the packet being read a mapped trace is prefetched, and
+ * how often the prefetch window is moved along */
+#define MAP_PREFETCH_AHEAD (16 * 1024 * 1024)
+#define MAP_PREFETCH_STEP (4 * 1024 * 1024)
+
+/* The largest gap in seconds between neighbouring packets that is
+ * considered plausible when resynchronising to a packet boundary */
+#define RESYNC_MAX_GAP 3600
+
 #define MAGIC1      0xa1b2c3d4  /* Original */
 #define MAGIC2      0xa1b23c4d  /* Newer nanosecond format */
 #define MAGIC1_REV  0xd4c3b2a1  /* Reversed byteorder detection */
@@ -101,6 +110,19 @@ struct pcapfile_format_data_t {
 	pcapfile_header_t header;
 	/* Indicates whether the input trace is started */
 	bool started;
+
+	/* An uncompressed trace file is mapped rather than read through
+	 * libtrace->io and packets point straight into the mapping */
+	char *map;
+	size_t map_len;
+	/* The offset of the next packet header in the mapping */
+	size_t map_offset;
+	/* The offset at which the prefetch window is next moved */
+	size_t map_prefetch;
+	/* Splits the mapping between threads when reading in parallel */
+	struct trace_map_reader reader;
+	/* Reads a trace that could not be mapped */
+	struct trace_record_reader block_reader;
 };
 
 struct pcapfile_format_data_out_t {
@@ -140,6 +162,12 @@ static int pcapfile_init_input(libtrace_t *libtrace) {
 
 	IN_OPTIONS.real_time = 0;
 	DATA(libtrace)->started = false;
+	DATA(libtrace)->map = NULL;
+	DATA(libtrace)->map_len = 0;
+	DATA(libtrace)->map_offset = 0;
+	DATA(libtrace)->map_prefetch = 0;
+	DATA(libtrace)->reader.boundaries = NULL;
+	trace_record_reader_init(&DATA(libtrace)->block_reader);
 	return 0;
 }
 
@@ -187,23 +215,60 @@ static inline uint32_t swapl(libtrace_t *libtrace, uint32_t num)
 }
 
 
+/* Maps the trace if it is an uncompressed file, the header is read from the
+ * mapping and libtrace->io is no longer needed. Anything else, e.g. a
+ * compressed file or a pipe, is left to be read through libtrace->io. */
+static void pcapfile_map_input(libtrace_t *libtrace)
+{
+	pcapfile_header_t *header;
+	size_t len;
+	char *map = trace_map_file(libtrace, &len);
+
+	if (!map)
+		return;
+	header = (pcapfile_header_t *) map;
+	if (len < sizeof(*header) || !header_is_magic(header)) {
+		trace_unmap_file(map, len);
+		return;
+	}
+
+	DATA(libtrace)->map = map;
+	DATA(libtrace)->map_len = len;
+	DATA(libtrace)->map_offset = sizeof(*header);
+	DATA(libtrace)->map_prefetch = 0;
+	if (libtrace->io) {
+		wandio_destroy(libtrace->io);
+		libtrace->io = NULL;
+	}
+}
+
 static int pcapfile_start_input(libtrace_t *libtrace) 
 {
 	int err;
 
-	if (!libtrace->io) {
+	if (!DATA(libtrace)->started && !DATA(libtrace)->map)
+		pcapfile_map_input(libtrace);
+
+	if (!libtrace->io && !DATA(libtrace)->map) {
 		libtrace->io=trace_open_file(libtrace);
 		DATA(libtrace)->started=false;
 	}
 
 	if (!DATA(libtrace)->started) {
 
-		if (!libtrace->io)
-			return -1;
+		if (DATA(libtrace)->map) {
+			/* pcapfile_map_input() made sure this much is mapped */
+			memcpy(&DATA(libtrace)->header, DATA(libtrace)->map,
+					sizeof(DATA(libtrace)->header));
+			err = sizeof(DATA(libtrace)->header);
+		} else {
+			if (!libtrace->io)
+				return -1;
 
-		err=wandio_read(libtrace->io,
-				&DATA(libtrace)->header,
-				sizeof(DATA(libtrace)->header));
+			err=wandio_read(libtrace->io,
+					&DATA(libtrace)->header,
+					sizeof(DATA(libtrace)->header));
+		}
 
 		DATA(libtrace)->started = true;
 		assert(sizeof(DATA(libtrace)->header) > 0);
@@ -263,10 +328,14 @@ static int pcapfile_config_input(libtrace_t *libtrace,
 		case TRACE_OPTION_SNAPLEN:
 		case TRACE_OPTION_PROMISC:
 		case TRACE_OPTION_FILTER:
-		case TRACE_OPTION_HASHER:
 			/* All these are either unsupported or handled
 			 * by trace_config */
 			break;
+		case TRACE_OPTION_HASHER:
+			/* Packets are split between threads by where they
+			 * are in the file. Don't set an error, libtrace will
+			 * hash the packets itself. */
+			return -1;
 	}
 	
 	trace_set_err(libtrace,TRACE_ERR_UNKNOWN_OPTION,
@@ -278,6 +347,10 @@ static int pcapfile_fin_input(libtrace_t *libtrace)
 {
 	if (libtrace->io)
 		wandio_destroy(libtrace->io);
+	if (DATA(libtrace)->map)
+		trace_unmap_file(DATA(libtrace)->map, DATA(libtrace)->map_len);
+	trace_map_reader_destroy(&DATA(libtrace)->reader);
+	trace_record_reader_destroy(&DATA(libtrace)->block_reader);
 	free(libtrace->format_data);
 	return 0; /* success */
 }
@@ -320,7 +393,7 @@ static int pcapfile_prepare_packet(libtrace_t *libtrace,
 
 	if (packet->buffer != buffer && 
 			packet->buf_control == TRACE_CTRL_PACKET) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 
 	if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -343,28 +416,75 @@ static int pcapfile_prepare_packet(libtrace_t *libtrace,
 	return 0;
 }
 
+/* Reads a packet from a mapped trace without copying it, the packet buffer
+ * is left pointing into the mapping */
+static int pcapfile_read_mapped_packet(libtrace_t *libtrace,
+		libtrace_packet_t *packet)
+{
+	struct pcapfile_format_data_t *data = DATA(libtrace);
+	libtrace_pcapfile_pkt_hdr_t *hdr;
+	size_t remaining = data->map_len - data->map_offset;
+	size_t bytes_to_read;
+
+	if (remaining == 0) {
+		/* EOF */
+		return 0;
+	}
+	if (remaining < sizeof(*hdr)) {
+		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+				"Incomplete pcap packet header");
+		return -1;
+	}
+
+	/* The records are not necessarily aligned, so neither is hdr */
+	hdr = (libtrace_pcapfile_pkt_hdr_t *)(data->map + data->map_offset);
+	bytes_to_read = swapl(libtrace, hdr->caplen);
+
+	if (bytes_to_read >= LIBTRACE_PACKET_BUFSIZE) {
+		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Invalid caplen in pcap header (%u) - trace may be corrupt", (uint32_t)bytes_to_read);
+		return -1;
+	}
+	if (remaining - sizeof(*hdr) < bytes_to_read) {
+		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+				"Incomplete pcap packet body");
+		return -1;
+	}
+
+	if (data->map_offset >= data->map_prefetch) {
+		trace_map_file_prefetch(data->map, data->map_len,
+				data->map_offset, MAP_PREFETCH_AHEAD);
+		data->map_prefetch = data->map_offset + MAP_PREFETCH_STEP;
+	}
+
+	if (pcapfile_prepare_packet(libtrace, packet, hdr, packet->type,
+				TRACE_PREP_DO_NOT_OWN_BUFFER)) {
+		return -1;
+	}
+	data->map_offset += sizeof(*hdr) + bytes_to_read;
+
+	packet->capture_length = bytes_to_read;
+	return sizeof(*hdr) + bytes_to_read;
+}
+
 static int pcapfile_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 {
 	int err;
-	uint32_t flags = 0;
 	size_t bytes_to_read = 0;
+	libtrace_pcapfile_pkt_hdr_t *hdr;
+	void *record;
 
 	assert(libtrace->format_data);
 
 	packet->type = pcap_linktype_to_rt(swapl(libtrace,
 				DATA(libtrace)->header.network));
 
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-	}
+	if (DATA(libtrace)->map)
+		return pcapfile_read_mapped_packet(libtrace, packet);
 
-	flags |= TRACE_PREP_OWN_BUFFER;
-	
-	err=wandio_read(libtrace->io,
-			packet->buffer,
-			sizeof(libtrace_pcapfile_pkt_hdr_t));
+	/* Read the header first, so we know how long the record is */
+	err = trace_record_reader_peek(libtrace, &DATA(libtrace)->block_reader,
+			sizeof(*hdr), &record);
 	if (err<0) {
-		trace_set_err(libtrace,errno,"reading packet");
 		return -1;
 	}
 	if (err==0) {
@@ -373,11 +493,12 @@ static int pcapfile_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 	}
 
         if (err < (int)sizeof(libtrace_pcapfile_pkt_hdr_t)) {
-                trace_set_err(libtrace, errno, "Incomplete pcap packet header");
+                trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Incomplete pcap packet header");
                 return -1;
         }
 
-	bytes_to_read = swapl(libtrace,((libtrace_pcapfile_pkt_hdr_t*)packet->buffer)->caplen);
+	hdr = (libtrace_pcapfile_pkt_hdr_t *) record;
+	bytes_to_read = swapl(libtrace,hdr->caplen);
 
 	if (bytes_to_read >= LIBTRACE_PACKET_BUFSIZE) {
 		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Invalid caplen in pcap header (%u) - trace may be corrupt", (uint32_t)bytes_to_read);
@@ -386,36 +507,28 @@ static int pcapfile_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 
 	assert(bytes_to_read < LIBTRACE_PACKET_BUFSIZE);
 
-	/* If there is no payload to read, do not ask wandio_read to try and
-	 * read zero bytes - we'll just get back a zero that we will 
-	 * misinterpret as EOF! */
-	if (bytes_to_read == 0) {
-		packet->header = packet->buffer;
-		return sizeof(libtrace_pcapfile_pkt_hdr_t);
-	}
-
-	err=wandio_read(libtrace->io,
-			(char*)packet->buffer+sizeof(libtrace_pcapfile_pkt_hdr_t),
-			(size_t)swapl(libtrace,((libtrace_pcapfile_pkt_hdr_t*)packet->buffer)->caplen)
-			);
-
+	/* The record may have been moved to make room for the body */
+	err = trace_record_reader_peek(libtrace, &DATA(libtrace)->block_reader,
+			sizeof(*hdr) + bytes_to_read, &record);
 	if (err<0) {
-		trace_set_err(libtrace,errno,"reading packet");
 		return -1;
 	}
-	if (err==0) {
+	if (err == (int)sizeof(*hdr) && bytes_to_read > 0) {
+		/* The trace ends after the header */
 		return 0;
 	}
 
-        if (err < (int)bytes_to_read) {
-                trace_set_err(libtrace, errno, "Incomplete pcap packet body");
+        if (err < (int)(sizeof(*hdr) + bytes_to_read)) {
+                trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Incomplete pcap packet body");
                 return -1;
         }
 
-	if (pcapfile_prepare_packet(libtrace, packet, packet->buffer,
-				packet->type, flags)) {
+	if (pcapfile_prepare_packet(libtrace, packet, record,
+				packet->type, TRACE_PREP_DO_NOT_OWN_BUFFER)) {
 		return -1;
 	}
+	trace_record_reader_claim(&DATA(libtrace)->block_reader, packet,
+			sizeof(*hdr) + bytes_to_read);
 
 	/* We may as well cache this value now, seeing as we already had to 
 	 * look it up */
@@ -423,6 +536,103 @@ static int pcapfile_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 	return sizeof(libtrace_pcapfile_pkt_hdr_t) + bytes_to_read;
 }
 
+static size_t pcapfile_record_length(libtrace_t *libtrace, const char *record,
+		size_t avail)
+{
+	const libtrace_pcapfile_pkt_hdr_t *hdr =
+		(const libtrace_pcapfile_pkt_hdr_t *) record;
+	uint32_t caplen;
+
+	if (avail < sizeof(*hdr))
+		return 0;
+	caplen = swapl(libtrace, hdr->caplen);
+	if (caplen >= LIBTRACE_PACKET_BUFSIZE)
+		return 0;
+	return sizeof(*hdr) + caplen;
+}
+
+static bool pcapfile_record_plausible(libtrace_t *libtrace, const char *record,
+		const char *prev)
+{
+	const libtrace_pcapfile_pkt_hdr_t *hdr =
+		(const libtrace_pcapfile_pkt_hdr_t *) record;
+	uint32_t caplen = swapl(libtrace, hdr->caplen);
+	uint32_t snaplen = swapl(libtrace, DATA(libtrace)->header.snaplen);
+	uint32_t ts_max = trace_in_nanoseconds(&DATA(libtrace)->header) ?
+		1000000000 : 1000000;
+
+	if (caplen > swapl(libtrace, hdr->wirelen))
+		return false;
+	if (snaplen != 0 && caplen > snaplen)
+		return false;
+	if (swapl(libtrace, hdr->ts_usec) >= ts_max)
+		return false;
+	if (prev) {
+		const libtrace_pcapfile_pkt_hdr_t *phdr =
+			(const libtrace_pcapfile_pkt_hdr_t *) prev;
+		int64_t gap = (int64_t) swapl(libtrace, hdr->ts_sec) -
+			(int64_t) swapl(libtrace, phdr->ts_sec);
+
+		if (gap > RESYNC_MAX_GAP || gap < -RESYNC_MAX_GAP)
+			return false;
+	}
+	return true;
+}
+
+/* Only a mapped trace can be read in parallel. Anything else fails here
+ * without an error, so the trace is started with pcapfile_start_input()
+ * and is read by one thread at a time. */
+static int pcapfile_pstart_input(libtrace_t *libtrace)
+{
+	if (!DATA(libtrace)->started && !DATA(libtrace)->map)
+		pcapfile_map_input(libtrace);
+	if (!DATA(libtrace)->map)
+		return -1;
+	if (DATA(libtrace)->started)
+		return 0;	/* Resuming after a pause */
+
+	if (pcapfile_start_input(libtrace))
+		return -1;
+	return trace_map_reader_init(libtrace, &DATA(libtrace)->reader,
+			DATA(libtrace)->map, DATA(libtrace)->map_len,
+			DATA(libtrace)->map_offset, pcapfile_record_length,
+			pcapfile_record_plausible);
+}
+
+static int pcapfile_pread_packets(libtrace_t *libtrace, libtrace_thread_t *t,
+		libtrace_packet_t *packets[], size_t nb_packets)
+{
+	libtrace_rt_types_t type = pcap_linktype_to_rt(swapl(libtrace,
+				DATA(libtrace)->header.network));
+	size_t i, offset;
+	int len = 0;
+
+	for (i = 0; i < nb_packets; i++) {
+		len = trace_map_reader_next(libtrace, &DATA(libtrace)->reader,
+				t, &offset);
+		if (len <= 0)
+			break;
+
+		packets[i]->trace = libtrace;
+		if (pcapfile_prepare_packet(libtrace, packets[i],
+					DATA(libtrace)->map + offset, type,
+					TRACE_PREP_DO_NOT_OWN_BUFFER)) {
+			len = -1;
+			break;
+		}
+		packets[i]->capture_length = len -
+			sizeof(libtrace_pcapfile_pkt_hdr_t);
+		packets[i]->error = len;
+		/* Keeps the packets in the same order as the file */
+		trace_packet_set_order(packets[i], offset);
+	}
+
+	/* Return what was read, the EOF or error will be seen next time */
+	if (i > 0)
+		return i;
+	return len;
+}
+
 static int pcapfile_write_packet(libtrace_out_t *out,
 		libtrace_packet_t *packet)
 {
@@ -787,7 +997,14 @@ static struct libtrace_format_t pcapfile = {
 	pcapfile_event,		/* trace_event */
 	pcapfile_help,			/* help */
 	NULL,			/* next pointer */
-	NON_PARALLEL(false)
+	{false, -1},			/* Not live, no thread limit */
+	pcapfile_pstart_input,		/* pstart_input */
+	pcapfile_pread_packets,		/* pread_packets */
+	NULL,				/* ppause_input */
+	pcapfile_fin_input,		/* pfin_input */
+	trace_map_pregister_thread,	/* pregister_thread */
+	trace_map_punregister_thread,	/* punregister_thread */
+	NULL				/* get_thread_statistics */
 };
 
 
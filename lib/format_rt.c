@@ -594,7 +594,7 @@ static int rt_get_next_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
         rt_header_t *rthdr;
 
         if (packet->buffer && packet->buf_control == TRACE_CTRL_PACKET)
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
 
         while (RT_INFO->buf_write - RT_INFO->buf_read <
                                 (uint32_t)sizeof(rt_header_t)) {
@@ -661,7 +661,7 @@ static int rt_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 
 	if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
         if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
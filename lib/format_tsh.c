@@ -52,11 +52,21 @@
 
 static struct libtrace_format_t tshformat;
 
+#define DATA(x) ((struct tsh_format_data_t *)x->format_data)
+
 typedef struct tsh_pkt_header_t {
 	uint32_t seconds;
 	uint32_t usecs;
 } tsh_pkt_header_t;
 
+/* The TSH header, the IP header and 16 bytes of transport header */
+#define TSH_RECORD_LEN (sizeof(tsh_pkt_header_t) + sizeof(libtrace_ip_t) + 16)
+
+struct tsh_format_data_t {
+	/* Reads the records from libtrace->io */
+	struct trace_record_reader block_reader;
+};
+
 static int tsh_get_framing_length(const libtrace_packet_t *packet UNUSED)
 {
 	return sizeof(tsh_pkt_header_t);
@@ -65,7 +75,12 @@ static int tsh_get_framing_length(const libtrace_packet_t *packet UNUSED)
 
 static int tsh_init_input(libtrace_t *libtrace) 
 {
-	libtrace->format_data = NULL; /* No format data */
+	libtrace->format_data = malloc(sizeof(struct tsh_format_data_t));
+	if (!libtrace->format_data) {
+		trace_set_err(libtrace, ENOMEM, "Out of memory");
+		return -1;
+	}
+	trace_record_reader_init(&DATA(libtrace)->block_reader);
 	
 	return 0; /* success */
 }
@@ -86,6 +101,10 @@ static int tsh_start_input(libtrace_t *libtrace)
 static int tsh_fin_input(libtrace_t *libtrace) {
 	if (libtrace->io)
 		wandio_destroy(libtrace->io);
+	if (libtrace->format_data) {
+		trace_record_reader_destroy(&DATA(libtrace)->block_reader);
+		free(libtrace->format_data);
+	}
 	return 0;
 }
 
@@ -93,7 +112,7 @@ static int tsh_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 		void *buffer, libtrace_rt_types_t rt_type, uint32_t flags) {
 	if (packet->buffer != buffer &&
                         packet->buf_control == TRACE_CTRL_PACKET) {
-                free(packet->buffer);
+                libtrace_buffer_pool_free(packet->buffer);
         }
 
         if ((flags & TRACE_PREP_OWN_BUFFER) == TRACE_PREP_OWN_BUFFER) {
@@ -117,29 +136,15 @@ static int tsh_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
 
 static int tsh_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	int numbytes;
-	void *buffer2 = packet->buffer;
-	uint32_t flags = 0;
-
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-		packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-		if (!packet->buffer) {
-			trace_set_err(libtrace, errno, 
-					"Cannot allocate memory");
-			return -1;
-		}
-	}
+	void *record;
 
-	flags |= TRACE_PREP_OWN_BUFFER;
 	packet->type = TRACE_RT_DATA_TSH;
 
-	buffer2 = packet->buffer;
-
-	/* Read the TSH header */
-	if ((numbytes=wandio_read(libtrace->io,
-					buffer2,
-					(size_t)sizeof(tsh_pkt_header_t))) == -1) {
-		trace_set_err(libtrace,errno,"read(%s)",
-				libtrace->uridata);
+	/* Read the TSH header, the IP header and 16 bytes of transport
+	 * header. IP Options aren't captured in the trace. */
+	if ((numbytes=trace_record_reader_peek(libtrace,
+					&DATA(libtrace)->block_reader,
+					TSH_RECORD_LEN, &record)) == -1) {
 		return -1;
 	}
 	/* EOF */
@@ -148,42 +153,22 @@ static int tsh_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 	}
 
         if (numbytes < (int)sizeof(tsh_pkt_header_t)) {
-                trace_set_err(libtrace, errno, "Incomplete TSH header");
+                trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Incomplete TSH header");
                 return -1;
         }
 
-	buffer2 = (char*)buffer2 + numbytes;
-
-	/* Read the IP header */
-	if ((numbytes=wandio_read(libtrace->io,
-				buffer2,
-				(size_t)sizeof(libtrace_ip_t)+16))  /* 16 bytes of transport header */
-			!= sizeof(libtrace_ip_t)+16) {
-		trace_set_err(libtrace,errno,"read(%s)",
-				libtrace->uridata);
+	if (numbytes != (int)TSH_RECORD_LEN) {
+		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+				"Incomplete TSH record");
 		return -1;
 	}
 
-#if 0
-	/* IP Options aren't captured in the trace, so leave room
-	 * for them, and put the transport header where it "should" be
-	 */
-	buffer2 = (char*)buffer2 + ((libtrace_ip_t*)buffer2)->ip_hl*4;
-
-	/* Read the transport header */
-	if ((numbytes=wandio_read(libtrace->io,
-				buffer2,
-				16)) != 16) {
-		trace_set_err(libtrace,errno,"read(%s)",
-				libtrace->uridata);
-		return -1;
-	}
-#endif
-	
-	if (tsh_prepare_packet(libtrace, packet, packet->buffer, packet->type, 
-				flags)) {
+	if (tsh_prepare_packet(libtrace, packet, record, packet->type, 
+				TRACE_PREP_DO_NOT_OWN_BUFFER)) {
 		return -1;
 	}
+	trace_record_reader_claim(&DATA(libtrace)->block_reader, packet,
+			TSH_RECORD_LEN);
 
 
 	return 80;
@@ -0,0 +1,220 @@
+/**
+ * A fast hash for spreading flows across threads in software.
+ *
+ * Rather than going through the generic protocol decoders we parse the
+ * Ethernet, VLAN and IP headers directly, falling back to
+ * trace_get_layer3() for other link types. The addresses and ports are
+ * ordered so both directions of a flow give the same tuple, which is
+ * hashed with CRC32C where SSE4.2 is available, otherwise a
+ * multiply-shift hash.
+ */
+#include "hash_fast.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define FAST_HASH_CRC32C 1
+#include <cpuid.h>
+#include <nmmintrin.h>
+#endif
+
+#define FAST_HASH_SEED 0x9E3779B97F4A7C15ULL
+
+/* Stop after this many IPv6 extension headers */
+#define MAX_IPV6_EXT 4
+
+static uint64_t hash_words_select(const uint64_t *words, int nb_words);
+static uint64_t (*hash_words)(const uint64_t *, int) = hash_words_select;
+
+static uint64_t hash_words_mul(const uint64_t *words, int nb_words) {
+	uint64_t h = FAST_HASH_SEED;
+	int i;
+
+	for (i = 0; i < nb_words; i++) {
+		h ^= words[i] * 0x87C37B91114253D5ULL;
+		h = (h << 27 | h >> 37) * 0xC2B2AE3D27D4EB4FULL;
+	}
+	/* Mix so the low bits, which choose the thread, depend on them all */
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+#ifdef FAST_HASH_CRC32C
+__attribute__((target("sse4.2")))
+static uint64_t hash_words_crc32c(const uint64_t *words, int nb_words) {
+	uint32_t h = (uint32_t) FAST_HASH_SEED;
+	int i;
+
+	for (i = 0; i < nb_words; i++) {
+#ifdef __x86_64__
+		h = (uint32_t) _mm_crc32_u64(h, words[i]);
+#else
+		h = _mm_crc32_u32(h, (uint32_t) words[i]);
+		h = _mm_crc32_u32(h, (uint32_t) (words[i] >> 32));
+#endif
+	}
+	return h;
+}
+#endif
+
+/* Picks the hash on first use, every thread picks the same one */
+static uint64_t hash_words_select(const uint64_t *words, int nb_words) {
+#ifdef FAST_HASH_CRC32C
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2))
+		hash_words = hash_words_crc32c;
+	else
+#endif
+		hash_words = hash_words_mul;
+	return hash_words(words, nb_words);
+}
+
+static inline int has_ports(uint8_t proto) {
+	return proto == TRACE_IPPROTO_TCP || proto == TRACE_IPPROTO_UDP ||
+		proto == TRACE_IPPROTO_SCTP;
+}
+
+/* Both directions of a flow must give the same word */
+static inline uint64_t ports_word(uint16_t lo_port, uint16_t hi_port, uint8_t proto) {
+	return (uint64_t) lo_port << 32 | (uint64_t) hi_port << 16 | proto;
+}
+
+static uint64_t hash_ipv4(const uint8_t *ip, uint32_t remaining) {
+	uint32_t src, dst, tmp_ip;
+	uint16_t sport = 0, dport = 0, tmp_port;
+	uint32_t hl;
+	uint64_t words[2];
+
+	if (remaining < 20 || (ip[0] >> 4) != 4)
+		return 0;
+	hl = (ip[0] & 0x0F) * 4;
+	memcpy(&src, ip + 12, 4);
+	memcpy(&dst, ip + 16, 4);
+
+	/* Only the first fragment has ports, so ignore them for every
+	 * fragment to keep a fragmented flow together */
+	if (!((ip[6] & 0x3F) || ip[7]) && has_ports(ip[9]) &&
+	    hl >= 20 && remaining >= hl + 4) {
+		memcpy(&sport, ip + hl, 2);
+		memcpy(&dport, ip + hl + 2, 2);
+	}
+
+	if (src > dst || (src == dst && sport > dport)) {
+		tmp_ip = src; src = dst; dst = tmp_ip;
+		tmp_port = sport; sport = dport; dport = tmp_port;
+	}
+	words[0] = (uint64_t) src << 32 | dst;
+	words[1] = ports_word(sport, dport, ip[9]);
+	return hash_words(words, 2);
+}
+
+static uint64_t hash_ipv6(const uint8_t *ip, uint32_t remaining) {
+	const uint8_t *src = ip + 8, *dst = ip + 24, *tmp_ip;
+	const uint8_t *next;
+	uint16_t sport = 0, dport = 0, tmp_port;
+	uint8_t proto;
+	uint32_t len;
+	uint64_t words[5];
+	int i, cmp;
+
+	if (remaining < 40 || (ip[0] >> 4) != 6)
+		return 0;
+	proto = ip[6];
+	next = ip + 40;
+	remaining -= 40;
+
+	/* Skip hop-by-hop, routing and destination options, we stop at a
+	 * fragment header so fragments are hashed without ports */
+	for (i = 0; i < MAX_IPV6_EXT; i++) {
+		if (proto != 0 /* hop by hop options */ &&
+		    proto != TRACE_IPPROTO_ROUTING &&
+		    proto != TRACE_IPPROTO_DSTOPTS)
+			break;
+		if (remaining < 8)
+			break;
+		len = (next[1] + 1) * 8;
+		if (remaining < len)
+			break;
+		proto = next[0];
+		next += len;
+		remaining -= len;
+	}
+
+	if (has_ports(proto) && remaining >= 4) {
+		memcpy(&sport, next, 2);
+		memcpy(&dport, next + 2, 2);
+	}
+
+	cmp = memcmp(src, dst, 16);
+	if (cmp > 0 || (cmp == 0 && sport > dport)) {
+		tmp_ip = src; src = dst; dst = tmp_ip;
+		tmp_port = sport; sport = dport; dport = tmp_port;
+	}
+	memcpy(&words[0], src, 16);
+	memcpy(&words[2], dst, 16);
+	words[4] = ports_word(sport, dport, proto);
+	return hash_words(words, 5);
+}
+
+/**
+ * Hashes a packet such that both directions of a TCP, UDP or SCTP flow
+ * get the same hash. Other IP packets are hashed by their addresses,
+ * and anything else hashes to 0.
+ *
+ * @param pkt The packet to hash
+ * @param data Unused, this can be passed to trace_set_hasher() as is
+ * @return The hash
+ */
+DLLEXPORT uint64_t fast_hash_packet(const libtrace_packet_t *pkt, void *data UNUSED) {
+	libtrace_linktype_t linktype;
+	uint32_t remaining = 0;
+	uint16_t ethertype = 0;
+	const uint8_t *l3;
+
+	l3 = trace_get_packet_buffer(pkt, &linktype, &remaining);
+	if (!l3)
+		return 0;
+
+	switch (linktype) {
+		case TRACE_TYPE_ETH:
+			if (remaining < 14)
+				return 0;
+			ethertype = l3[12] << 8 | l3[13];
+			l3 += 14;
+			remaining -= 14;
+			while ((ethertype == TRACE_ETHERTYPE_8021Q ||
+			        ethertype == 0x88A8) && remaining >= 4) {
+				ethertype = l3[2] << 8 | l3[3];
+				l3 += 4;
+				remaining -= 4;
+			}
+			break;
+		case TRACE_TYPE_NONE:
+			/* Raw IP, the version tells us which */
+			if (remaining < 1)
+				return 0;
+			if ((l3[0] >> 4) == 4)
+				ethertype = TRACE_ETHERTYPE_IP;
+			else if ((l3[0] >> 4) == 6)
+				ethertype = TRACE_ETHERTYPE_IPV6;
+			break;
+		default:
+			l3 = trace_get_layer3(pkt, &ethertype, &remaining);
+			if (!l3)
+				return 0;
+			break;
+	}
+
+	switch (ethertype) {
+		case TRACE_ETHERTYPE_IP:
+			return hash_ipv4(l3, remaining);
+		case TRACE_ETHERTYPE_IPV6:
+			return hash_ipv6(l3, remaining);
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,13 @@
+/**
+ * A fast symmetric flow hash for dispatching packets in software, this is
+ * not compatible with any NIC's RSS hash - see HASHER_FAST
+ */
+#include <stdint.h>
+#include <libtrace.h>
+
+#ifndef HASH_FAST_H
+#define HASH_FAST_H
+
+DLLEXPORT uint64_t fast_hash_packet(const libtrace_packet_t *pkt, void *data);
+
+#endif
@@ -10,11 +10,78 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdio.h>
- 
+
+/* The carry-less multiply variant needs the target attribute to build
+ * without -mpclmul, the CPU is checked at runtime */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define TOEPLITZ_CLMUL 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+static uint32_t toeplitz_hash_table(const toeplitz_conf_t *tc, const uint8_t *data, size_t offset, size_t n, uint32_t result);
+static uint32_t (*toeplitz_hash_impl)(const toeplitz_conf_t *, const uint8_t *, size_t, size_t, uint32_t) = toeplitz_hash_table;
+
 static inline uint8_t get_bit(uint8_t byte, size_t num) {
 	return byte & (0x80>>num);
 }
 
+static inline uint8_t reverse_byte(uint8_t b) {
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+#ifdef TOEPLITZ_CLMUL
+/**
+ * Toeplitz as a carry-less multiply, 4 bytes of input at a time.
+ *
+ * Output bit j (from the MSB) is the xor of input bit i with key bit i+j
+ * for every i. Multiplying the input (MSB first) by the key with its
+ * bits reversed lines all of these sums up in bits 31-62 of the product,
+ * in reverse order. Reversing the bits in each byte of that gives the
+ * same byte order as key_cache, which is loaded in host order.
+ */
+__attribute__((target("pclmul,sse2")))
+static uint32_t toeplitz_hash_clmul(const toeplitz_conf_t *tc, const uint8_t *data, size_t offset, size_t n, uint32_t result)
+{
+	__m128i acc = _mm_setzero_si128();
+	uint64_t product;
+	uint64_t key;
+	uint32_t in, res;
+	size_t byte, i;
+
+	for (byte = 0; byte < n; byte += 4) {
+		if (n - byte >= 4) {
+			memcpy(&in, data + byte, 4);
+			in = __builtin_bswap32(in);
+		} else {
+			in = 0;
+			for (i = 0; i < n - byte; i++)
+				in |= (uint32_t) data[byte + i] << (24 - 8 * i);
+		}
+		memcpy(&key, tc->key_rev + offset + byte, 8);
+		acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(
+				_mm_set_epi64x(0, in), _mm_set_epi64x(0, key), 0x00));
+	}
+	_mm_storel_epi64((__m128i *) &product, acc);
+	res = (uint32_t) (product >> 31);
+	res = (res & 0xF0F0F0F0) >> 4 | (res & 0x0F0F0F0F) << 4;
+	res = (res & 0xCCCCCCCC) >> 2 | (res & 0x33333333) << 2;
+	res = (res & 0xAAAAAAAA) >> 1 | (res & 0x55555555) << 1;
+	return result ^ res;
+}
+
+static int cpu_has_clmul(void) {
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ecx & bit_PCLMUL) && (edx & bit_SSE2);
+}
+#endif
+
 /**
  * Takes a key of length 40 bytes == (320bits)
  * and expands it into 320 32 bit ints
@@ -37,6 +104,28 @@ void toeplitz_hash_expand_key(toeplitz_conf_t *conf) {
 		++i;
 	} while (i < 320);
 	free(key_cpy);
+
+	/* Every value of every input byte, so we look up a byte at a time */
+	for (i = 0; i < 40; ++i) {
+		for (j = 0; j < 256; ++j) {
+			size_t bit;
+			uint32_t res = 0;
+			for (bit = 0; bit < 8; ++bit) {
+				if (get_bit(j, bit))
+					res ^= conf->key_cache[i*8 + bit];
+			}
+			conf->byte_cache[i][j] = res;
+		}
+	}
+
+	memset(conf->key_rev, 0, sizeof(conf->key_rev));
+	for (i = 0; i < 40; ++i)
+		conf->key_rev[i] = reverse_byte(conf->key[i]);
+
+#ifdef TOEPLITZ_CLMUL
+	if (cpu_has_clmul())
+		toeplitz_hash_impl = toeplitz_hash_clmul;
+#endif
 }
 
 
@@ -70,7 +159,7 @@ void toeplitz_create_bikey(uint8_t *key) {
 	}
 }
 
-void toeplitz_init_config(toeplitz_conf_t *conf, bool bidirectional)
+DLLEXPORT void toeplitz_init_config(toeplitz_conf_t *conf, bool bidirectional)
 {
 	if (bidirectional) {
 		toeplitz_create_bikey(conf->key);
@@ -80,29 +169,31 @@ void toeplitz_init_config(toeplitz_conf_t *conf, bool bidirectional)
 	toeplitz_hash_expand_key(conf);
 }
 
-/**
- * n is bits
- */
-uint32_t toeplitz_hash(const toeplitz_conf_t *tc, const uint8_t *data, size_t offset, size_t n, uint32_t result)
+/* One lookup per input byte */
+static uint32_t toeplitz_hash_table(const toeplitz_conf_t *tc, const uint8_t *data, size_t offset, size_t n, uint32_t result)
 {
 	size_t byte;
-	size_t bit, i = 0;
-	const uint32_t * key_array = tc->key_cache + offset*8;
 	for (byte = 0; byte < n; ++byte) {
-		for (bit = 0; bit < 8; ++bit,++i) {
-			if (get_bit(data[byte], bit))
-				result ^= key_array[i];
-		}
+		result ^= tc->byte_cache[offset + byte][data[byte]];
 	}
 	return result;
 }
 
+/**
+ * Hashes n bytes of data, which start offset bytes into the tuple being
+ * hashed. Offset and n must fit within the 40 byte key.
+ */
+uint32_t toeplitz_hash(const toeplitz_conf_t *tc, const uint8_t *data, size_t offset, size_t n, uint32_t result)
+{
+	return toeplitz_hash_impl(tc, data, offset, n, result);
+}
+
 uint32_t toeplitz_first_hash(const toeplitz_conf_t *tc, const uint8_t *data, size_t n)
 {
 	return toeplitz_hash(tc, data, 0, n, 0);
 }
 
-uint64_t toeplitz_hash_packet(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf) {
+DLLEXPORT uint64_t toeplitz_hash_packet(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf) {
 	uint8_t proto;
 	uint16_t eth_type;
 	uint32_t remaining;
@@ -24,13 +24,19 @@ typedef struct toeplitz_conf {
 	unsigned int x_hash_udp_ipv6_ex : 1;
 	uint8_t key[40];
 	uint32_t key_cache[320];
+	/* key_cache folded into a table per input byte offset, such that
+	 * byte_cache[i][b] is the hash of byte value b at offset i */
+	uint32_t byte_cache[40][256];
+	/* The key with the bits of each byte reversed, padded so 8 bytes
+	 * can be loaded from any offset, used by the carry-less multiply */
+	uint8_t key_rev[48];
 } toeplitz_conf_t;
 
 void toeplitz_hash_expand_key(toeplitz_conf_t *conf);
 uint32_t toeplitz_hash(const toeplitz_conf_t *tc, const uint8_t *data, size_t offset, size_t n, uint32_t result);
 uint32_t toeplitz_first_hash(const toeplitz_conf_t *tc, const uint8_t *data, size_t n);
-void toeplitz_init_config(toeplitz_conf_t *conf, bool bidirectional);
-uint64_t toeplitz_hash_packet(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf);
+DLLEXPORT void toeplitz_init_config(toeplitz_conf_t *conf, bool bidirectional);
+DLLEXPORT uint64_t toeplitz_hash_packet(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf);
 void toeplitz_create_bikey(uint8_t *key);
 void toeplitz_create_unikey(uint8_t *key);
 
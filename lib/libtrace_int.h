@@ -148,6 +148,9 @@ int snprintf(char *str, size_t size, const char *format, ...);
 #endif
 
 #include "data-struct/ring_buffer.h"
+#include "data-struct/spsc_ring.h"
+#include "data-struct/arena.h"
+#include "data-struct/buffer_pool.h"
 #include "data-struct/object_cache.h"
 #include "data-struct/vector.h"
 #include "data-struct/message_queue.h"
@@ -191,6 +194,17 @@ enum thread_states {
 	THREAD_STATE_MAX
 };
 
+/**
+ * A burst of packets read ahead by a perpkt thread, which an idle thread
+ * can take, see trace_pread_packet_work_stealing
+ */
+struct libtrace_steal_slot {
+	libtrace_packet_t **packets; // burst_size long, NULL terminated if short
+	uint64_t first_order; // The order of packets[0]
+	uint64_t next_order; // Owner only, the least order it may take next
+	int state; // Empty, ready or being taken, claimed with a CAS
+};
+
 /**
  * Information of this thread
  */
@@ -205,7 +219,9 @@ struct libtrace_thread_t {
 	void* user_data; // TLS for the user to use
 	void* format_data; // TLS for the format to use
 	libtrace_message_queue_t messages; // Message handling
-	libtrace_ringbuffer_t rbuffer; // Input
+	libtrace_spsc_ring_t rbuffer; // Input
+	struct libtrace_steal_slot steal; // Packets read ahead, see trace_pread_packet_work_stealing
+	libtrace_arena_t result_arena; // Backs trace_alloc_result_payload()
 	libtrace_t * trace;
 	void* ret;
 	enum thread_types type;
@@ -278,6 +294,7 @@ struct user_configuration {
 	size_t tick_count;
 	size_t perpkt_threads;
 	size_t hasher_queue_size;
+	size_t hasher_threads;
 	bool hasher_polling;
 	bool reporter_polling;
 	size_t reporter_thold;
@@ -338,6 +355,12 @@ struct libtrace_t {
 	enum trace_state state;
 	/** Use to control pausing threads and finishing threads etc always used with libtrace_lock */
 	pthread_cond_t perpkt_cond;
+	/** Held by the perpkt thread reading from a format that cannot read in parallel */
+	pthread_mutex_t read_lock;
+	/** Set once such a read returns EOF or an error, always used with read_lock */
+	bool read_finished;
+	/** The READ_EOF or READ_ERROR that finished the read */
+	int read_result;
 	/** Keeps track of counts of threads in any given state */
 	int perpkt_thread_states[THREAD_STATE_MAX]; 
 
@@ -383,6 +406,7 @@ struct libtrace_t {
 #define LIBTRACE_STAT_MAGIC 0x41
 
 void trace_fin_packet(libtrace_packet_t *packet);
+void *trace_reserve_packet_buffer(libtrace_packet_t *packet, size_t size);
 void libtrace_zero_thread(libtrace_thread_t * t);
 void store_first_packet(libtrace_t *libtrace, libtrace_packet_t *packet, libtrace_thread_t *t);
 libtrace_thread_t * get_thread_table(libtrace_t *libtrace);
@@ -291,7 +291,15 @@ enum hasher_types {
 	 * This value indicates that the hasher is a custom user-defined
          * function. 
 	 */
-	HASHER_CUSTOM
+	HASHER_CUSTOM,
+
+	/** A bi-directional hash like HASHER_BIDIRECTIONAL, however always
+	 * calculated in software by a cheap hash over the 5-tuple rather
+	 * than pushed to the format. The hash is not compatible with any
+	 * NIC's RSS, use this when a NIC cannot hash for us and the
+	 * Toeplitz hash would be the bottleneck.
+	 */
+	HASHER_FAST
 };
 
 typedef struct libtrace_info_t {
@@ -405,6 +413,12 @@ struct libtrace_combine {
 	 * chosen.
 	 */
 	libtrace_generic_t configuration;
+
+	/**
+	 * Receive a burst of results from a processing thread, as per
+	 * publish. If this is NULL publish is called for each in turn.
+	 */
+	void (*publish_bulk)(libtrace_t *, int thread_id, libtrace_combine_t *, libtrace_result_t *, size_t);
 };
 
 /**
@@ -837,6 +851,21 @@ DLLEXPORT int trace_set_thread_cache_size(libtrace_t *trace, size_t size);
  */
 DLLEXPORT int trace_set_fixed_count(libtrace_t *trace, bool fixed);
 
+struct libtrace_ocache_stats;
+
+/** Gets counts of how often empty packets were taken from and returned to
+ * each thread's cache, the shared pool, or neither.
+ *
+ * The structure is defined in data-struct/object_cache.h. Counts are only
+ * kept if libtrace was configured with --enable-memory-debugging.
+ *
+ * @param trace A parallel input trace which has been started
+ * @param stats Filled with the counts, totalled across all threads
+ * @return 0 if successful otherwise -1
+ */
+DLLEXPORT int trace_get_packet_cache_stats(libtrace_t *trace,
+                                           struct libtrace_ocache_stats *stats);
+
 /** The number of packets to batch together for processing internally
  * by libtrace.
  *
@@ -864,6 +893,25 @@ DLLEXPORT int trace_set_burst_size(libtrace_t *trace, size_t size);
  */
 DLLEXPORT int trace_set_hasher_queue_size(libtrace_t *trace, size_t size);
 
+/**
+ * Sets the number of threads used to hash packets when a hasher thread is
+ * required, i.e. the format cannot hash packets itself.
+ *
+ * With more than one, the hasher thread only reads packets and hands
+ * bursts of them to this many hasher threads to hash. Packets are still
+ * queued to the packet processing threads in the order they were read,
+ * so all packets within a flow are seen in order.
+ *
+ * @param trace A parallel input trace
+ * @param count The number of threads hashing packets. Defaults to 1.
+ *
+ * Each hasher thread has its own queue of size set by
+ * trace_set_hasher_queue_size(), which counts towards the packets needed.
+ *
+ * @return 0 if successful otherwise -1
+ */
+DLLEXPORT int trace_set_hasher_threads(libtrace_t *trace, size_t count);
+
 /**
  * Enables or disables polling of the hasher queue.
  *
@@ -1023,6 +1071,48 @@ DLLEXPORT void trace_publish_result(libtrace_t *libtrace,
                                     libtrace_generic_t value,
                                     int type);
 
+/** Publish a burst of results to the reporter thread (via the combiner)
+ *
+ * @param[in] libtrace The parallel input trace
+ * @param[in] t The current per-packet thread
+ * @param[in] results The results to publish, in the order they should be
+ * published. These are copied so the array can be reused on return.
+ * @param[in] nb_results The number of results
+ *
+ * This behaves as calling trace_publish_result() for each result in turn,
+ * but lets the combiner take the whole burst at once. A per-packet
+ * thread might gather the results for several packets and publish them
+ * together, just be sure to publish anything held before the thread
+ * pauses or stops.
+ */
+DLLEXPORT void trace_publish_results(libtrace_t *libtrace,
+                                     libtrace_thread_t *t,
+                                     libtrace_result_t *results,
+                                     size_t nb_results);
+
+/** Allocate memory for the value of a result
+ *
+ * @param[in] libtrace The parallel input trace
+ * @param[in] t The current per-packet thread
+ * @param[in] size The number of bytes required
+ * @return The memory, aligned to 16 bytes, or NULL if out of memory
+ *
+ * This memory comes from a per thread arena, which is much cheaper than
+ * malloc() for a small result published per packet. It must be freed
+ * using trace_free_result_payload(), typically by the reporter once it
+ * has consumed the result. Only a per-packet thread may allocate, any
+ * thread may free. Everything must be freed before trace_destroy().
+ */
+DLLEXPORT void *trace_alloc_result_payload(libtrace_t *libtrace,
+                                           libtrace_thread_t *t,
+                                           size_t size);
+
+/** Free memory from trace_alloc_result_payload()
+ *
+ * @param[in] payload The memory to free, may be NULL
+ */
+DLLEXPORT void trace_free_result_payload(void *payload);
+
 /** Check if a dedicated hasher thread is being used.
  *
  * @param[in] libtrace The parallel input trace
@@ -1304,6 +1394,7 @@ DLLEXPORT libtrace_info_t *trace_get_information(libtrace_t * libtrace);
  * * \b tick_count,\b tc see trace_set_tick_count() [size_t]
  * * \b perpkt_threads,\b pt see trace_set_perpkt_threads() [XXX TBA XXX]
  * * \b hasher_queue_size,\b hqs see trace_set_hasher_queue_size() [size_t]
+ * * \b hasher_threads,\b ht see trace_set_hasher_threads() [size_t]
  * * \b hasher_polling,\b hp see trace_set_hasher_polling() [bool]
  * * \b reporter_polling,\b rp see trace_set_reporter_polling() [bool]
  * * \b reporter_thold,\b rt see trace_set_reporter_thold() [size_t]
@@ -1375,12 +1466,22 @@ extern const libtrace_combine_t combiner_ordered;
 
 /**
  * Like classic Google Map/Reduce, the results are sorted
- * in ascending order based on their key. The sorting is only done when the
- * trace finishes and all results are stored internally until then.
- *
- * This only works with a very limited number of results, otherwise
- * libtrace will just run out of memory and crash. You should always
- * use combiner_ordered if you can.
+ * in ascending order based on their key.
+ *
+ * Ticks are used as watermarks: once every thread has published a tick,
+ * results with a key before the oldest of those ticks are sent to the
+ * reporter. For this to be useful results must be keyed in the same way
+ * as the ticks, e.g. by erf timestamp for tick intervals. Without ticks
+ * nothing is sent until the trace finishes.
+ *
+ * The configuration passed to trace_set_combiner() gives the reorder
+ * window as a uint64, the maximum number of results to hold in memory.
+ * Once this is exceeded the results held are sorted and spilled to a
+ * temporary file, which are merged back together as results are sent.
+ * A window of 0 holds everything in memory. Note results pointing
+ * to other memory, such as packets, still hold onto that memory.
+ *
+ * You should always use combiner_ordered if you can.
  */
 extern const libtrace_combine_t combiner_sorted;
 
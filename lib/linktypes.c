@@ -257,7 +257,7 @@ void promote_packet(libtrace_packet_t *packet)
 		}
 
 		/* This should be easy, just prepend the header */
-		tmpbuffer= (char*)malloc(
+		tmpbuffer= (char*)libtrace_buffer_pool_alloc(
 				sizeof(libtrace_sll_header_t)
 				+trace_get_capture_length(packet)
 				+trace_get_framing_length(packet)
@@ -294,7 +294,7 @@ void promote_packet(libtrace_packet_t *packet)
 			packet->buf_control=TRACE_CTRL_PACKET;
 		}
 		else {
-			free(packet->buffer);
+			libtrace_buffer_pool_free(packet->buffer);
 		}
 		packet->buffer=tmpbuffer;
 		packet->header=tmpbuffer;
@@ -330,7 +330,7 @@ bool demote_packet(libtrace_packet_t *packet)
 				packet->payload,&type,&remaining);
 			if (!packet->payload)
 				return false;
-			tmp=(char*)malloc(
+			tmp=(char*)libtrace_buffer_pool_alloc(
 				trace_get_capture_length(packet)
 				+sizeof(libtrace_pcapfile_pkt_hdr_t)
 				);
@@ -350,7 +350,7 @@ bool demote_packet(libtrace_packet_t *packet)
 				packet->buf_control=TRACE_CTRL_PACKET;
 			}
 			else {
-				free(packet->buffer);
+				libtrace_buffer_pool_free(packet->buffer);
 			}
 			packet->buffer=tmp;
 			packet->header=tmp;
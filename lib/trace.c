@@ -270,6 +270,9 @@ DLLEXPORT libtrace_t *trace_create(const char *uri) {
 	/* Parallel inits */
 	ASSERT_RET(pthread_mutex_init(&libtrace->libtrace_lock, NULL), == 0);
 	ASSERT_RET(pthread_cond_init(&libtrace->perpkt_cond, NULL), == 0);
+	ASSERT_RET(pthread_mutex_init(&libtrace->read_lock, NULL), == 0);
+	libtrace->read_finished = false;
+	libtrace->read_result = 0;
 	libtrace->state = STATE_NEW;
 	libtrace->perpkt_queue_full = false;
 	libtrace->global_blob = NULL;
@@ -394,6 +397,9 @@ DLLEXPORT libtrace_t * trace_create_dead (const char *uri) {
 	/* Parallel inits */
 	ASSERT_RET(pthread_mutex_init(&libtrace->libtrace_lock, NULL), == 0);
 	ASSERT_RET(pthread_cond_init(&libtrace->perpkt_cond, NULL), == 0);
+	ASSERT_RET(pthread_mutex_init(&libtrace->read_lock, NULL), == 0);
+	libtrace->read_finished = false;
+	libtrace->read_result = 0;
 	libtrace->state = STATE_NEW; // TODO MAYBE DEAD
 	libtrace->perpkt_queue_full = false;
 	libtrace->global_blob = NULL;
@@ -690,6 +696,7 @@ DLLEXPORT void trace_destroy(libtrace_t *libtrace) {
 
 	ASSERT_RET(pthread_mutex_destroy(&libtrace->libtrace_lock), == 0);
 	ASSERT_RET(pthread_cond_destroy(&libtrace->perpkt_cond), == 0);
+	ASSERT_RET(pthread_mutex_destroy(&libtrace->read_lock), == 0);
 
 	/* destroy any packets that are still around */
 	if (libtrace->state != STATE_NEW && libtrace->first_packets.packets) {
@@ -726,6 +733,8 @@ DLLEXPORT void trace_destroy(libtrace_t *libtrace) {
 		libtrace_ocache_destroy(&libtrace->packet_freelist);
 		for (i = 0; i < libtrace->perpkt_thread_count; ++i) {
                         libtrace_message_queue_destroy(&libtrace->perpkt_threads[i].messages);
+                        libtrace_arena_destroy(&libtrace->perpkt_threads[i].result_arena);
+                        free(libtrace->perpkt_threads[i].steal.packets);
                 }
                 libtrace_message_queue_destroy(&libtrace->hasher_thread.messages);
                 libtrace_message_queue_destroy(&libtrace->keepalive_thread.messages);
@@ -766,6 +775,7 @@ DLLEXPORT void trace_destroy_dead(libtrace_t *libtrace) {
 
 	ASSERT_RET(pthread_mutex_destroy(&libtrace->libtrace_lock), == 0);
 	ASSERT_RET(pthread_cond_destroy(&libtrace->perpkt_cond), == 0);
+	ASSERT_RET(pthread_mutex_destroy(&libtrace->read_lock), == 0);
 
 	/* Don't call pause_input or fin_input, because we should never have
 	 * used this trace to do any reading anyway. Do make sure we free
@@ -798,6 +808,25 @@ DLLEXPORT libtrace_packet_t *trace_create_packet(void)
 	return packet;
 }
 
+/* Makes sure the packet has a buffer of its own of at least size bytes,
+ * which a format can then read a packet into. A buffer the packet already
+ * owns is kept if it came from the pool and is large enough, one of
+ * unknown size, e.g. a user's TRACE_PREP_OWN_BUFFER, is replaced.
+ *
+ * @return The buffer, or NULL if out of memory
+ */
+void *trace_reserve_packet_buffer(libtrace_packet_t *packet, size_t size)
+{
+	if (packet->buffer && packet->buf_control == TRACE_CTRL_PACKET) {
+		if (libtrace_buffer_pool_size(packet->buffer) >= size)
+			return packet->buffer;
+		libtrace_buffer_pool_free(packet->buffer);
+	}
+	packet->buffer = libtrace_buffer_pool_alloc(size);
+	packet->buf_control = TRACE_CTRL_PACKET;
+	return packet->buffer;
+}
+
 DLLEXPORT libtrace_packet_t *trace_copy_packet(const libtrace_packet_t *packet) {
 	libtrace_packet_t *dest = 
 		(libtrace_packet_t *)calloc((size_t)1, sizeof(libtrace_packet_t));
@@ -806,7 +835,9 @@ DLLEXPORT libtrace_packet_t *trace_copy_packet(const libtrace_packet_t *packet)
 		abort();
 	}
 	dest->trace=packet->trace;
-	dest->buffer=malloc(65536);
+	dest->buffer=libtrace_buffer_pool_alloc(
+			trace_get_framing_length(packet) +
+			trace_get_capture_length(packet));
 	if (!dest->buffer) {
 		printf("Out of memory allocating buffer memory\n");
 		abort();
@@ -841,7 +872,7 @@ DLLEXPORT void trace_destroy_packet(libtrace_packet_t *packet) {
 		packet->trace->last_packet = NULL;
 	
 	if (packet->buf_control == TRACE_CTRL_PACKET && packet->buffer) {
-		free(packet->buffer);
+		libtrace_buffer_pool_free(packet->buffer);
 	}
 	packet->buf_control=(buf_control_t)'\0'; 
 				/* A "bad" value to force an assert
@@ -2016,13 +2047,7 @@ void trace_construct_packet(libtrace_packet_t *packet,
 	/* Now fill in the libtrace packet itself */
 	packet->trace=deadtrace;
 	size=len+sizeof(hdr);
-	if (packet->buf_control==TRACE_CTRL_PACKET) {
-		packet->buffer=realloc(packet->buffer,size);
-	}
-	else {
-		packet->buffer=malloc(size);
-	}
-	packet->buf_control=TRACE_CTRL_PACKET;
+	trace_reserve_packet_buffer(packet, size);
 	packet->header=packet->buffer;
 	packet->payload=(void*)((char*)packet->buffer+sizeof(hdr));
 	
@@ -94,80 +94,22 @@
 #include "format_helper.h"
 #include "rt_protocol.h"
 #include "hash_toeplitz.h"
+#include "hash_fast.h"
 
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sched.h>
 #include <ctype.h>
 
 static inline int delay_tracetime(libtrace_t *libtrace, libtrace_packet_t *packet, libtrace_thread_t *t);
+static int trace_pread_packet_work_stealing(libtrace_t *libtrace, libtrace_thread_t *t, libtrace_packet_t *packets[], size_t nb_packets);
+static bool ws_claim_burst(struct libtrace_steal_slot *slot, uint64_t min_order);
+static int ws_take_burst(libtrace_t *libtrace, libtrace_packet_t *packets[], struct libtrace_steal_slot *slot, size_t nb_packets);
 extern int libtrace_parallel;
 
-struct mem_stats {
-	struct memfail {
-	   uint64_t cache_hit;
-	   uint64_t ring_hit;
-	   uint64_t miss;
-	   uint64_t recycled;
-	} readbulk, read, write, writebulk;
-};
-
-
-#ifdef ENABLE_MEM_STATS
-// Grrr gcc wants this spelt out
-__thread struct mem_stats mem_hits = {{0},{0},{0},{0}};
-
-
-static void print_memory_stats() {
-	uint64_t total;
-#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__linux__)
-	char t_name[50];
-	pthread_getname_np(pthread_self(), t_name, sizeof(t_name));
-
-	fprintf(stderr, "Thread ID#%d - %s\n", (int) pthread_self(), t_name);
-#else
-	fprintf(stderr, "Thread ID#%d\n", (int) pthread_self());
-#endif
-
-	total = mem_hits.read.cache_hit + mem_hits.read.ring_hit + mem_hits.read.miss;
-	if (total) {
-		fprintf(stderr, "\tRead:\n\t---CHits=%"PRIu64"\n\t---RHits=%"PRIu64"\n\t---Misses=%"PRIu64"\n\t---Recycled=%"PRIu64"\n",
-				mem_hits.read.cache_hit, mem_hits.read.ring_hit, mem_hits.read.miss, mem_hits.read.recycled);
-		fprintf(stderr, "\t---Total=%"PRIu64"\n\t---Miss %%=%f\n",
-				total, (double) mem_hits.read.miss / (double) total * 100.0);
-	}
-
-	total = mem_hits.readbulk.cache_hit + mem_hits.readbulk.ring_hit + mem_hits.readbulk.miss;
-	if (total) {
-		fprintf(stderr, "\tReadbulk:\n\t---CHits=%"PRIu64"\n\t---RHits=%"PRIu64"\n\t---Misses=%"PRIu64"\n\t---Recycled=%"PRIu64"\n",
-				mem_hits.readbulk.cache_hit, mem_hits.readbulk.ring_hit, mem_hits.readbulk.miss, mem_hits.readbulk.recycled);
-
-
-		fprintf(stderr, "\t---Total=%"PRIu64"\n\t---Miss %%=%f\n",
-				total, (double) mem_hits.readbulk.miss / (double) total * 100.0);
-	}
-
-	total = mem_hits.write.cache_hit + mem_hits.write.ring_hit + mem_hits.write.miss;
-	if (total) {
-		fprintf(stderr, "\tWrite:\n\t---CHits=%"PRIu64"\n\t---RHits=%"PRIu64"\n\t---Misses=%"PRIu64"\n\t---Recycled=%"PRIu64"\n",
-				mem_hits.write.cache_hit, mem_hits.write.ring_hit, mem_hits.write.miss, mem_hits.write.recycled);
-
-		fprintf(stderr, "\t---Total=%"PRIu64"\n\t---Miss %%=%f\n",
-				total, (double) mem_hits.write.miss / (double) total * 100.0);
-	}
-
-	total = mem_hits.writebulk.cache_hit + mem_hits.writebulk.ring_hit + mem_hits.writebulk.miss;
-	if (total) {
-		fprintf(stderr, "\tWritebulk:\n\t---CHits=%"PRIu64"\n\t---RHits=%"PRIu64"\n\t---Misses=%"PRIu64"\n\t---Recycled=%"PRIu64"\n",
-				mem_hits.writebulk.cache_hit, mem_hits.writebulk.ring_hit, mem_hits.writebulk.miss, mem_hits.writebulk.recycled);
-
-		fprintf(stderr, "\t---Total=%"PRIu64"\n\t---Miss %%=%f\n",
-				total, (double) mem_hits.writebulk.miss / (double) total * 100.0);
-	}
-}
-#else
-static void print_memory_stats() {}
-#endif
+/* The size of the chunks backing each perpkt thread's result payloads */
+#define RESULT_ARENA_CHUNK_SIZE (64 * 1024)
 
 static const libtrace_generic_t gen_zero = {0};
 
@@ -376,7 +318,12 @@ void libtrace_zero_thread(libtrace_thread_t * t) {
 	t->tracetime_offset_usec = 0;
 	t->user_data = 0;
 	t->format_data = 0;
-	libtrace_zero_ringbuffer(&t->rbuffer);
+	libtrace_zero_spsc_ring(&t->rbuffer);
+	t->steal.packets = NULL;
+	t->steal.first_order = 0;
+	t->steal.next_order = 0;
+	t->steal.state = 0;
+	libtrace_zero_arena(&t->result_arena);
 	t->trace = NULL;
 	t->ret = NULL;
 	t->type = THREAD_EMPTY;
@@ -563,7 +510,7 @@ static int trace_perpkt_thread_pause(libtrace_t *trace, libtrace_thread_t *t,
 	/* If a hasher thread is running, empty input queues so we don't lose data */
 	if (trace_has_dedicated_hasher(trace)) {
 		// The hasher has stopped by this point, so the queue shouldn't be filling
-		while(!libtrace_ringbuffer_is_empty(&t->rbuffer) || t->format_data) {
+		while(!libtrace_spsc_ring_is_empty(&t->rbuffer) || t->format_data) {
 			int ret = trace->pread(trace, t, &packet, 1);
 			if (ret == 1) {
 				if (packet->error > 0) {
@@ -577,7 +524,7 @@ static int trace_perpkt_thread_pause(libtrace_t *trace, libtrace_thread_t *t,
 				assert (ret == READ_EOF || ret == READ_ERROR);
 				/* Verify no packets are remaining */
 				/* TODO refactor this sanity check out!! */
-				while (!libtrace_ringbuffer_is_empty(&t->rbuffer)) {
+				while (!libtrace_spsc_ring_is_empty(&t->rbuffer)) {
 					ASSERT_RET(trace->pread(trace, t, &packet, 1), <= 0);
 					// No packets after this should have any data in them
 					assert(packet->error <= 0);
@@ -589,6 +536,31 @@ static int trace_perpkt_thread_pause(libtrace_t *trace, libtrace_thread_t *t,
 	}
 	libtrace_ocache_free(&trace->packet_freelist, (void **) &packet, 1, 1);
 
+	/* Packets we read ahead may point into buffers the format releases
+	 * when paused, so these must be sent through too */
+	if (trace->pread == trace_pread_packet_work_stealing &&
+	    ws_claim_burst(&t->steal, t->steal.next_order)) {
+		libtrace_packet_t *burst[trace->config.burst_size];
+		size_t i, nb;
+
+		libtrace_ocache_alloc(&trace->packet_freelist, (void **) burst,
+		                      trace->config.burst_size,
+		                      trace->config.burst_size);
+		nb = ws_take_burst(trace, burst, &t->steal,
+		                   trace->config.burst_size);
+		t->steal.next_order = trace_packet_get_order(burst[nb - 1]) + 1;
+		for (i = 0; i < nb; i++) {
+			if (burst[i]->error > 0) {
+				store_first_packet(trace, burst[i], t);
+			}
+			ASSERT_RET(dispatch_packet(trace, t, &burst[i], false), == 0);
+		}
+		for (i = 0; i < trace->config.burst_size; i++) {
+			if (burst[i])
+				libtrace_ocache_free(&trace->packet_freelist, (void **) &burst[i], 1, 1);
+		}
+	}
+
 	/* Now we do the actual pause, this returns when we resumed */
 	trace_thread_pause(trace, t);
 	send_message(trace, t, MESSAGE_RESUMING, gen_zero, t);
@@ -749,23 +721,248 @@ eof:
 	if (trace->format->punregister_thread) {
 		trace->format->punregister_thread(trace, t);
 	}
-	print_memory_stats();
+	pthread_exit(NULL);
+}
+
+/* Hands the packets queued against a perpkt thread over in a single write */
+static void hasher_flush_group(libtrace_t *trace, int thread,
+                               libtrace_packet_t *group[], size_t *nb) {
+	if (*nb == 0)
+		return;
+	/* Blocking write to the correct queue - I'm the only writer */
+	if (trace->perpkt_threads[thread].state != THREAD_FINISHED) {
+		libtrace_spsc_ring_write_bulk(&trace->perpkt_threads[thread].rbuffer,
+		                              (void **) group, *nb, *nb);
+	} else {
+		assert(!"Dropping a packet!!");
+		libtrace_ocache_free(&trace->packet_freelist, (void **) group, *nb, *nb);
+	}
+	*nb = 0;
+}
+
+/* Queues a packet against a perpkt thread, flushing the group if it is full */
+static inline void hasher_queue_packet(libtrace_t *trace, int thread,
+                                       libtrace_packet_t *groups[],
+                                       size_t nb_grouped[],
+                                       libtrace_packet_t *packet) {
+	size_t burst_size = trace->config.burst_size;
+	libtrace_packet_t **group = &groups[thread * burst_size];
+
+	if (nb_grouped[thread] == burst_size)
+		hasher_flush_group(trace, thread, group, &nb_grouped[thread]);
+	group[nb_grouped[thread]++] = packet;
+}
+
+/* Hashes a run of packets, this is the part we can spread across threads */
+static void hasher_hash_packets(libtrace_t *trace, libtrace_packet_t *packets[],
+                                size_t nb_packets) {
+	size_t i;
+
+	/* We are guaranteed to have a hash function i.e. != NULL */
+	for (i = 0; i < nb_packets; i++) {
+		trace_packet_set_hash(packets[i], (*trace->hasher)(packets[i], trace->hasher_data));
+	}
+}
+
+/* Queues a run of hashed packets against the correct threads, the caller
+ * must be the only writer to the perpkt queues */
+static void hasher_queue_packets(libtrace_t *trace, libtrace_packet_t *packets[],
+                                 size_t nb_packets, libtrace_packet_t *groups[],
+                                 size_t nb_grouped[]) {
+	size_t k;
+	int i;
+
+	for (k = 0; k < nb_packets; k++) {
+		uint64_t order = trace_packet_get_order(packets[k]);
+		int thread = trace_packet_get_hash(packets[k]) % trace->perpkt_thread_count;
+
+		hasher_queue_packet(trace, thread, groups, nb_grouped, packets[k]);
+		if (trace->config.tick_count && order % trace->config.tick_count == 0) {
+			// Write ticks to everyone else
+			libtrace_packet_t * pkts[trace->perpkt_thread_count];
+			memset(pkts, 0, sizeof(void *) * trace->perpkt_thread_count);
+			libtrace_ocache_alloc(&trace->packet_freelist, (void **) pkts, trace->perpkt_thread_count, trace->perpkt_thread_count);
+			for (i = 0; i < trace->perpkt_thread_count; i++) {
+				pkts[i]->error = READ_TICK;
+				trace_packet_set_order(pkts[i], order);
+				hasher_queue_packet(trace, i, groups, nb_grouped, pkts[i]);
+			}
+		}
+	}
+}
+
+static void hasher_flush_groups(libtrace_t *trace, libtrace_packet_t *groups[],
+                                size_t nb_grouped[]) {
+	int i;
+
+	for (i = 0; i < trace->perpkt_thread_count; i++) {
+		hasher_flush_group(trace, i, &groups[i * trace->config.burst_size], &nb_grouped[i]);
+	}
+}
+
+/**
+ * A hasher worker, used when more than one hasher thread is configured.
+ *
+ * The hasher thread becomes a reader, it reads bursts and hands each to
+ * the next worker in turn. A burst is ended by a NULL and an empty burst
+ * asks the worker to exit.
+ *
+ * Workers hash in parallel, but queue packets to the perpkt threads in
+ * the order they were read. A worker waits until next_order reaches the
+ * order of the first packet in its burst, queues the burst then moves
+ * next_order past the last packet. This keeps the perpkt queues single
+ * writer and every flow in order.
+ */
+typedef struct hasher_worker {
+	libtrace_t *trace;
+	volatile uint64_t *next_order;
+	libtrace_spsc_ring_t rbuffer;
+	pthread_t tid;
+} hasher_worker_t;
+
+static void* hasher_worker_entry(void *data) {
+	hasher_worker_t *w = (hasher_worker_t *) data;
+	libtrace_t *trace = w->trace;
+	size_t burst_size = trace->config.burst_size;
+	libtrace_packet_t * packets[burst_size + 1];
+	libtrace_packet_t ** groups;
+	size_t * nb_grouped;
+	uint64_t last_order = 0;
+	bool queuing = false;
+	size_t nb, j, end;
+
+	groups = malloc(sizeof(libtrace_packet_t *) * burst_size *
+	                trace->perpkt_thread_count);
+	nb_grouped = calloc(trace->perpkt_thread_count, sizeof(size_t));
+	assert(groups && nb_grouped);
+
+	while (1) {
+		nb = libtrace_spsc_ring_read_bulk(&w->rbuffer, (void **) packets,
+		                                  burst_size + 1, 1);
 
+		/* Hash everything before we wait for our turn */
+		for (j = 0; j < nb; j = end + 1) {
+			for (end = j; end < nb && packets[end]; end++);
+			hasher_hash_packets(trace, &packets[j], end - j);
+		}
+
+		for (j = 0; j < nb; j = end + 1) {
+			for (end = j; end < nb && packets[end]; end++);
+
+			if (end > j) {
+				if (!queuing) {
+					uint64_t order = trace_packet_get_order(packets[j]);
+					while (__atomic_load_n(w->next_order, __ATOMIC_ACQUIRE) != order)
+						sched_yield();
+					queuing = true;
+				}
+				last_order = trace_packet_get_order(packets[end - 1]);
+				hasher_queue_packets(trace, &packets[j], end - j,
+				                     groups, nb_grouped);
+			}
+
+			if (end < nb) {
+				/* The end of a burst, or of us if it was empty */
+				if (!queuing)
+					goto done;
+				hasher_flush_groups(trace, groups, nb_grouped);
+				__atomic_store_n(w->next_order, last_order + 1, __ATOMIC_RELEASE);
+				queuing = false;
+			}
+		}
+	}
+done:
+	free(groups);
+	free(nb_grouped);
+	libtrace_ocache_unregister_thread(&trace->packet_freelist);
 	pthread_exit(NULL);
 }
 
+/* Waits until the workers have queued every packet read so far, after
+ * which the caller can safely write to the perpkt queues */
+static void hasher_wait_for_workers(libtrace_t *trace, volatile uint64_t *next_order) {
+	while (__atomic_load_n(next_order, __ATOMIC_ACQUIRE) != trace->sequence_number)
+		sched_yield();
+}
+
+/* Starts the hasher workers, returning the number actually started */
+static int hasher_start_workers(libtrace_t *trace, hasher_worker_t *workers,
+                                int nb_workers, volatile uint64_t *next_order) {
+	int i;
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__linux__)
+	char name[16];
+#endif
+
+	*next_order = trace->sequence_number;
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].trace = trace;
+		workers[i].next_order = next_order;
+		if (libtrace_spsc_ring_init(&workers[i].rbuffer,
+		                            trace->config.hasher_queue_size,
+		                            trace->config.hasher_polling?
+		                                    LIBTRACE_SPSC_RING_POLLING:
+		                                    LIBTRACE_SPSC_RING_BLOCKING) != 0)
+			break;
+		if (pthread_create(&workers[i].tid, NULL, hasher_worker_entry, &workers[i]) != 0) {
+			libtrace_spsc_ring_destroy(&workers[i].rbuffer);
+			break;
+		}
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__linux__)
+		snprintf(name, sizeof(name), "hasher-%hu", (unsigned short) i);
+		pthread_setname_np(workers[i].tid, name);
+#endif
+	}
+	if (i < nb_workers)
+		fprintf(stderr, "Only started %d of %d hasher threads\n", i, nb_workers);
+	return i;
+}
+
+/* Stops the hasher workers once they are idle */
+static void hasher_stop_workers(libtrace_t *trace, hasher_worker_t *workers,
+                                int nb_workers, volatile uint64_t *next_order) {
+	int i;
+
+	hasher_wait_for_workers(trace, next_order);
+	for (i = 0; i < nb_workers; i++) {
+		libtrace_spsc_ring_write(&workers[i].rbuffer, NULL);
+	}
+	for (i = 0; i < nb_workers; i++) {
+		ASSERT_RET(pthread_join(workers[i].tid, NULL), == 0);
+		assert(libtrace_spsc_ring_is_empty(&workers[i].rbuffer));
+		libtrace_spsc_ring_destroy(&workers[i].rbuffer);
+	}
+}
+
 /**
- * The start point for our single threaded hasher thread, this will read
- * and hash a packet from a data source and queue it against the correct
- * core to process it.
+ * The start point for our hasher thread, this will read and hash a burst
+ * of packets from a data source and queue each against the correct core
+ * to process it.
+ *
+ * Packets are grouped by the thread they are destined for so that each
+ * thread's queue is only written to once per burst.
+ *
+ * If more than one hasher thread is configured this thread only reads,
+ * handing the bursts to hasher workers, see hasher_worker_entry().
  */
 static void* hasher_entry(void *data) {
 	libtrace_t *trace = (libtrace_t *)data;
 	libtrace_thread_t * t;
-	int i;
+	size_t j, nb_packets;
+	size_t burst_size = trace->config.burst_size;
+	/* A live format can block waiting for the next packet, so each
+	 * packet is passed on as soon as it is read rather than held back
+	 * until a burst is full */
+	size_t read_burst = trace->format->info.live ? 1 : burst_size;
+	libtrace_packet_t * packets[burst_size];
+	libtrace_packet_t ** groups;
+	size_t * nb_grouped;
 	libtrace_packet_t * packet;
 	libtrace_message_t message = {0, {.uint64=0}, NULL};
-	int pkt_skipped = 0;
+	hasher_worker_t * workers = NULL;
+	int nb_workers = 0;
+	int next_worker = 0;
+	volatile uint64_t next_order = 0;
+	int i;
 
 	assert(trace_has_dedicated_hasher(trace));
 	/* Wait until all threads are started and objects are initialised (ring buffers) */
@@ -784,12 +981,32 @@ static void* hasher_entry(void *data) {
 		trace->format->pregister_thread(trace, t, true);
 	}
 
+	/* One group of up to burst_size packets per perpkt thread */
+	groups = malloc(sizeof(libtrace_packet_t *) * burst_size *
+	                trace->perpkt_thread_count);
+	nb_grouped = calloc(trace->perpkt_thread_count, sizeof(size_t));
+	assert(groups && nb_grouped);
+
+	if (trace->config.hasher_threads > 1) {
+		workers = calloc(trace->config.hasher_threads, sizeof(hasher_worker_t));
+		assert(workers);
+		nb_workers = hasher_start_workers(trace, workers,
+		                                  trace->config.hasher_threads,
+		                                  &next_order);
+	}
+
+	/* Start with a full burst of empty packets, after that only the
+	 * packets handed over to perpkt threads need replacing */
+	libtrace_ocache_alloc(&trace->packet_freelist, (void **) packets, burst_size, burst_size);
+	nb_packets = 0;
+
 	/* Read all packets in then hash and queue against the correct thread */
 	while (1) {
-		int thread;
-		if (!pkt_skipped)
-			libtrace_ocache_alloc(&trace->packet_freelist, (void **) &packet, 1, 1);
-		assert(packet);
+		if (nb_packets) {
+			libtrace_ocache_alloc(&trace->packet_freelist, (void **) packets, nb_packets, nb_packets);
+			nb_packets = 0;
+		}
+		packet = packets[0];
 
 		if (libtrace_halt) {
 			packet->error = 0;
@@ -800,6 +1017,10 @@ static void* hasher_entry(void *data) {
 		if (libtrace_message_queue_try_get(&t->messages, &message) != LIBTRACE_MQ_FAILED) {
 			switch(message.code) {
 				case MESSAGE_DO_PAUSE:
+					/* Everything read must be queued before
+					 * the perpkt threads are paused */
+					if (nb_workers)
+						hasher_wait_for_workers(trace, &next_order);
 					ASSERT_RET(pthread_mutex_lock(&trace->libtrace_lock), == 0);
 					thread_change_state(trace, t, THREAD_PAUSED, false);
 					pthread_cond_broadcast(&trace->perpkt_cond);
@@ -819,39 +1040,46 @@ static void* hasher_entry(void *data) {
 				default:
 					fprintf(stderr, "Hasher thread didn't expect message code=%d\n", message.code);
 			}
-			pkt_skipped = 1;
 			continue;
 		}
 
-		if ((packet->error = trace_read_packet(trace, packet)) <1) {
-			break; /* We are EOF or error'd either way we stop  */
+		/* Read a burst, stopping early if we hit EOF or an error */
+		for (j = 0; j < read_burst; j++) {
+			if ((packets[j]->error = trace_read_packet(trace, packets[j])) < 1)
+				break;
 		}
 
-		/* We are guaranteed to have a hash function i.e. != NULL */
-		trace_packet_set_hash(packet, (*trace->hasher)(packet, trace->hasher_data));
-		thread = trace_packet_get_hash(packet) % trace->perpkt_thread_count;
-		/* Blocking write to the correct queue - I'm the only writer */
-		if (trace->perpkt_threads[thread].state != THREAD_FINISHED) {
-			uint64_t order = trace_packet_get_order(packet);
-			libtrace_ringbuffer_write(&trace->perpkt_threads[thread].rbuffer, packet);
-			if (trace->config.tick_count && order % trace->config.tick_count == 0) {
-				// Write ticks to everyone else
-				libtrace_packet_t * pkts[trace->perpkt_thread_count];
-				memset(pkts, 0, sizeof(void *) * trace->perpkt_thread_count);
-				libtrace_ocache_alloc(&trace->packet_freelist, (void **) pkts, trace->perpkt_thread_count, trace->perpkt_thread_count);
-				for (i = 0; i < trace->perpkt_thread_count; i++) {
-					pkts[i]->error = READ_TICK;
-					trace_packet_set_order(pkts[i], order);
-					libtrace_ringbuffer_write(&trace->perpkt_threads[i].rbuffer, pkts[i]);
-				}
-			}
-			pkt_skipped = 0;
+		if (nb_workers && j) {
+			hasher_worker_t *w = &workers[next_worker];
+			libtrace_spsc_ring_write_bulk(&w->rbuffer, (void **) packets, j, j);
+			libtrace_spsc_ring_write(&w->rbuffer, NULL);
+			next_worker = (next_worker + 1) % nb_workers;
 		} else {
-			assert(!"Dropping a packet!!");
-			pkt_skipped = 1; // Reuse that packet no one read it
+			hasher_hash_packets(trace, packets, j);
+			hasher_queue_packets(trace, packets, j, groups, nb_grouped);
+			hasher_flush_groups(trace, groups, nb_grouped);
+		}
+		nb_packets = j;
+
+		if (j < read_burst) {
+			packet = packets[j];
+			break; /* We are EOF or error'd either way we stop  */
 		}
 	}
 
+	/* Let the workers finish off, before we write to the perpkt queues */
+	if (nb_workers)
+		hasher_stop_workers(trace, workers, nb_workers, &next_order);
+	free(workers);
+
+	/* Return the rest of the burst that was never read into */
+	if (nb_packets + 1 < burst_size) {
+		libtrace_ocache_free(&trace->packet_freelist, (void **) &packets[nb_packets + 1],
+		                     burst_size - nb_packets - 1, burst_size - nb_packets - 1);
+	}
+	free(groups);
+	free(nb_grouped);
+
 	/* Broadcast our last failed read to all threads */
 	for (i = 0; i < trace->perpkt_thread_count; i++) {
 		libtrace_packet_t * bcast;
@@ -864,7 +1092,7 @@ static void* hasher_entry(void *data) {
 		ASSERT_RET(pthread_mutex_lock(&trace->libtrace_lock), == 0);
 		if (trace->perpkt_threads[i].state != THREAD_FINISHED) {
 			// Unlock early otherwise we could deadlock
-			libtrace_ringbuffer_write(&trace->perpkt_threads[i].rbuffer, bcast);
+			libtrace_spsc_ring_write(&trace->perpkt_threads[i].rbuffer, bcast);
 		}
 		ASSERT_RET(pthread_mutex_unlock(&trace->libtrace_lock), == 0);
 	}
@@ -876,24 +1104,94 @@ static void* hasher_entry(void *data) {
 	if (trace->format->punregister_thread) {
 		trace->format->punregister_thread(trace, t);
 	}
-	print_memory_stats();
-
 	// TODO remove from TTABLE t sometime
 	pthread_exit(NULL);
 }
 
-/* Our simplest case when a thread becomes ready it can obtain an exclusive
- * lock to read packets from the underlying trace.
+/* Packets read ahead by a perpkt thread are left in its steal slot as a
+ * burst of burst_size pointers, NULL terminated if the burst is short.
+ * Only one burst is ever read ahead, as the owner takes that burst before
+ * reading again, so a single slot is enough. The owner and idle threads
+ * claim the burst by moving the slot from ready to taking with a CAS and
+ * hand it back empty once the packets are taken, no lock is involved.
+ *
+ * A thread only takes a burst newer than anything it has already
+ * processed. Otherwise a thread that takes its own read ahead burst and
+ * then steals an older one from another thread would hand out its orders
+ * out of sequence, and the ordered combiner relies on the orders from
+ * each thread increasing.
  */
-static int trace_pread_packet_first_in_first_served(libtrace_t *libtrace,
-                                                    libtrace_thread_t *t,
-                                                    libtrace_packet_t *packets[],
-                                                    size_t nb_packets) {
-	size_t i = 0;
-	//bool tick_hit = false;
+enum steal_states {
+	STEAL_EMPTY,
+	STEAL_READY,
+	STEAL_TAKING,
+};
+
+/* Claims the burst in a slot if it holds one no older than min_order */
+static bool ws_claim_burst(struct libtrace_steal_slot *slot,
+                           uint64_t min_order) {
+	int expected = STEAL_READY;
+
+	if (__atomic_load_n(&slot->state, __ATOMIC_RELAXED) != STEAL_READY)
+		return false;
+	if (!__atomic_compare_exchange_n(&slot->state, &expected, STEAL_TAKING,
+	                                 false, __ATOMIC_ACQUIRE,
+	                                 __ATOMIC_RELAXED))
+		return false;
+	if (slot->first_order < min_order) {
+		__atomic_store_n(&slot->state, STEAL_READY, __ATOMIC_RELEASE);
+		return false;
+	}
+	return true;
+}
+
+/* Moves a claimed burst into packets, the empty packets it replaces are
+ * returned to the cache and the slot is emptied. Returns the number of
+ * packets moved. */
+static int ws_take_burst(libtrace_t *libtrace, libtrace_packet_t *packets[],
+                         struct libtrace_steal_slot *slot, size_t nb_packets) {
+	libtrace_packet_t **burst = slot->packets;
+	size_t i;
+
+	for (i = 0; i < nb_packets && burst[i]; i++) {
+		libtrace_packet_t *empty = packets[i];
+		packets[i] = burst[i];
+		burst[i] = empty;
+	}
+	libtrace_ocache_free(&libtrace->packet_freelist, (void **) burst, i, i);
+	__atomic_store_n(&slot->state, STEAL_EMPTY, __ATOMIC_RELEASE);
+	return i;
+}
+
+/* Tries to steal the burst read ahead by another thread */
+static int ws_steal_burst(libtrace_t *libtrace, libtrace_thread_t *t,
+                          libtrace_packet_t *packets[], size_t nb_packets) {
+	int i;
+
+	for (i = 1; i < libtrace->perpkt_thread_count; i++) {
+		libtrace_thread_t *victim = &libtrace->perpkt_threads[
+		        (t->perpkt_num + i) % libtrace->perpkt_thread_count];
+		if (ws_claim_burst(&victim->steal, t->steal.next_order))
+			return ws_take_burst(libtrace, packets, &victim->steal,
+			                     nb_packets);
+	}
+	return 0;
+}
+
+/* Reads up to nb_packets from the trace, the read_lock must be held.
+ *
+ * Once the trace reports EOF or an error this is remembered, so that
+ * later callers don't keep reading a finished trace.
+ *
+ * @return The number of packets read, otherwise the error from the first
+ */
+static int ws_read_burst(libtrace_t *libtrace, libtrace_packet_t *packets[],
+                         size_t nb_packets) {
+	size_t i;
+
+	if (libtrace->read_finished)
+		return libtrace->read_result;
 
-	ASSERT_RET(pthread_mutex_lock(&libtrace->libtrace_lock), == 0);
-	/* Read nb_packets */
 	for (i = 0; i < nb_packets; ++i) {
 		if (libtrace_halt) {
 			break;
@@ -901,35 +1199,99 @@ static int trace_pread_packet_first_in_first_served(libtrace_t *libtrace,
 		packets[i]->error = trace_read_packet(libtrace, packets[i]);
 
 		if (packets[i]->error <= 0) {
+			if (packets[i]->error == READ_EOF ||
+			    packets[i]->error == READ_ERROR) {
+				libtrace->read_finished = true;
+				libtrace->read_result = packets[i]->error;
+			}
 			/* We'll catch this next time if we have already got packets */
-			if ( i==0 ) {
-				ASSERT_RET(pthread_mutex_unlock(&libtrace->libtrace_lock), == 0);
+			if (i == 0)
 				return packets[i]->error;
-			} else {
-				break;
-			}
+			break;
 		}
-		/*
-		if (libtrace->config.tick_count && trace_packet_get_order(packets[i]) % libtrace->config.tick_count == 0) {
-			tick_hit = true;
-		}*/
-	}
-	// Doing this inside the lock ensures the first packet is always
-	// recorded first
-	if (packets[0]->error > 0) {
-		store_first_packet(libtrace, packets[0], t);
 	}
-	ASSERT_RET(pthread_mutex_unlock(&libtrace->libtrace_lock), == 0);
-	/* XXX TODO this needs to be inband with packets, or we don't bother in this case
-	if (tick_hit) {
-		libtrace_message_t tick;
-		tick.additional.uint64 = trace_packet_get_order(packets[i]);
-		tick.code = MESSAGE_TICK;
-		trace_send_message_to_perpkts(libtrace, &tick);
-	} */
 	return i;
 }
 
+/* Reads a burst ahead into our own steal slot, the read_lock must be held */
+static void ws_read_ahead(libtrace_t *libtrace, libtrace_thread_t *t,
+                          size_t nb_packets) {
+	libtrace_packet_t **burst = t->steal.packets;
+	int ret;
+	size_t nb;
+
+	/* Another thread may still be taking the last burst */
+	if (__atomic_load_n(&t->steal.state, __ATOMIC_ACQUIRE) != STEAL_EMPTY)
+		return;
+	libtrace_ocache_alloc(&libtrace->packet_freelist, (void **) burst,
+	                      nb_packets, nb_packets);
+	ret = ws_read_burst(libtrace, burst, nb_packets);
+	nb = ret > 0 ? (size_t) ret : 0;
+	if (nb != nb_packets) {
+		libtrace_ocache_free(&libtrace->packet_freelist,
+		                     (void **) &burst[nb], nb_packets - nb,
+		                     nb_packets - nb);
+		burst[nb] = NULL;
+	}
+	if (nb) {
+		t->steal.first_order = trace_packet_get_order(burst[0]);
+		__atomic_store_n(&t->steal.state, STEAL_READY, __ATOMIC_RELEASE);
+	}
+}
+
+/* Used for HASHER_BALANCE when the format cannot read in parallel.
+ *
+ * Only one thread reads from the trace at a time, under read_lock rather
+ * than libtrace_lock. The reader also reads a burst ahead into its own
+ * steal slot, so a thread that finds somebody else reading can steal
+ * that burst rather than wait. A thread stuck on an expensive packet
+ * thus never holds up the others.
+ */
+static int trace_pread_packet_work_stealing(libtrace_t *libtrace,
+                                            libtrace_thread_t *t,
+                                            libtrace_packet_t *packets[],
+                                            size_t nb_packets) {
+	int ret;
+
+	assert(nb_packets == libtrace->config.burst_size);
+
+	/* Anything we read ahead earlier comes first */
+	if (ws_claim_burst(&t->steal, t->steal.next_order)) {
+		ret = ws_take_burst(libtrace, packets, &t->steal, nb_packets);
+		goto done;
+	}
+
+	/* Somebody else is reading, steal from them if we can otherwise
+	 * wait our turn */
+	if (pthread_mutex_trylock(&libtrace->read_lock) != 0) {
+		if ((ret = ws_steal_burst(libtrace, t, packets, nb_packets)))
+			goto done;
+		ASSERT_RET(pthread_mutex_lock(&libtrace->read_lock), == 0);
+	}
+
+	ret = ws_read_burst(libtrace, packets, nb_packets);
+	if (ret > 0) {
+		// Doing this inside the lock ensures the first packet is always
+		// recorded first
+		store_first_packet(libtrace, packets[0], t);
+		if ((size_t) ret == nb_packets)
+			ws_read_ahead(libtrace, t, nb_packets);
+	}
+	ASSERT_RET(pthread_mutex_unlock(&libtrace->read_lock), == 0);
+
+	/* Help empty the other slots before finishing */
+	if (ret == READ_EOF || ret == READ_ERROR) {
+		int stolen = ws_steal_burst(libtrace, t, packets, nb_packets);
+		if (stolen)
+			ret = stolen;
+	}
+done:
+	if (ret > 0)
+		t->steal.next_order =
+		        trace_packet_get_order(packets[ret - 1]) + 1;
+	return ret;
+}
+
 /**
  * For the case that we have a dedicated hasher thread
  * 1. We read a packet from our buffer
@@ -949,7 +1311,7 @@ inline static int trace_pread_packet_hasher_thread(libtrace_t *libtrace,
 	// Always grab at least one
 	if (packets[0]) // Recycle the old get the new
 		libtrace_ocache_free(&libtrace->packet_freelist, (void **) packets, 1, 1);
-	packets[0] = libtrace_ringbuffer_read(&t->rbuffer);
+	packets[0] = libtrace_spsc_ring_read(&t->rbuffer);
 
 	if (packets[0]->error <= 0 && packets[0]->error != READ_TICK) {
 		return packets[0]->error;
@@ -958,7 +1320,7 @@ inline static int trace_pread_packet_hasher_thread(libtrace_t *libtrace,
 	for (i = 1; i < nb_packets; i++) {
 		if (packets[i]) // Recycle the old get the new
 			libtrace_ocache_free(&libtrace->packet_freelist, (void **) &packets[i], 1, 1);
-		if (!libtrace_ringbuffer_try_read(&t->rbuffer, (void **) &packets[i])) {
+		if (!libtrace_spsc_ring_try_read(&t->rbuffer, (void **) &packets[i])) {
 			packets[i] = NULL;
 			break;
 		}
@@ -1141,8 +1503,11 @@ static void* reporter_entry(void *data) {
         send_message(trace, t, MESSAGE_PAUSING,(libtrace_generic_t) {0}, t);
         send_message(trace, t, MESSAGE_STOPPING,(libtrace_generic_t) {0}, t);
 
+	if (trace->format->punregister_thread) {
+		trace->format->punregister_thread(trace, t);
+	}
+
 	thread_change_state(trace, &trace->reporter_thread, THREAD_FINISHED, true);
-	print_memory_stats();
 	return NULL;
 }
 
@@ -1339,7 +1704,11 @@ static int trace_pread_packet_wrapper(libtrace_t *libtrace,
 				if (libtrace->snaplen>0)
 					trace_set_capture_length(packets[i],
 							libtrace->snaplen);
-				trace_packet_set_order(packets[i], trace_get_erf_timestamp(packets[i]));
+				/* Live formats are ordered by timestamp, trace
+				 * files by where a packet is in the file which
+				 * the format has already set */
+				if (libtrace->format->info.live)
+					trace_packet_set_order(packets[i], trace_get_erf_timestamp(packets[i]));
 			}
 		} while(ret == 0);
 		return ret;
@@ -1458,10 +1827,14 @@ SIMPLE_FUNCTION static int get_nb_cores() {
  * specified by the user.
  */
 static void verify_configuration(libtrace_t *libtrace) {
+	size_t queues;
 
 	if (libtrace->config.hasher_queue_size <= 0)
 		libtrace->config.hasher_queue_size = 1000;
 
+	if (libtrace->config.hasher_threads <= 0)
+		libtrace->config.hasher_threads = 1;
+
 	if (libtrace->config.perpkt_threads <= 0) {
 		libtrace->perpkt_thread_count = get_nb_cores();
 		if (libtrace->perpkt_thread_count <= 0)
@@ -1477,11 +1850,15 @@ static void verify_configuration(libtrace_t *libtrace) {
 		libtrace->config.burst_size = 10;
 	if (libtrace->config.thread_cache_size <= 0)
 		libtrace->config.thread_cache_size = 20;
+	/* Each hasher worker has a queue in front of it too */
+	queues = libtrace->perpkt_thread_count;
+	if (libtrace->config.hasher_threads > 1)
+		queues += libtrace->config.hasher_threads;
 	if (libtrace->config.cache_size <= 0)
-		libtrace->config.cache_size = (libtrace->config.hasher_queue_size + 1) * libtrace->perpkt_thread_count;
+		libtrace->config.cache_size = (libtrace->config.hasher_queue_size + 1) * queues;
 
 	if (libtrace->config.cache_size <
-		(libtrace->config.hasher_queue_size + 1) * libtrace->perpkt_thread_count)
+		(libtrace->config.hasher_queue_size + 1) * queues)
 		fprintf(stderr, "WARNING deadlocks may occur and extra memory allocating buffer sizes (packet_freelist_size) mismatched\n");
 
 	if (libtrace->combiner.initialise == NULL && libtrace->combiner.publish == NULL)
@@ -1547,11 +1924,19 @@ static int trace_start_thread(libtrace_t *trace,
 	}
 	libtrace_message_queue_init(&t->messages, sizeof(libtrace_message_t));
 	if (trace_has_dedicated_hasher(trace) && type == THREAD_PERPKT) {
-		libtrace_ringbuffer_init(&t->rbuffer,
-		                         trace->config.hasher_queue_size,
-		                         trace->config.hasher_polling?
-		                                 LIBTRACE_RINGBUFFER_POLLING:
-		                                 LIBTRACE_RINGBUFFER_BLOCKING);
+		libtrace_spsc_ring_init(&t->rbuffer,
+		                        trace->config.hasher_queue_size,
+		                        trace->config.hasher_polling?
+		                                LIBTRACE_SPSC_RING_POLLING:
+		                                LIBTRACE_SPSC_RING_BLOCKING);
+	}
+	if (type == THREAD_PERPKT)
+		libtrace_arena_init(&t->result_arena, RESULT_ARENA_CHUNK_SIZE);
+	if (trace->pread == trace_pread_packet_work_stealing &&
+	    type == THREAD_PERPKT) {
+		t->steal.packets = malloc(trace->config.burst_size *
+		                          sizeof(libtrace_packet_t *));
+		t->steal.state = STEAL_EMPTY;
 	}
 #if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__linux__)
 	if(name)
@@ -1729,9 +2114,10 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
 		if (libtrace->format->start_input) {
 			ret = libtrace->format->start_input(libtrace);
 		}
-		if (libtrace->perpkt_thread_count > 1)
-			libtrace->pread = trace_pread_packet_first_in_first_served;
-		else
+		if (libtrace->perpkt_thread_count > 1) {
+			libtrace->pread = trace_pread_packet_work_stealing;
+			libtrace->read_finished = false;
+		} else
 			/* Use standard read_packet */
 			libtrace->pread = NULL;
 	}
@@ -1842,6 +2228,7 @@ cleanup_threads:
 		for (i = 0; i < libtrace->perpkt_thread_count; i++) {
 			if (libtrace->perpkt_threads[i].type == THREAD_PERPKT) {
 				pthread_join(libtrace->perpkt_threads[i].tid, NULL);
+				free(libtrace->perpkt_threads[i].steal.packets);
 				libtrace_zero_thread(&libtrace->perpkt_threads[i]);
 			} else break;
 		}
@@ -2004,7 +2391,7 @@ DLLEXPORT int trace_ppause(libtrace_t *libtrace)
 				libtrace_packet_t *pkt;
 				libtrace_ocache_alloc(&libtrace->packet_freelist, (void **) &pkt, 1, 1);
 				pkt->error = READ_MESSAGE;
-				libtrace_ringbuffer_write(&libtrace->perpkt_threads[i].rbuffer, pkt);
+				libtrace_spsc_ring_write(&libtrace->perpkt_threads[i].rbuffer, pkt);
 			}
 		} else {
 			fprintf(stderr, "Mapper threads should not be used to pause a trace this could cause any number of problems!!\n");
@@ -2151,6 +2538,10 @@ DLLEXPORT int trace_set_hasher(libtrace_t *trace, enum hasher_types type, fn_has
 					trace->hasher_data = calloc(1, sizeof(toeplitz_conf_t));
 					toeplitz_init_config(trace->hasher_data, 0);
 					return 0;
+				case HASHER_FAST:
+					trace->hasher = (fn_hasher) fast_hash_packet;
+					trace->hasher_data = NULL;
+					return 0;
 			}
 			return -1;
 		}
@@ -2176,7 +2567,7 @@ DLLEXPORT void trace_join(libtrace_t *libtrace) {
 		// the producer (or any other threads) don't block.
 		libtrace_packet_t * packet;
 		assert(libtrace->perpkt_threads[i].state == THREAD_FINISHED);
-		while(libtrace_ringbuffer_try_read(&libtrace->perpkt_threads[i].rbuffer, (void **) &packet))
+		while(libtrace_spsc_ring_try_read(&libtrace->perpkt_threads[i].rbuffer, (void **) &packet))
 			if (packet) // This could be NULL iff the perpkt finishes early
 				trace_destroy_packet(packet);
 	}
@@ -2193,11 +2584,20 @@ DLLEXPORT void trace_join(libtrace_t *libtrace) {
 		// Its possible 1 packet got added by the reporter (or 1 per any other thread) since we cleaned up
 		// if they lost timeslice before-during a write
 		libtrace_packet_t * packet;
-		while(libtrace_ringbuffer_try_read(&libtrace->perpkt_threads[i].rbuffer, (void **) &packet))
+		while(libtrace_spsc_ring_try_read(&libtrace->perpkt_threads[i].rbuffer, (void **) &packet))
 			trace_destroy_packet(packet);
 		if (trace_has_dedicated_hasher(libtrace)) {
-			assert(libtrace_ringbuffer_is_empty(&libtrace->perpkt_threads[i].rbuffer));
-			libtrace_ringbuffer_destroy(&libtrace->perpkt_threads[i].rbuffer);
+			assert(libtrace_spsc_ring_is_empty(&libtrace->perpkt_threads[i].rbuffer));
+			libtrace_spsc_ring_destroy(&libtrace->perpkt_threads[i].rbuffer);
+		}
+		// Anything read ahead but not processed if we were stopped early
+		if (libtrace->pread == trace_pread_packet_work_stealing &&
+		    libtrace->perpkt_threads[i].steal.state == STEAL_READY) {
+			libtrace_packet_t **burst = libtrace->perpkt_threads[i].steal.packets;
+			size_t j;
+			for (j = 0; j < libtrace->config.burst_size && burst[j]; j++)
+				trace_destroy_packet(burst[j]);
+			libtrace->perpkt_threads[i].steal.state = STEAL_EMPTY;
 		}
 		// Cannot destroy vector yet, this happens with trace_destroy
 	}
@@ -2216,7 +2616,6 @@ DLLEXPORT void trace_join(libtrace_t *libtrace) {
 	}
 
 	libtrace_change_state(libtrace, STATE_JOINED, true);
-	print_memory_stats();
 }
 
 DLLEXPORT int libtrace_thread_get_message_count(libtrace_t * libtrace,
@@ -2316,6 +2715,28 @@ DLLEXPORT void trace_publish_result(libtrace_t *libtrace, libtrace_thread_t *t,
 	return;
 }
 
+DLLEXPORT void trace_publish_results(libtrace_t *libtrace, libtrace_thread_t *t, libtrace_result_t *results, size_t nb_results) {
+	size_t i;
+	assert(libtrace->combiner.publish);
+	if (nb_results == 0)
+		return;
+	if (libtrace->combiner.publish_bulk) {
+		libtrace->combiner.publish_bulk(libtrace, t->perpkt_num, &libtrace->combiner, results, nb_results);
+		return;
+	}
+	for (i = 0; i < nb_results; i++)
+		libtrace->combiner.publish(libtrace, t->perpkt_num, &libtrace->combiner, &results[i]);
+}
+
+DLLEXPORT void *trace_alloc_result_payload(libtrace_t *libtrace UNUSED, libtrace_thread_t *t, size_t size) {
+	assert(t->type == THREAD_PERPKT);
+	return libtrace_arena_alloc(&t->result_arena, size);
+}
+
+DLLEXPORT void trace_free_result_payload(void *payload) {
+	libtrace_arena_free(payload);
+}
+
 DLLEXPORT void trace_set_combiner(libtrace_t *trace, const libtrace_combine_t *combiner, libtrace_generic_t config){
 	if (combiner) {
 		trace->combiner = *combiner;
@@ -2409,6 +2830,13 @@ DLLEXPORT int trace_set_fixed_count(libtrace_t *trace, bool fixed) {
 	return 0;
 }
 
+DLLEXPORT int trace_get_packet_cache_stats(libtrace_t *trace,
+                                           libtrace_ocache_stats_t *stats) {
+	if (!trace->packet_freelist.nodes)
+		return -1;
+	return libtrace_ocache_get_stats(&trace->packet_freelist, stats);
+}
+
 DLLEXPORT int trace_set_burst_size(libtrace_t *trace, size_t size) {
 	if (!trace_is_configurable(trace)) return -1;
 
@@ -2423,6 +2851,13 @@ DLLEXPORT int trace_set_hasher_queue_size(libtrace_t *trace, size_t size) {
 	return 0;
 }
 
+DLLEXPORT int trace_set_hasher_threads(libtrace_t *trace, size_t count) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.hasher_threads = count;
+	return 0;
+}
+
 DLLEXPORT int trace_set_hasher_polling(libtrace_t *trace, bool polling) {
 	if (!trace_is_configurable(trace)) return -1;
 
@@ -2489,6 +2924,9 @@ static void config_string(struct user_configuration *uc, char *key, size_t nkey,
 	} else if (strncmp(key, "hasher_queue_size", nkey) == 0
 	           || strncmp(key, "hqs", nkey) == 0) {
 		uc->hasher_queue_size = strtoll(value, NULL, 10);
+	} else if (strncmp(key, "hasher_threads", nkey) == 0
+	           || strncmp(key, "ht", nkey) == 0) {
+		uc->hasher_threads = strtoll(value, NULL, 10);
 	} else if (strncmp(key, "hasher_polling", nkey) == 0
 	           || strncmp(key, "hp", nkey) == 0) {
 		uc->hasher_polling = config_bool_parse(value, nvalue);
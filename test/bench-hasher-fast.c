@@ -0,0 +1,104 @@
+/*
+ * This file is part of libtrace
+ *
+ * Compares the speed of HASHER_FAST against the software Toeplitz hash
+ * HASHER_BIDIRECTIONAL uses, on TCP over IPv4 packets. This is a
+ * benchmark rather than a test, it is built with the tests but not run by
+ * do-tests.sh. test-hasher-fast checks how HASHER_FAST behaves.
+ *
+ * usage: bench-hasher-fast [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "libtrace.h"
+#include "hash_toeplitz.h"
+#include "hash_fast.h"
+
+#define BENCH_FLOWS 256
+#define BENCH_ROUNDS 4000
+
+struct frame {
+	uint8_t data[128];
+	uint16_t len;
+};
+
+static void make_ipv4(struct frame *f, uint32_t src, uint32_t dst,
+                      uint16_t sport, uint16_t dport) {
+	uint8_t *ip;
+	memset(f->data, 0, sizeof(f->data));
+	memset(f->data, 0x11, 12);
+	f->data[12] = 0x08;
+	f->len = 14;
+	ip = f->data + f->len;
+	ip[0] = 0x45;
+	ip[3] = 40;
+	ip[6] = 0x40;
+	ip[8] = 64;
+	ip[9] = TRACE_IPPROTO_TCP;
+	ip[12] = src >> 24; ip[13] = src >> 16; ip[14] = src >> 8; ip[15] = src;
+	ip[16] = dst >> 24; ip[17] = dst >> 16; ip[18] = dst >> 8; ip[19] = dst;
+	ip[20] = sport >> 8; ip[21] = sport & 0xFF;
+	ip[22] = dport >> 8; ip[23] = dport & 0xFF;
+	f->len += 40;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[]) {
+	libtrace_packet_t *packets[BENCH_FLOWS];
+	struct frame frames[BENCH_FLOWS];
+	toeplitz_conf_t *conf;
+	volatile uint64_t sink = 0;
+	unsigned int seed = 1;
+	double start, toeplitz_time, fast_time;
+	int i, j, rounds = BENCH_ROUNDS;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (rounds < 1) {
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < BENCH_FLOWS; i++) {
+		make_ipv4(&frames[i], rand_r(&seed), rand_r(&seed),
+		          rand_r(&seed), rand_r(&seed));
+		packets[i] = trace_create_packet();
+		trace_construct_packet(packets[i], TRACE_TYPE_ETH,
+		                       frames[i].data, frames[i].len);
+	}
+
+	conf = calloc(1, sizeof(toeplitz_conf_t));
+	toeplitz_init_config(conf, 1);
+	conf->hash_ipv4 = 1;
+	conf->hash_tcp_ipv4 = 1;
+
+	start = now();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < BENCH_FLOWS; i++)
+			sink += toeplitz_hash_packet(packets[i], conf);
+	toeplitz_time = now() - start;
+
+	start = now();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < BENCH_FLOWS; i++)
+			sink += fast_hash_packet(packets[i], NULL);
+	fast_time = now() - start;
+
+	printf("toeplitz: %.1fns/packet fast: %.1fns/packet\n",
+	       toeplitz_time * 1e9 / ((double) rounds * BENCH_FLOWS),
+	       fast_time * 1e9 / ((double) rounds * BENCH_FLOWS));
+
+	for (i = 0; i < BENCH_FLOWS; i++)
+		trace_destroy_packet(packets[i]);
+	free(conf);
+	return 0;
+}
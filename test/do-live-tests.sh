@@ -36,6 +36,10 @@ do
 	done
 done
 
+echo
+echo ./test-format-odp
+do_test ./test-format-odp
+
 echo
 echo "Tests passed: $OK"
 echo "Tests failed: $FAIL"
\ No newline at end of file
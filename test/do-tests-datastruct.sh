@@ -21,6 +21,18 @@ echo Testing deque
 do_test ./test-datastruct-deque
 echo Testing ringbuffer
 do_test ./test-datastruct-ringbuffer
+echo Testing spsc ring
+do_test ./test-datastruct-spscring
+echo Testing arena
+do_test ./test-datastruct-arena
+echo Testing message queue
+do_test ./test-datastruct-messagequeue
+echo Testing buffer pool
+do_test ./test-datastruct-bufferpool
+echo Testing object cache
+do_test ./test-datastruct-ocache
+echo Testing buckets
+do_test ./test-datastruct-buckets
 echo
 echo "Tests passed: $OK"
 echo "Tests failed: $FAIL"
@@ -59,6 +59,12 @@ do_test ./test-format-parallel-stressthreads erf
 echo \* Read testing reporter thread
 do_test ./test-format-parallel-reporter erf
 
+echo \* Read testing reporter thread with a compressed trace
+do_test ./test-format-parallel-reporter legacyeth
+
+echo \* Read testing the sorted combiner spilling to disk
+do_test ./test-format-parallel-sorted
+
 echo \* Testing Trace-Time Playback
 do_test ./test-tracetime-parallel
 
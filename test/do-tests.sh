@@ -232,6 +232,9 @@ do_test ./test-autodetect traces/5_packets.erf.xz
 echo " * VXLan decode"
 do_test ./test-vxlan
 
+echo " * HASHER_FAST symmetry"
+do_test ./test-hasher-fast
+
 echo
 echo "Tests passed: $OK"
 echo "Tests failed: $FAIL"
@@ -0,0 +1,84 @@
+#include "data-struct/arena.h"
+#include "data-struct/spsc_ring.h"
+#include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_SIZE 1000000
+#define CHUNK_SIZE 4096
+
+static libtrace_arena_t arena;
+static libtrace_spsc_ring_t ring;
+
+/* Allocates from the arena and passes each allocation to the consumer */
+static void * producer(void * a) {
+	uint32_t i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		/* Vary the size, including some too big for a chunk */
+		size_t size = i % 1000 == 0 ? CHUNK_SIZE * 2 : 8 + i % 100;
+		uint32_t *p = libtrace_arena_alloc(&arena, size);
+		assert(p);
+		assert(((uintptr_t) p & 15) == 0);
+		memset(p, 0xff, size);
+		*p = i;
+		libtrace_spsc_ring_write(&ring, p);
+	}
+	return 0;
+}
+
+/* Checks each allocation and frees it from another thread */
+static void * consumer(void * a) {
+	uint32_t i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		uint32_t *p = libtrace_spsc_ring_read(&ring);
+		assert(*p == i);
+		libtrace_arena_free(p);
+	}
+	return 0;
+}
+
+/**
+ * Tests the arena, first single threaded and then allocating in one thread
+ * while freeing in another.
+ */
+int main() {
+	pthread_t t[2];
+	void *p, *q, *seen[4];
+	int i, j, nb_seen = 0;
+
+	libtrace_arena_init(&arena, CHUNK_SIZE);
+
+	/* Allocations are distinct and don't overlap */
+	p = libtrace_arena_alloc(&arena, 10);
+	q = libtrace_arena_alloc(&arena, 10);
+	assert(p && q);
+	assert((char *) q >= (char *) p + 10);
+	libtrace_arena_free(p);
+	libtrace_arena_free(q);
+	libtrace_arena_free(NULL);
+
+	/* Freed chunks are reused rather than allocating more, so only a
+	 * couple of distinct addresses are ever handed out */
+	for (i = 0; i < 100; i++) {
+		p = libtrace_arena_alloc(&arena, CHUNK_SIZE / 2);
+		for (j = 0; j < nb_seen && seen[j] != p; j++);
+		if (j == nb_seen) {
+			assert(nb_seen < 4);
+			seen[nb_seen++] = p;
+		}
+		libtrace_arena_free(p);
+	}
+
+	libtrace_spsc_ring_init(&ring, 1000, LIBTRACE_SPSC_RING_BLOCKING);
+	pthread_create(&t[0], NULL, producer, NULL);
+	pthread_create(&t[1], NULL, consumer, NULL);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	libtrace_spsc_ring_destroy(&ring);
+
+	libtrace_arena_destroy(&arena);
+	return 0;
+}
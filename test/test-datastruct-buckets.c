@@ -0,0 +1,119 @@
+#include "data-struct/buckets.h"
+#include "data-struct/spsc_ring.h"
+#include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_SIZE 4096
+#define PER_BUFFER 30000
+#define NB_BUFFERS 20
+#define TEST_SIZE 1000000
+
+static libtrace_bucket_t *bucket;
+static libtrace_spsc_ring_t ring;
+
+/* Reads packets into buffers and passes their ids to the consumer */
+static void * producer(void * a) {
+	uint64_t i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		if (i % 1000 == 0)
+			libtrace_create_new_bucket(bucket, malloc(BUFFER_SIZE));
+		libtrace_spsc_ring_write(&ring,
+				(void *) (uintptr_t) libtrace_push_into_bucket(bucket));
+	}
+	return 0;
+}
+
+/* Releases each id from another thread */
+static void * consumer(void * a) {
+	uint64_t i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		uint64_t id = (uintptr_t) libtrace_spsc_ring_read(&ring);
+		assert(id != 0);
+		libtrace_release_bucket_id(bucket, id);
+	}
+	return 0;
+}
+
+static int buffers_held(void) {
+	libtrace_list_node_t *l;
+	int n = 0;
+	for (l = bucket->nodelist->head; l; l = l->next)
+		if ((*(libtrace_bucket_node_t **) l->data)->buffer)
+			n++;
+	return n;
+}
+
+/**
+ * Tests the buckets data structure, first that a buffer can hold more than
+ * the initial number of slots and that a packet which is kept for longer
+ * than MAX_OUTSTANDING ids does not stop buffers being freed or ids being
+ * reused, then that ids can be released from another thread.
+ */
+int main() {
+	uint64_t *ids, kept, *seen;
+	int i, j;
+	pthread_t t[2];
+
+	bucket = libtrace_bucket_init();
+	ids = malloc(sizeof(uint64_t) * PER_BUFFER);
+	seen = calloc(PER_BUFFER, sizeof(uint64_t));
+	assert(ids && seen);
+
+	/* Nothing to push into yet */
+	assert(libtrace_push_into_bucket(bucket) == 0);
+
+	libtrace_create_new_bucket(bucket, malloc(BUFFER_SIZE));
+	kept = libtrace_push_into_bucket(bucket);
+	assert(kept != 0);
+
+	for (i = 0; i < NB_BUFFERS; i++) {
+		if (i > 0)
+			libtrace_create_new_bucket(bucket, malloc(BUFFER_SIZE));
+		for (j = 0; j < PER_BUFFER; j++) {
+			ids[j] = libtrace_push_into_bucket(bucket);
+			assert(ids[j] != 0 && ids[j] != kept);
+		}
+		/* Keep the last packet of this buffer until the next one
+		 * is done with, as a format reading into two packets would */
+		for (j = 0; j < PER_BUFFER - 1; j++)
+			libtrace_release_bucket_id(bucket, ids[j]);
+		if (i > 0)
+			libtrace_release_bucket_id(bucket, seen[PER_BUFFER - 1]);
+		memcpy(seen, ids, sizeof(uint64_t) * PER_BUFFER);
+		/* Only the buffer holding kept, the previous and the current
+		 * one have not been freed */
+		assert(buffers_held() <= 3);
+	}
+	libtrace_release_bucket_id(bucket, seen[PER_BUFFER - 1]);
+	libtrace_release_bucket_id(bucket, kept);
+	/* Everything but the current buffer has been freed */
+	assert(libtrace_list_get_size(bucket->nodelist) == 1);
+	libtrace_bucket_destroy(bucket);
+
+	/* Buffers still held are freed by destroy */
+	bucket = libtrace_bucket_init();
+	libtrace_create_new_bucket(bucket, malloc(BUFFER_SIZE));
+	libtrace_push_into_bucket(bucket);
+	libtrace_create_new_bucket(bucket, malloc(BUFFER_SIZE));
+	libtrace_push_into_bucket(bucket);
+	libtrace_bucket_destroy(bucket);
+
+	bucket = libtrace_bucket_init();
+	libtrace_spsc_ring_init(&ring, 1000, LIBTRACE_SPSC_RING_BLOCKING);
+	pthread_create(&t[0], NULL, producer, NULL);
+	pthread_create(&t[1], NULL, consumer, NULL);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	libtrace_spsc_ring_destroy(&ring);
+	assert(libtrace_list_get_size(bucket->nodelist) == 1);
+	libtrace_bucket_destroy(bucket);
+
+	free(ids);
+	free(seen);
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include "data-struct/buffer_pool.h"
+#include "data-struct/spsc_ring.h"
+#include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SIZE 1000000
+
+static libtrace_spsc_ring_t ring;
+
+/* Allocates buffers of varying sizes and passes them to the consumer */
+static void * producer(void * a) {
+	uint32_t i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		size_t size = 4 + (i * 7919) % (LIBTRACE_PACKET_BUFSIZE - 4);
+		uint32_t *p = libtrace_buffer_pool_alloc(size);
+		assert(p);
+		assert(libtrace_buffer_pool_size(p) >= size);
+		/* Touch the end, an undersized buffer would overlap another */
+		((char *) p)[size - 1] = 0;
+		*p = i;
+		libtrace_spsc_ring_write(&ring, p);
+	}
+	return 0;
+}
+
+/* Checks each buffer and frees it from another thread */
+static void * consumer(void * a) {
+	uint32_t i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		uint32_t *p = libtrace_spsc_ring_read(&ring);
+		assert(*p == i);
+		libtrace_buffer_pool_free(p);
+	}
+	return 0;
+}
+
+/**
+ * Tests the buffer pool, first single threaded and then allocating in one
+ * thread while freeing in another.
+ */
+int main() {
+	pthread_t t[2];
+	void *p, *q;
+	int i;
+
+	/* Small buffers are not given a full LIBTRACE_PACKET_BUFSIZE */
+	p = libtrace_buffer_pool_alloc(100);
+	q = libtrace_buffer_pool_alloc(100);
+	assert(p && q && p != q);
+	assert(libtrace_buffer_pool_size(p) >= 100);
+	assert(libtrace_buffer_pool_size(p) <= LIBTRACE_PACKET_BUFSIZE);
+	memset(p, 0, 100);
+	memset(q, 0, 100);
+
+	/* Freed buffers are reused */
+	libtrace_buffer_pool_free(q);
+	for (i = 0; i < 100; i++) {
+		q = libtrace_buffer_pool_alloc(100);
+		libtrace_buffer_pool_free(q);
+		assert(q == libtrace_buffer_pool_alloc(100));
+		libtrace_buffer_pool_free(q);
+	}
+	libtrace_buffer_pool_free(p);
+
+	/* The largest class holds a whole LIBTRACE_PACKET_BUFSIZE */
+	p = libtrace_buffer_pool_alloc(LIBTRACE_PACKET_BUFSIZE);
+	assert(libtrace_buffer_pool_size(p) == LIBTRACE_PACKET_BUFSIZE);
+	memset(p, 0, LIBTRACE_PACKET_BUFSIZE);
+	libtrace_buffer_pool_free(p);
+
+	/* Buffers from malloc() may be freed, but their size is unknown */
+	p = malloc(16);
+	assert(libtrace_buffer_pool_size(p) == 0);
+	libtrace_buffer_pool_free(p);
+
+	/* As are ones too large for any class */
+	p = libtrace_buffer_pool_alloc(LIBTRACE_PACKET_BUFSIZE + 1);
+	assert(p && libtrace_buffer_pool_size(p) == 0);
+	libtrace_buffer_pool_free(p);
+
+	libtrace_spsc_ring_init(&ring, 1000, LIBTRACE_SPSC_RING_BLOCKING);
+	pthread_create(&t[0], NULL, producer, NULL);
+	pthread_create(&t[1], NULL, consumer, NULL);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	libtrace_spsc_ring_destroy(&ring);
+	return 0;
+}
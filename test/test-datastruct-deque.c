@@ -75,6 +75,13 @@ int main() {
 	pthread_join(t[0], NULL);
 	pthread_join(t[1], NULL);
 	assert(libtrace_deque_get_size(&deque) == 0);
+	libtrace_deque_destroy(&deque);
+
+	// Destroying frees anything left behind
+	libtrace_deque_init(&deque, sizeof(int));
+	for (i = 0; i < 100; i++)
+		libtrace_deque_push_back(&deque, &i);
+	libtrace_deque_destroy(&deque);
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "data-struct/message_queue.h"
+#include <pthread.h>
+#include <assert.h>
+#include <poll.h>
+
+#define TEST_SIZE 1000000
+#define NB_WRITERS 4
+
+typedef struct test_message {
+	int writer;
+	int seq;
+} test_message_t;
+
+static libtrace_message_queue_t mq;
+
+static void * writer(void * a) {
+	test_message_t msg;
+	msg.writer = (int) (intptr_t) a;
+	for (msg.seq = 0; msg.seq < TEST_SIZE; msg.seq++) {
+		assert(libtrace_message_queue_put(&mq, &msg) >= 1);
+	}
+	return 0;
+}
+
+/* Checks that each writer's messages arrive in the order they were sent */
+static void check(int *next, const test_message_t *msg) {
+	assert(msg->writer >= 0 && msg->writer < NB_WRITERS);
+	assert(next[msg->writer] == msg->seq);
+	next[msg->writer]++;
+}
+
+static void * reader_blocking(void * a) {
+	int next[NB_WRITERS] = {0};
+	test_message_t msg;
+	int i;
+	(void) a;
+	for (i = 0; i < TEST_SIZE * NB_WRITERS; i++) {
+		assert(libtrace_message_queue_get(&mq, &msg) >= 0);
+		check(next, &msg);
+	}
+	return 0;
+}
+
+static void * reader_polling(void * a) {
+	int next[NB_WRITERS] = {0};
+	test_message_t msg;
+	struct pollfd pfd;
+	int i = 0;
+	(void) a;
+	while (i < TEST_SIZE * NB_WRITERS) {
+		if (libtrace_message_queue_try_get(&mq, &msg) != LIBTRACE_MQ_FAILED) {
+			check(next, &msg);
+			i++;
+			continue;
+		}
+		pfd.fd = libtrace_message_queue_get_fd(&mq);
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		assert(poll(&pfd, 1, -1) == 1);
+	}
+	return 0;
+}
+
+static void run(void *(*reader)(void *)) {
+	pthread_t t[NB_WRITERS + 1];
+	int i;
+
+	libtrace_message_queue_init(&mq, sizeof(test_message_t));
+	pthread_create(&t[NB_WRITERS], NULL, reader, NULL);
+	for (i = 0; i < NB_WRITERS; i++)
+		pthread_create(&t[i], NULL, writer, (void *) (intptr_t) i);
+	for (i = 0; i <= NB_WRITERS; i++)
+		pthread_join(t[i], NULL);
+	assert(libtrace_message_queue_count(&mq) == 0);
+	libtrace_message_queue_destroy(&mq);
+}
+
+/**
+ * Tests the message queue, first single threaded and then with several
+ * writers and a reader that either blocks in get() or polls the fd.
+ */
+int main() {
+	test_message_t msg = {0, 0};
+	struct pollfd pfd;
+
+	libtrace_message_queue_init(&mq, sizeof(test_message_t));
+	assert(libtrace_message_queue_try_get(&mq, &msg) == LIBTRACE_MQ_FAILED);
+
+	// An armed, empty queue must not poll as readable
+	pfd.fd = libtrace_message_queue_get_fd(&mq);
+	pfd.events = POLLIN;
+	assert(poll(&pfd, 1, 0) == 0);
+
+	// But must once a message is put
+	msg.seq = 1;
+	assert(libtrace_message_queue_put(&mq, &msg) == 1);
+	assert(poll(&pfd, 1, 0) == 1);
+	msg.seq = 2;
+	assert(libtrace_message_queue_put(&mq, &msg) == 2);
+	assert(libtrace_message_queue_count(&mq) == 2);
+	assert(libtrace_message_queue_get(&mq, &msg) == 1 && msg.seq == 1);
+	assert(libtrace_message_queue_try_get(&mq, &msg) == 0 && msg.seq == 2);
+	assert(libtrace_message_queue_try_get(&mq, &msg) == LIBTRACE_MQ_FAILED);
+
+	// Once drained it is quiet again
+	pfd.fd = libtrace_message_queue_get_fd(&mq);
+	assert(poll(&pfd, 1, 0) == 0);
+	libtrace_message_queue_destroy(&mq);
+
+	run(reader_blocking);
+	run(reader_polling);
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include "data-struct/object_cache.h"
+#include <pthread.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#define TEST_SIZE 100000
+#define NB_THREADS 4
+#define CACHE_SIZE 32
+#define BUFFER_SIZE 256
+#define BURST 10
+
+static libtrace_ocache_t oc;
+static int allocs = 0;
+
+static void *alloc_object(void) {
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return malloc(sizeof(int));
+}
+
+static void free_object(void *obj) {
+	__atomic_sub_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	free(obj);
+}
+
+/* Repeatedly takes a burst of objects and gives them back */
+static void * worker(void * a) {
+	void *values[BURST];
+	int i, j;
+	(void) a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		size_t nb = 1 + i % BURST;
+		assert(libtrace_ocache_alloc(&oc, values, nb, nb) == nb);
+		for (j = 0; j < (int) nb; j++)
+			*(int *) values[j] = i;
+		libtrace_ocache_free(&oc, values, nb, nb);
+	}
+	libtrace_ocache_unregister_thread(&oc);
+	return 0;
+}
+
+static void run(size_t thread_cache_size, bool limit_size) {
+	pthread_t t[NB_THREADS];
+	int i;
+
+	assert(libtrace_ocache_init(&oc, alloc_object, free_object,
+	                            thread_cache_size, BUFFER_SIZE,
+	                            limit_size) == 0);
+	for (i = 0; i < NB_THREADS; i++)
+		pthread_create(&t[i], NULL, worker, NULL);
+	for (i = 0; i < NB_THREADS; i++)
+		pthread_join(t[i], NULL);
+	if (limit_size)
+		assert(allocs <= BUFFER_SIZE);
+	assert(libtrace_ocache_destroy(&oc) == 0);
+	assert(allocs == 0);
+}
+
+/**
+ * Tests the object cache with several threads sharing it, with and without
+ * thread caches and with and without a limit on the number of objects.
+ */
+int main() {
+	libtrace_ocache_stats_t stats;
+	void *value;
+
+	/* Objects freed by a thread are reused by it */
+	assert(libtrace_ocache_init(&oc, alloc_object, free_object,
+	                            CACHE_SIZE, BUFFER_SIZE, false) == 0);
+	assert(libtrace_ocache_alloc(&oc, &value, 1, 1) == 1);
+	assert(allocs == 1);
+	libtrace_ocache_free(&oc, &value, 1, 1);
+	assert(libtrace_ocache_alloc(&oc, &value, 1, 1) == 1);
+	assert(allocs == 1);
+	libtrace_ocache_free(&oc, &value, 1, 1);
+	if (libtrace_ocache_get_stats(&oc, &stats) == 0) {
+		assert(stats.read.miss == 1);
+		assert(stats.read.cache_hit == 1);
+	}
+	libtrace_ocache_unregister_thread(&oc);
+	assert(libtrace_ocache_destroy(&oc) == 0);
+	assert(allocs == 0);
+
+	run(CACHE_SIZE, false);
+	run(CACHE_SIZE, true);
+	run(0, false);
+	run(0, true);
+	return 0;
+}
@@ -0,0 +1,163 @@
+#include "data-struct/spsc_ring.h"
+#include <pthread.h>
+#include <assert.h>
+
+#define TEST_SIZE ((char *) 1000000)
+#define RING_SIZE ((char *) 1000)
+#define BULK_SIZE 64
+
+static void * producer(void * a) {
+	libtrace_spsc_ring_t * rb = (libtrace_spsc_ring_t *) a;
+	char * i;
+	for (i = NULL; i < TEST_SIZE; i++) {
+		libtrace_spsc_ring_write(rb, i);
+	}
+	return 0;
+}
+
+static void * consumer(void * a) {
+	libtrace_spsc_ring_t * rb = (libtrace_spsc_ring_t *) a;
+	char *i;
+	void *value;
+	for (i = NULL; i < TEST_SIZE; i++) {
+		value = libtrace_spsc_ring_read(rb);
+		assert(value == i);
+	}
+	return 0;
+}
+
+static void * producer_bulk(void * a) {
+	libtrace_spsc_ring_t * rb = (libtrace_spsc_ring_t *) a;
+	void *values[BULK_SIZE];
+	char * i = NULL;
+	size_t j, nb, nb_written;
+	while (i < TEST_SIZE) {
+		nb = BULK_SIZE;
+		if ((size_t) (TEST_SIZE - i) < nb)
+			nb = TEST_SIZE - i;
+		for (j = 0; j < nb; j++)
+			values[j] = i + j;
+		nb_written = libtrace_spsc_ring_write_bulk(rb, values, nb, 1);
+		assert(nb_written >= 1 && nb_written <= nb);
+		i += nb_written;
+	}
+	return 0;
+}
+
+static void * consumer_bulk(void * a) {
+	libtrace_spsc_ring_t * rb = (libtrace_spsc_ring_t *) a;
+	void *values[BULK_SIZE];
+	char *i = NULL;
+	size_t j, nb;
+	while (i < TEST_SIZE) {
+		nb = libtrace_spsc_ring_read_bulk(rb, values, BULK_SIZE, 1);
+		assert(nb >= 1 && nb <= BULK_SIZE);
+		for (j = 0; j < nb; j++, i++)
+			assert(values[j] == i);
+	}
+	return 0;
+}
+
+
+/**
+ * Tests the spsc ring data structure, first this establishes that single
+ * threaded operations work correctly, then does a basic consumer producer
+ * thread-safety test with both single and bulk operations.
+ */
+int main() {
+	char *i;
+	void *value;
+	void *values[BULK_SIZE] = {0};
+	pthread_t t[2];
+	libtrace_spsc_ring_t rb_block;
+	libtrace_spsc_ring_t rb_polling;
+
+	// A size which is not a power of two must still hold exactly that many
+	assert(libtrace_spsc_ring_init(&rb_block, (size_t) RING_SIZE, LIBTRACE_SPSC_RING_BLOCKING) == 0);
+	assert(libtrace_spsc_ring_init(&rb_polling, (size_t) RING_SIZE, LIBTRACE_SPSC_RING_POLLING) == 0);
+	assert(libtrace_spsc_ring_is_empty(&rb_block));
+	assert(libtrace_spsc_ring_is_empty(&rb_polling));
+
+	for (i = NULL; i < RING_SIZE; i++) {
+		value = (void *) i;
+		libtrace_spsc_ring_write(&rb_block, value);
+		libtrace_spsc_ring_write(&rb_polling, value);
+	}
+
+	assert(libtrace_spsc_ring_is_full(&rb_block));
+	assert(libtrace_spsc_ring_is_full(&rb_polling));
+
+	// Full so trying to write should fail
+	assert(!libtrace_spsc_ring_try_write(&rb_block, value));
+	assert(!libtrace_spsc_ring_try_write(&rb_polling, value));
+	assert(libtrace_spsc_ring_write_bulk(&rb_block, values, BULK_SIZE, 0) == 0);
+	assert(libtrace_spsc_ring_write_bulk(&rb_polling, values, BULK_SIZE, 0) == 0);
+
+	// Cycle the buffer a few times
+	for (i = NULL; i < TEST_SIZE; i++) {
+		value = (void *) -1;
+		value = libtrace_spsc_ring_read(&rb_block);
+		assert(value == (void *) i);
+		value = (void *) -1;
+		value = libtrace_spsc_ring_read(&rb_polling);
+		assert(value == (void *) i);
+		value = (void *) (i + (size_t) RING_SIZE);
+		libtrace_spsc_ring_write(&rb_block, value);
+		libtrace_spsc_ring_write(&rb_polling, value);
+	}
+
+	// Empty it completely
+	for (i = TEST_SIZE; i < TEST_SIZE + (size_t) RING_SIZE; i++) {
+		value = libtrace_spsc_ring_read(&rb_block);
+		assert(value == (void *) i);
+		value = libtrace_spsc_ring_read(&rb_polling);
+		assert(value == (void *) i);
+	}
+	assert(libtrace_spsc_ring_is_empty(&rb_block));
+	assert(libtrace_spsc_ring_is_empty(&rb_polling));
+
+	// Empty so trying to read should fail
+	assert(!libtrace_spsc_ring_try_read(&rb_block, &value));
+	assert(!libtrace_spsc_ring_try_read(&rb_polling, &value));
+	assert(libtrace_spsc_ring_read_bulk(&rb_block, values, BULK_SIZE, 0) == 0);
+	assert(libtrace_spsc_ring_read_bulk(&rb_polling, values, BULK_SIZE, 0) == 0);
+
+	// A partial bulk write only takes what fits
+	for (i = NULL; i < RING_SIZE - 10; i++)
+		libtrace_spsc_ring_write(&rb_block, i);
+	assert(libtrace_spsc_ring_write_bulk(&rb_block, values, BULK_SIZE, 0) == 10);
+	assert(libtrace_spsc_ring_is_full(&rb_block));
+	assert(libtrace_spsc_ring_read_bulk(&rb_block, values, BULK_SIZE, 0) == BULK_SIZE);
+	assert(values[0] == NULL && values[BULK_SIZE - 1] == (void *) (BULK_SIZE - 1));
+	while (libtrace_spsc_ring_try_read(&rb_block, &value));
+	assert(libtrace_spsc_ring_is_empty(&rb_block));
+
+	// Test thread safety
+	pthread_create(&t[0], NULL, &producer, (void *) &rb_block);
+	pthread_create(&t[1], NULL, &consumer, (void *) &rb_block);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_spsc_ring_is_empty(&rb_block));
+
+	pthread_create(&t[0], NULL, &producer, (void *) &rb_polling);
+	pthread_create(&t[1], NULL, &consumer, (void *) &rb_polling);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_spsc_ring_is_empty(&rb_polling));
+
+	pthread_create(&t[0], NULL, &producer_bulk, (void *) &rb_block);
+	pthread_create(&t[1], NULL, &consumer_bulk, (void *) &rb_block);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_spsc_ring_is_empty(&rb_block));
+
+	pthread_create(&t[0], NULL, &producer_bulk, (void *) &rb_polling);
+	pthread_create(&t[1], NULL, &consumer_bulk, (void *) &rb_polling);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_spsc_ring_is_empty(&rb_polling));
+
+	libtrace_spsc_ring_destroy(&rb_block);
+	libtrace_spsc_ring_destroy(&rb_polling);
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * This file is part of libtrace
+ *
+ * Writes packets to the ODP format through a pcap pktio and reads them
+ * back from the file it writes. Packets read from an ODP input are sent
+ * by reference, while trimmed packets and packets from other formats are
+ * copied. None of them may change the packet that was written.
+ *
+ * Needs an ODP with the pcap pktio, and whatever privileges ODP needs to
+ * start, so it is run with the live tests.
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "libtrace.h"
+
+#define ODP_IN "odp:port=pcap:in=traces/100_packets.pcap"
+#define ODP_OUT "odp:port=pcap:out=traces/100_packets.out.odp.pcap"
+#define PCAP_IN "pcapfile:traces/100_packets.pcap"
+#define PCAP_CHECK "pcapfile:traces/100_packets.out.odp.pcap"
+
+/* Read from ODP, the last is read from pcapfile */
+#define NB_PACKETS 100
+/* Every fourth ODP packet is trimmed to this, so it has to be copied */
+#define TRIM_LEN 60
+
+static size_t lengths[NB_PACKETS + 1];
+static uint32_t sums[NB_PACKETS + 1];
+
+static void iferr_out(libtrace_out_t *trace)
+{
+	libtrace_err_t err = trace_get_err_output(trace);
+	if (err.err_num == 0)
+		return;
+	printf("Error: %s\n", err.problem);
+	exit(1);
+}
+
+static void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num == 0)
+		return;
+	printf("Error: %s\n", err.problem);
+	exit(1);
+}
+
+static void signal_handler(int signal)
+{
+	if (signal == SIGALRM) {
+		fprintf(stderr, "!!!Timeout after 10 seconds!!!\n");
+		exit(1);
+	}
+}
+
+static uint32_t checksum(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sum = sum * 31 + p[i];
+	return sum;
+}
+
+/* Writes a packet and checks it is the same afterwards */
+static void write_packet(libtrace_out_t *out, libtrace_packet_t *packet,
+                         int i)
+{
+	void *buffer = packet->buffer;
+	void *payload = packet->payload;
+	size_t caplen = trace_get_capture_length(packet);
+	uint32_t sum = checksum(payload, caplen);
+
+	if (trace_write_packet(out, packet) != (int) caplen)
+		iferr_out(out);
+
+	assert(packet->buffer == buffer);
+	assert(packet->payload == payload);
+	assert(trace_get_capture_length(packet) == caplen);
+	assert(checksum(packet->payload, caplen) == sum);
+
+	lengths[i] = caplen;
+	sums[i] = sum;
+}
+
+int main()
+{
+	libtrace_out_t *out;
+	libtrace_t *in;
+	libtrace_packet_t *packet;
+	int i;
+
+	signal(SIGALRM, signal_handler);
+	alarm(10);
+
+	out = trace_create_output(ODP_OUT);
+	iferr_out(out);
+	trace_start_output(out);
+	iferr_out(out);
+
+	in = trace_create(ODP_IN);
+	iferr(in);
+	trace_start(in);
+	iferr(in);
+
+	packet = trace_create_packet();
+	for (i = 0; i < NB_PACKETS; i++) {
+		if (trace_read_packet(in, packet) <= 0) {
+			iferr(in);
+			fprintf(stderr, "Error: read %d of %d packets\n", i,
+			        NB_PACKETS);
+			return 1;
+		}
+		if (i % 4 == 3 && trace_get_capture_length(packet) > TRIM_LEN)
+			trace_set_capture_length(packet, TRIM_LEN);
+		write_packet(out, packet, i);
+	}
+	trace_destroy_packet(packet);
+	trace_destroy(in);
+
+	/* A packet from another format is copied */
+	in = trace_create(PCAP_IN);
+	iferr(in);
+	trace_start(in);
+	iferr(in);
+	packet = trace_create_packet();
+	if (trace_read_packet(in, packet) <= 0) {
+		iferr(in);
+		return 1;
+	}
+	write_packet(out, packet, NB_PACKETS);
+	trace_destroy_packet(packet);
+	trace_destroy(in);
+
+	/* Sends whatever is still waiting for a full burst */
+	trace_destroy_output(out);
+
+	in = trace_create(PCAP_CHECK);
+	iferr(in);
+	trace_start(in);
+	iferr(in);
+	packet = trace_create_packet();
+	for (i = 0; i <= NB_PACKETS; i++) {
+		if (trace_read_packet(in, packet) <= 0) {
+			iferr(in);
+			fprintf(stderr, "Error: only %d of %d packets were "
+			        "written\n", i, NB_PACKETS + 1);
+			return 1;
+		}
+		assert(trace_get_capture_length(packet) == lengths[i]);
+		assert(checksum(packet->payload, lengths[i]) == sums[i]);
+	}
+	assert(trace_read_packet(in, packet) == 0);
+	trace_destroy_packet(packet);
+	trace_destroy(in);
+
+	printf("success\n");
+	return 0;
+}
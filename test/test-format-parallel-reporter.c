@@ -103,6 +103,10 @@ struct final {
         int packets;
 };
 
+/* Uncompressed pcap and ERF files are read in parallel and each packet is
+ * ordered by where it is in the file, so the keys are not consecutive */
+static bool keys_are_offsets = false;
+
 static void *report_start(libtrace_t *trace UNUSED,
                 libtrace_thread_t *t UNUSED,
                 void *global) {
@@ -127,7 +131,9 @@ static void report_cb(libtrace_t *trace UNUSED,
         assert(*magic == 0xabcdef);
         assert(res->type == RESULT_PACKET);
       
-        if (threadcounter->last != 0)
+        if (threadcounter->last != 0 && keys_are_offsets)
+                assert(threadcounter->last < res->key);
+        else if (threadcounter->last != 0)
                 assert(threadcounter->last + 1 == res->key);
         threadcounter->last = res->key;
 
@@ -288,6 +294,9 @@ int main(int argc, char *argv[]) {
 	}
 
 	tracename = lookup_uri(argv[1]);
+	keys_are_offsets = !strcmp(argv[1], "erf") ||
+	                   !strcmp(argv[1], "pcapfile") ||
+	                   !strcmp(argv[1], "pcapfilens");
 
 	trace = trace_create(tracename);
 	iferr(trace,tracename);
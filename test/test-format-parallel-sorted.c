@@ -0,0 +1,139 @@
+/*
+ * This file is part of libtrace
+ *
+ * Checks combiner_sorted with a reorder window small enough that results
+ * are spilled to disk many times over, so that runs are merged both as
+ * they pile up and as they are read back.
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "libtrace_parallel.h"
+
+/* 100 packets each publishing this many results */
+#define RESULTS_PER_PACKET 1000
+#define NB_RESULTS (100 * RESULTS_PER_PACKET)
+/* Far fewer than we publish, more than 64 spills forces runs to merge */
+#define WINDOW 100
+
+static uint64_t published_sum = 0;
+static uint64_t received_sum = 0;
+static uint64_t received = 0;
+
+void iferr(libtrace_t *trace,const char *msg)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s: %s\n", msg, err.problem);
+	exit(1);
+}
+
+/* Scatters the keys so every thread's results arrive out of order */
+static uint64_t make_key(uint64_t order, int i) {
+	uint64_t x = order * RESULTS_PER_PACKET + i + 1;
+	x ^= x >> 31;
+	x *= 0x7fb5d329728ea185ULL;
+	x ^= x >> 27;
+	return x >> 1;
+}
+
+static libtrace_packet_t *per_packet(libtrace_t *trace,
+                libtrace_thread_t *t,
+                void *global UNUSED, void *tls UNUSED,
+                libtrace_packet_t *packet) {
+	uint64_t order = trace_packet_get_order(packet);
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < RESULTS_PER_PACKET; i++) {
+		uint64_t key = make_key(order, i);
+		trace_publish_result(trace, t, key,
+		                     (libtrace_generic_t){.uint64 = key},
+		                     RESULT_USER);
+		sum += key;
+	}
+	__atomic_fetch_add(&published_sum, sum, __ATOMIC_RELAXED);
+	return packet;
+}
+
+static void *report_start(libtrace_t *trace UNUSED,
+                libtrace_thread_t *t UNUSED, void *global UNUSED) {
+	uint64_t *last = malloc(sizeof(uint64_t));
+	*last = 0;
+	return last;
+}
+
+static void report_cb(libtrace_t *trace UNUSED,
+                libtrace_thread_t *sender UNUSED,
+                void *global UNUSED, void *tls, libtrace_result_t *res) {
+	uint64_t *last = (uint64_t *)tls;
+
+	assert(res->type == RESULT_USER);
+	assert(res->value.uint64 == res->key);
+	assert(*last <= res->key);
+	*last = res->key;
+	received_sum += res->key;
+	received++;
+}
+
+static void report_end(libtrace_t *trace UNUSED, libtrace_thread_t *t UNUSED,
+                void *global UNUSED, void *tls) {
+	free(tls);
+}
+
+int main(int argc, char *argv[]) {
+	const char *tracename = "erf:traces/100_packets.erf";
+	libtrace_t *trace;
+	libtrace_callback_set_t *processing = NULL;
+	libtrace_callback_set_t *reporter = NULL;
+
+	if (argc > 1)
+		tracename = argv[1];
+
+	trace = trace_create(tracename);
+	iferr(trace,tracename);
+
+	processing = trace_create_callback_set();
+	trace_set_packet_cb(processing, per_packet);
+
+	reporter = trace_create_callback_set();
+	trace_set_starting_cb(reporter, report_start);
+	trace_set_stopping_cb(reporter, report_end);
+	trace_set_result_cb(reporter, report_cb);
+
+	trace_set_perpkt_threads(trace, 4);
+	trace_set_combiner(trace, &combiner_sorted,
+	                   (libtrace_generic_t){.uint64 = WINDOW});
+
+	trace_pstart(trace, NULL, processing, reporter);
+	iferr(trace,tracename);
+	trace_join(trace);
+	iferr(trace,tracename);
+
+	assert(received == NB_RESULTS);
+	assert(received_sum == published_sum);
+
+	trace_destroy(trace);
+	trace_destroy_callback_set(processing);
+	trace_destroy_callback_set(reporter);
+	printf("success\n");
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of libtrace
+ *
+ * Checks HASHER_FAST gives both directions of a flow the same hash and
+ * different flows different hashes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "libtrace.h"
+#include "hash_fast.h"
+
+#define NB_FLOWS 256
+
+struct frame {
+	uint8_t data[128];
+	uint16_t len;
+};
+
+static uint16_t put_eth(uint8_t *buf, int vlan, uint16_t ethertype) {
+	uint16_t len = 12;
+	memset(buf, 0x11, 12);
+	if (vlan) {
+		buf[len++] = 0x81; buf[len++] = 0x00;
+		buf[len++] = 0x00; buf[len++] = 0x64;
+	}
+	buf[len++] = ethertype >> 8;
+	buf[len++] = ethertype & 0xFF;
+	return len;
+}
+
+static void put_ports(uint8_t *buf, uint16_t sport, uint16_t dport) {
+	buf[0] = sport >> 8; buf[1] = sport & 0xFF;
+	buf[2] = dport >> 8; buf[3] = dport & 0xFF;
+}
+
+static void make_ipv4(struct frame *f, int vlan, uint8_t proto, uint32_t src,
+                      uint32_t dst, uint16_t sport, uint16_t dport, int frag) {
+	uint8_t *ip;
+	memset(f->data, 0, sizeof(f->data));
+	f->len = put_eth(f->data, vlan, 0x0800);
+	ip = f->data + f->len;
+	ip[0] = 0x45;
+	ip[3] = 40;
+	ip[6] = frag ? 0x20 : 0x40;
+	ip[8] = 64;
+	ip[9] = proto;
+	ip[12] = src >> 24; ip[13] = src >> 16; ip[14] = src >> 8; ip[15] = src;
+	ip[16] = dst >> 24; ip[17] = dst >> 16; ip[18] = dst >> 8; ip[19] = dst;
+	put_ports(ip + 20, sport, dport);
+	f->len += 40;
+}
+
+static void make_ipv6(struct frame *f, uint8_t proto, const uint8_t *src,
+                      const uint8_t *dst, uint16_t sport, uint16_t dport,
+                      int dstopts) {
+	uint8_t *ip;
+	memset(f->data, 0, sizeof(f->data));
+	f->len = put_eth(f->data, 0, 0x86DD);
+	ip = f->data + f->len;
+	ip[0] = 0x60;
+	ip[5] = dstopts ? 28 : 20;
+	ip[6] = dstopts ? 60 : proto;
+	ip[7] = 64;
+	memcpy(ip + 8, src, 16);
+	memcpy(ip + 24, dst, 16);
+	ip += 40;
+	if (dstopts) {
+		ip[0] = proto;
+		ip[1] = 0;
+		ip += 8;
+	}
+	put_ports(ip, sport, dport);
+	f->len = ip + 20 - f->data;
+}
+
+static uint64_t hash_frame(libtrace_packet_t *packet, const struct frame *f) {
+	trace_construct_packet(packet, TRACE_TYPE_ETH, f->data, f->len);
+	return fast_hash_packet(packet, NULL);
+}
+
+int main() {
+	libtrace_packet_t *packet = trace_create_packet();
+	libtrace_packet_t *packets[NB_FLOWS];
+	struct frame fwd, rev, frames[NB_FLOWS];
+	uint8_t a6[16], b6[16];
+	unsigned int seed = 1;
+	int i, differ = 0;
+
+	/* Both directions of each kind of flow must hash the same */
+	make_ipv4(&fwd, 0, TRACE_IPPROTO_TCP, 0x0A000001, 0xC0A80102, 1234, 80, 0);
+	make_ipv4(&rev, 0, TRACE_IPPROTO_TCP, 0xC0A80102, 0x0A000001, 80, 1234, 0);
+	assert(hash_frame(packet, &fwd) == hash_frame(packet, &rev));
+
+	make_ipv4(&fwd, 1, TRACE_IPPROTO_UDP, 0x0A000001, 0x0A000001, 53, 5353, 0);
+	make_ipv4(&rev, 1, TRACE_IPPROTO_UDP, 0x0A000001, 0x0A000001, 5353, 53, 0);
+	assert(hash_frame(packet, &fwd) == hash_frame(packet, &rev));
+
+	/* A fragment is hashed without ports */
+	make_ipv4(&fwd, 0, TRACE_IPPROTO_UDP, 0x0A000001, 0xC0A80102, 1, 2, 1);
+	make_ipv4(&rev, 0, TRACE_IPPROTO_UDP, 0xC0A80102, 0x0A000001, 3, 4, 1);
+	assert(hash_frame(packet, &fwd) == hash_frame(packet, &rev));
+
+	memset(a6, 0, 16); a6[0] = 0x20; a6[1] = 0x01; a6[15] = 1;
+	memset(b6, 0, 16); b6[0] = 0x20; b6[1] = 0x01; b6[15] = 2;
+	make_ipv6(&fwd, TRACE_IPPROTO_TCP, a6, b6, 40000, 443, 0);
+	make_ipv6(&rev, TRACE_IPPROTO_TCP, b6, a6, 443, 40000, 0);
+	assert(hash_frame(packet, &fwd) == hash_frame(packet, &rev));
+
+	make_ipv6(&fwd, TRACE_IPPROTO_UDP, a6, b6, 40000, 443, 1);
+	make_ipv6(&rev, TRACE_IPPROTO_UDP, b6, a6, 443, 40000, 0);
+	assert(hash_frame(packet, &fwd) == hash_frame(packet, &rev));
+
+	/* And different flows should not */
+	for (i = 0; i < NB_FLOWS; i++) {
+		make_ipv4(&frames[i], 0, TRACE_IPPROTO_TCP, rand_r(&seed),
+		          rand_r(&seed), rand_r(&seed), rand_r(&seed), 0);
+		packets[i] = trace_create_packet();
+		trace_construct_packet(packets[i], TRACE_TYPE_ETH,
+		                       frames[i].data, frames[i].len);
+	}
+	for (i = 1; i < NB_FLOWS; i++) {
+		if (fast_hash_packet(packets[i], NULL) != fast_hash_packet(packets[i-1], NULL))
+			differ++;
+	}
+	assert(differ > NB_FLOWS - 4);
+
+	for (i = 0; i < NB_FLOWS; i++)
+		trace_destroy_packet(packets[i]);
+	trace_destroy_packet(packet);
+	printf("success\n");
+	return 0;
+}